@@ -0,0 +1,757 @@
+/*============================================================================
+
+  blitter.c
+
+  Implementation of the "methods" defined in blitter.h.
+
+  Each conversion routine ("kernel") converts one row of pixels. The
+  common conversions -- from the 32-bit format that text is usually
+  composed in, to the formats of real framebuffers -- have their own
+  kernels, which work on four pixels at a time using GCC's vector 
+  extensions. These compile to SSE on x86 and NEON on ARM, without
+  any platform-specific code. Everything else goes through a generic 
+  kernel that unpacks each pixel to separate components and packs 
+  it again, which is slow, but correct for any pair of formats.
+
+  Blending uses premultiplied alpha, so each component is just
+  src + dest * (255 - alpha) / 255. The division by 255 is done
+  with the usual shift-and-add approximation, which is exact for
+  all the products that can occur. 
+
+  Dithering to 16 bpp can be done in two ways. Error diffusion carries
+  each pixel's rounding error along the row to the next pixel. That
+  removes most of the banding in anti-aliased edges, but each pixel
+  depends on the one before, so it can't be vectorised. Ordered 
+  dithering adds a threshold from an 8x8 Bayer matrix, depending only
+  on the pixel's position, before truncating. The matrix is scaled
+  to thresholds when the blitter is created, so the kernel just
+  multiplies, adds a vector of thresholds, and divides -- no branches,
+  and four pixels at a time.
+
+  Like the rest of the drawing code, this assumes a little-endian CPU,
+  so that a 32-bit BGRX pixel has blue in the low byte.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include "defs.h"
+#include "log.h"
+#include "blitter.h"
+
+typedef uint32_t u32x4 __attribute__ ((vector_size (16)));
+typedef uint16_t u16x4 __attribute__ ((vector_size (8)));
+
+/** A kernel converts width pixels of one row. (x,y) is the position of
+    the first destination pixel, for kernels that dither. */
+typedef void (*BlitKernel) (const struct _Blitter *self, BYTE *dest, 
+               const BYTE *src, int width, int x, int y);
+
+// Size of the ordered dither matrix -- must be a power of two
+#define BLIT_BAYER 8
+
+struct _Blitter
+  {
+  SurfaceFormat src_format;
+  SurfaceFormat dest_format;
+  int src_bpp;
+  int dest_bpp;
+  int flags;
+  BlitKernel kernel;
+  const char *name;
+  // Ordered dither thresholds for each row of the matrix, from 0 to
+  //  254. The row is repeated past its end, so that four consecutive 
+  //  entries can be loaded from any starting position.
+  uint32_t thresholds [BLIT_BAYER][BLIT_BAYER + 4];
+  };
+
+// The classic 8x8 Bayer index matrix: each value from 0 to 63 appears
+//  once, and values that are close together are far apart in space
+static const BYTE blit_bayer [BLIT_BAYER][BLIT_BAYER] = 
+  {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+  };
+
+
+/*==========================================================================
+  blit_div255
+
+  Divide a product of two 8-bit values by 255, rounding
+
+*==========================================================================*/
+static inline int blit_div255 (int v)
+  {
+  v += 128;
+  return (v + (v >> 8)) >> 8;
+  }
+
+
+/*==========================================================================
+  blit_unpack
+
+  Get the components of a pixel. Formats without alpha are opaque.
+
+*==========================================================================*/
+static inline void blit_unpack (SurfaceFormat format, const BYTE *p,
+      int *r, int *g, int *b, int *a)
+  {
+  switch (format)
+    {
+    case SURFACE_FORMAT_BGRX8888:
+    case SURFACE_FORMAT_BGR888:
+      *b = p[0]; *g = p[1]; *r = p[2]; *a = 255;
+      break;
+    case SURFACE_FORMAT_BGRA8888:
+      *b = p[0]; *g = p[1]; *r = p[2]; *a = p[3];
+      break;
+    case SURFACE_FORMAT_RGB888:
+      *r = p[0]; *g = p[1]; *b = p[2]; *a = 255;
+      break;
+    case SURFACE_FORMAT_RGB565:
+      {
+      int v = *(const uint16_t *)p;
+      int r5 = v >> 11, g6 = (v >> 5) & 0x3f, b5 = v & 0x1f;
+      // Replicate the top bits into the bottom, so that full intensity
+      //  maps to 255
+      *r = (r5 << 3) | (r5 >> 2);
+      *g = (g6 << 2) | (g6 >> 4);
+      *b = (b5 << 3) | (b5 >> 2);
+      *a = 255;
+      }
+      break;
+    default:
+      // No surface has any other format, but an unknown pixel should
+      //  still come out as something
+      *r = *g = *b = 0;
+      *a = 255;
+    }
+  }
+
+
+/*==========================================================================
+  blit_pack
+*==========================================================================*/
+static inline void blit_pack (SurfaceFormat format, BYTE *p,
+      int r, int g, int b, int a)
+  {
+  switch (format)
+    {
+    case SURFACE_FORMAT_BGRA8888:
+      p[0] = b; p[1] = g; p[2] = r; p[3] = a;
+      break;
+    case SURFACE_FORMAT_BGRX8888:
+      p[3] = 0;
+      // Fall through
+    case SURFACE_FORMAT_BGR888:
+      p[0] = b; p[1] = g; p[2] = r;
+      break;
+    case SURFACE_FORMAT_RGB888:
+      p[0] = r; p[1] = g; p[2] = b;
+      break;
+    case SURFACE_FORMAT_RGB565:
+      *(uint16_t *)p = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+      break;
+    }
+  }
+
+
+/*==========================================================================
+  blit_dither_component
+
+  Add the error carried from the last pixel to a component, quantize
+  it to the specified number of bits, and work out the error to carry
+  to the next pixel. Returns the quantized value, expanded back to 
+  eight bits so that blit_pack() can reduce it again exactly.
+
+*==========================================================================*/
+static inline int blit_dither_component (int c, int bits, int *error)
+  {
+  int v = c + *error;
+  if (v < 0) v = 0;
+  if (v > 255) v = 255;
+  int q = v >> (8 - bits);
+  int expanded = (q << (8 - bits)) | (q >> (2 * bits - 8));
+  *error = v - expanded;
+  return expanded;
+  }
+
+
+/*==========================================================================
+  blit_order_component
+
+  Quantize a component to the specified number of bits, adding an 
+  ordered dither threshold first. The maximum value in n bits, 2^n - 1,
+  corresponds to 255, so the component is scaled by that, rather than
+  just shifted. Returns the quantized value expanded back to eight 
+  bits, like blit_dither_component().
+
+*==========================================================================*/
+static inline int blit_order_component (int c, int bits, int t)
+  {
+  int v = c * ((1 << bits) - 1) + t;
+  int q = (v + 1 + (v >> 8)) >> 8; // v / 255
+  return (q << (8 - bits)) | (q >> (2 * bits - 8));
+  }
+
+
+/*==========================================================================
+  blit_generic
+
+  Convert any format to any other, a pixel at a time 
+
+*==========================================================================*/
+static void blit_generic (const Blitter *self, BYTE *dest, const BYTE *src,
+      int width, int x, int y)
+  {
+  BOOL blend = self->src_format == SURFACE_FORMAT_BGRA8888;
+  BOOL to_565 = self->dest_format == SURFACE_FORMAT_RGB565
+    && self->src_format != SURFACE_FORMAT_RGB565;
+  BOOL ordered = to_565 && (self->flags & BLITTER_DITHER_ORDERED);
+  BOOL dither = to_565 && (self->flags & BLITTER_DITHER);
+  const uint32_t *thresholds = self->thresholds[y & (BLIT_BAYER - 1)];
+  int er = 0, eg = 0, eb = 0;
+
+  for (int i = 0; i < width; i++)
+    {
+    int r, g, b, a;
+    blit_unpack (self->src_format, src, &r, &g, &b, &a);
+    if (blend && a < 255)
+      {
+      int dr, dg, db, da;
+      blit_unpack (self->dest_format, dest, &dr, &dg, &db, &da);
+      int ia = 255 - a;
+      r += blit_div255 (dr * ia);
+      g += blit_div255 (dg * ia);
+      b += blit_div255 (db * ia);
+      a += blit_div255 (da * ia);
+      }
+    if (ordered)
+      {
+      int t = thresholds[(x + i) & (BLIT_BAYER - 1)];
+      r = blit_order_component (r, 5, t);
+      g = blit_order_component (g, 6, t);
+      b = blit_order_component (b, 5, t);
+      }
+    else if (dither)
+      {
+      r = blit_dither_component (r, 5, &er);
+      g = blit_dither_component (g, 6, &eg);
+      b = blit_dither_component (b, 5, &eb);
+      }
+    blit_pack (self->dest_format, dest, r, g, b, a);
+    src += self->src_bpp;
+    dest += self->dest_bpp;
+    }
+  }
+
+
+/*==========================================================================
+  blit_copy
+
+  Same format, no blending
+
+*==========================================================================*/
+static void blit_copy (const Blitter *self, BYTE *dest, const BYTE *src,
+      int width, int x, int y)
+  {
+  (void)x; (void)y;
+  memcpy (dest, src, width * self->dest_bpp);
+  }
+
+
+/*==========================================================================
+  blit_to_rgb565_4
+
+  Pack four 32-bit pixels into 16 bits each
+
+*==========================================================================*/
+static inline u16x4 blit_to_rgb565_4 (u32x4 p)
+  {
+  u32x4 v = ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+  return __builtin_convertvector (v, u16x4);
+  }
+
+
+/*==========================================================================
+  blit_from_rgb565_4
+
+  Unpack four 16-bit pixels into 32 bits each, with the alpha byte 0
+
+*==========================================================================*/
+static inline u32x4 blit_from_rgb565_4 (u16x4 p)
+  {
+  u32x4 v = __builtin_convertvector (p, u32x4);
+  u32x4 r = (v >> 11) & 0x1f;
+  u32x4 g = (v >> 5) & 0x3f;
+  u32x4 b = v & 0x1f;
+  r = (r << 3) | (r >> 2);
+  g = (g << 2) | (g >> 4);
+  b = (b << 3) | (b >> 2);
+  return (r << 16) | (g << 8) | b;
+  }
+
+
+/*==========================================================================
+  blit_blend_4
+
+  Blend four premultiplied BGRA pixels onto four 32-bit pixels. Blue
+  and red, and green and alpha, are worked on in pairs, each pair in
+  the two 16-bit halves of a 32-bit lane.
+
+*==========================================================================*/
+static inline u32x4 blit_blend_4 (u32x4 s, u32x4 d)
+  {
+  u32x4 ia = 255 - (s >> 24);
+  u32x4 rb = (d & 0x00ff00ff) * ia + 0x00800080;
+  u32x4 ga = ((d >> 8) & 0x00ff00ff) * ia + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+  ga = (ga + ((ga >> 8) & 0x00ff00ff)) & 0xff00ff00;
+  return s + (rb | ga);
+  }
+
+
+/*==========================================================================
+  blit_to_rgb565_ordered_4
+
+  Pack four 32-bit pixels into 16 bits each, with ordered dithering, 
+  as blit_order_component() does. The results can't exceed the 
+  maximum for each component, so there's nothing to clamp.
+
+*==========================================================================*/
+static inline u16x4 blit_to_rgb565_ordered_4 (u32x4 p, u32x4 t)
+  {
+  u32x4 b = (p & 0xff) * 31 + t;
+  u32x4 g = ((p >> 8) & 0xff) * 63 + t;
+  u32x4 r = ((p >> 16) & 0xff) * 31 + t;
+  b = (b + 1 + (b >> 8)) >> 8;
+  g = (g + 1 + (g >> 8)) >> 8;
+  r = (r + 1 + (r >> 8)) >> 8;
+  return __builtin_convertvector ((r << 11) | (g << 5) | b, u16x4);
+  }
+
+
+/*==========================================================================
+  blit_thresholds_4
+
+  Get the ordered dither thresholds for four pixels, starting at (x,y)
+
+*==========================================================================*/
+static inline u32x4 blit_thresholds_4 (const Blitter *self, int x, int y)
+  {
+  u32x4 t;
+  memcpy (&t, &self->thresholds[y & (BLIT_BAYER - 1)]
+    [x & (BLIT_BAYER - 1)], sizeof (t));
+  return t;
+  }
+
+
+/*==========================================================================
+  blit_bgrx_to_rgb565
+*==========================================================================*/
+static void blit_bgrx_to_rgb565 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 p;
+    memcpy (&p, src + i * 4, sizeof (p));
+    u16x4 q = blit_to_rgb565_4 (p);
+    memcpy (dest + i * 2, &q, sizeof (q));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 2, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_bgrx_to_rgb565_ordered
+*==========================================================================*/
+static void blit_bgrx_to_rgb565_ordered (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 p;
+    memcpy (&p, src + i * 4, sizeof (p));
+    u16x4 q = blit_to_rgb565_ordered_4 (p, 
+      blit_thresholds_4 (self, x + i, y));
+    memcpy (dest + i * 2, &q, sizeof (q));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 2, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_rgb565_to_bgrx
+*==========================================================================*/
+static void blit_rgb565_to_bgrx (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u16x4 p;
+    memcpy (&p, src + i * 2, sizeof (p));
+    u32x4 q = blit_from_rgb565_4 (p);
+    memcpy (dest + i * 4, &q, sizeof (q));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 4, src + i * 2, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_bgrx_to_bgra
+
+  Copy, making every pixel opaque
+
+*==========================================================================*/
+static void blit_bgrx_to_bgra (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 p;
+    memcpy (&p, src + i * 4, sizeof (p));
+    p |= 0xff000000;
+    memcpy (dest + i * 4, &p, sizeof (p));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 4, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_bgrx_to_bgr888
+
+  Dropping the fourth byte doesn't suit vectors, but this is still 
+  much quicker than the generic kernel
+
+*==========================================================================*/
+static void blit_bgrx_to_bgr888 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  (void)self; (void)x; (void)y;
+  for (int i = 0; i < width; i++)
+    {
+    dest[0] = src[0];
+    dest[1] = src[1];
+    dest[2] = src[2];
+    src += 4;
+    dest += 3;
+    }
+  }
+
+
+/*==========================================================================
+  blit_to_rgb888_4
+
+  Write four 32-bit pixels as twelve bytes of red, green, and blue. 
+  Swapping red and blue suits vectors, but squeezing out the fourth 
+  byte of each pixel would need a byte shuffle, which older x86 CPUs 
+  don't have; so that is done with shifts on three 32-bit words
+
+*==========================================================================*/
+static inline void blit_to_rgb888_4 (BYTE *dest, u32x4 p)
+  {
+  u32x4 q = ((p >> 16) & 0xff) | (p & 0xff00) | ((p & 0xff) << 16);
+  uint32_t w[3];
+  w[0] = q[0] | (q[1] << 24);
+  w[1] = (q[1] >> 8) | (q[2] << 16);
+  w[2] = (q[2] >> 16) | (q[3] << 8);
+  memcpy (dest, w, sizeof (w));
+  }
+
+
+/*==========================================================================
+  blit_bgrx_to_rgb888
+*==========================================================================*/
+static void blit_bgrx_to_rgb888 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 p;
+    memcpy (&p, src + i * 4, sizeof (p));
+    blit_to_rgb888_4 (dest + i * 3, p);
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 3, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_rgb565_to_rgb888
+*==========================================================================*/
+static void blit_rgb565_to_rgb888 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u16x4 p;
+    memcpy (&p, src + i * 2, sizeof (p));
+    blit_to_rgb888_4 (dest + i * 3, blit_from_rgb565_4 (p));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 3, src + i * 2, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_swap_rb888
+
+  Convert between BGR888 and RGB888, which is the same operation 
+  either way round
+
+*==========================================================================*/
+static void blit_swap_rb888 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  (void)self; (void)x; (void)y;
+  for (int i = 0; i < width; i++)
+    {
+    dest[0] = src[2];
+    dest[1] = src[1];
+    dest[2] = src[0];
+    src += 3;
+    dest += 3;
+    }
+  }
+
+
+/*==========================================================================
+  blit_bgra_over_bgrx
+
+  Blend onto a 32-bit surface. If the surface has no alpha, the unused
+  byte is kept at zero.
+
+*==========================================================================*/
+static void blit_bgra_over_bgrx (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  uint32_t keep = self->dest_format == SURFACE_FORMAT_BGRA8888 ?
+    0xffffffff : 0x00ffffff;
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 s, d;
+    memcpy (&s, src + i * 4, sizeof (s));
+    memcpy (&d, dest + i * 4, sizeof (d));
+    d = blit_blend_4 (s, d) & keep;
+    memcpy (dest + i * 4, &d, sizeof (d));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 4, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_bgra_over_rgb565
+*==========================================================================*/
+static void blit_bgra_over_rgb565 (const Blitter *self, BYTE *dest, 
+      const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 s;
+    u16x4 d;
+    memcpy (&s, src + i * 4, sizeof (s));
+    memcpy (&d, dest + i * 2, sizeof (d));
+    d = blit_to_rgb565_4 (blit_blend_4 (s, blit_from_rgb565_4 (d)));
+    memcpy (dest + i * 2, &d, sizeof (d));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 2, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blit_bgra_over_rgb565_ordered
+*==========================================================================*/
+static void blit_bgra_over_rgb565_ordered (const Blitter *self, 
+      BYTE *dest, const BYTE *src, int width, int x, int y)
+  {
+  int i = 0;
+  for (; i + 4 <= width; i += 4)
+    {
+    u32x4 s;
+    u16x4 d;
+    memcpy (&s, src + i * 4, sizeof (s));
+    memcpy (&d, dest + i * 2, sizeof (d));
+    u32x4 p = blit_blend_4 (s, blit_from_rgb565_4 (d));
+    d = blit_to_rgb565_ordered_4 (p, 
+      blit_thresholds_4 (self, x + i, y));
+    memcpy (dest + i * 2, &d, sizeof (d));
+    }
+  if (i < width) 
+    blit_generic (self, dest + i * 2, src + i * 4, width - i, x + i, y);
+  }
+
+
+/*==========================================================================
+  blitter_make_thresholds
+
+  Scale the Bayer matrix to thresholds spread evenly over a 
+  quantization step, which is 255 once a component has been scaled 
+  to the output range. Adding a threshold and then truncating rounds
+  up with a probability equal to the fraction that would otherwise be
+  lost, so each 8x8 block has the right average brightness.
+
+*==========================================================================*/
+static void blitter_make_thresholds (Blitter *self)
+  {
+  int n = BLIT_BAYER * BLIT_BAYER;
+  for (int y = 0; y < BLIT_BAYER; y++)
+    {
+    for (int x = 0; x < BLIT_BAYER + 4; x++)
+      {
+      int m = blit_bayer[y][x & (BLIT_BAYER - 1)];
+      self->thresholds[y][x] = (2 * m + 1) * 255 / (2 * n);
+      }
+    }
+  }
+
+
+/*==========================================================================
+  blitter_choose
+
+  Choose the kernel for a pair of formats
+
+*==========================================================================*/
+static void blitter_choose (Blitter *self)
+  {
+  SurfaceFormat s = self->src_format;
+  SurfaceFormat d = self->dest_format;
+  BOOL to_565 = d == SURFACE_FORMAT_RGB565 && s != SURFACE_FORMAT_RGB565;
+
+  self->kernel = blit_generic;
+  self->name = "generic";
+  if (to_565 && (self->flags & BLITTER_DITHER_ORDERED))
+    {
+    self->name = "generic, ordered dither";
+    if (s == SURFACE_FORMAT_BGRX8888)
+      { 
+      self->kernel = blit_bgrx_to_rgb565_ordered; 
+      self->name = "BGRX to RGB565, ordered dither"; 
+      }
+    else if (s == SURFACE_FORMAT_BGRA8888)
+      { 
+      self->kernel = blit_bgra_over_rgb565_ordered; 
+      self->name = "blend to RGB565, ordered dither"; 
+      }
+    return;
+    }
+  if (to_565 && (self->flags & BLITTER_DITHER))
+    {
+    // Error diffusion is inherently serial
+    self->name = "generic, error diffusion";
+    return;
+    }
+
+  if (s == d && s != SURFACE_FORMAT_BGRA8888)
+    { self->kernel = blit_copy; self->name = "copy"; }
+  else if (s == SURFACE_FORMAT_BGRX8888 && d == SURFACE_FORMAT_RGB565)
+    { self->kernel = blit_bgrx_to_rgb565; self->name = "BGRX to RGB565"; }
+  else if (s == SURFACE_FORMAT_RGB565 && d == SURFACE_FORMAT_BGRX8888)
+    { self->kernel = blit_rgb565_to_bgrx; self->name = "RGB565 to BGRX"; }
+  else if (s == SURFACE_FORMAT_BGRX8888 && d == SURFACE_FORMAT_BGRA8888)
+    { self->kernel = blit_bgrx_to_bgra; self->name = "BGRX to BGRA"; }
+  else if (s == SURFACE_FORMAT_BGRX8888 && d == SURFACE_FORMAT_BGR888)
+    { self->kernel = blit_bgrx_to_bgr888; self->name = "BGRX to BGR"; }
+  else if (s == SURFACE_FORMAT_BGRX8888 && d == SURFACE_FORMAT_RGB888)
+    { self->kernel = blit_bgrx_to_rgb888; self->name = "BGRX to RGB"; }
+  else if (s == SURFACE_FORMAT_RGB565 && d == SURFACE_FORMAT_RGB888)
+    { self->kernel = blit_rgb565_to_rgb888; self->name = "RGB565 to RGB"; }
+  else if ((s == SURFACE_FORMAT_BGR888 && d == SURFACE_FORMAT_RGB888)
+        || (s == SURFACE_FORMAT_RGB888 && d == SURFACE_FORMAT_BGR888))
+    { self->kernel = blit_swap_rb888; self->name = "swap red and blue"; }
+  else if (s == SURFACE_FORMAT_BGRA8888 && (d == SURFACE_FORMAT_BGRX8888
+        || d == SURFACE_FORMAT_BGRA8888))
+    { self->kernel = blit_bgra_over_bgrx; self->name = "blend to 32 bpp"; }
+  else if (s == SURFACE_FORMAT_BGRA8888 && d == SURFACE_FORMAT_RGB565)
+    { self->kernel = blit_bgra_over_rgb565; self->name = "blend to RGB565"; }
+  }
+
+
+/*==========================================================================
+  blitter_create
+*==========================================================================*/
+Blitter *blitter_create (SurfaceFormat src_format, 
+      SurfaceFormat dest_format, int flags)
+  {
+  LOG_IN
+  Blitter *self = malloc (sizeof (Blitter));
+  memset (self, 0, sizeof (Blitter));
+  self->src_format = src_format;
+  self->dest_format = dest_format;
+  self->src_bpp = surface_format_bytes (src_format);
+  self->dest_bpp = surface_format_bytes (dest_format);
+  self->flags = flags;
+  blitter_make_thresholds (self);
+  blitter_choose (self);
+  log_debug ("Blitter uses %s kernel", self->name);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  blitter_destroy
+*==========================================================================*/
+void blitter_destroy (Blitter *self)
+  {
+  LOG_IN
+  free (self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  blitter_blit
+*==========================================================================*/
+void blitter_blit (const Blitter *self, Surface *dest, int x, int y, 
+      const Surface *src, int src_x, int src_y, int width, int height)
+  {
+  if (src->format != self->src_format || dest->format != self->dest_format)
+    {
+    log_warning ("Blitter used with surfaces of the wrong formats");
+    return;
+    }
+  if (!surface_clip_copy (dest, &x, &y, src, &src_x, &src_y, 
+       &width, &height)) return;
+
+  for (int i = 0; i < height; i++)
+    self->kernel (self, dest->data + (y + i) * dest->stride 
+        + x * self->dest_bpp,
+      src->data + (src_y + i) * src->stride + src_x * self->src_bpp,
+      width, x, y + i);
+  }
+
+
+/*==========================================================================
+  blitter_get_name
+*==========================================================================*/
+const char *blitter_get_name (const Blitter *self)
+  {
+  return self->name;
+  }
+
@@ -0,0 +1,57 @@
+/*============================================================================
+
+  blitter.h
+
+  A "class" that copies rectangles of pixels from one surface to 
+  another, converting between pixel formats. The conversion routine
+  is chosen once, when the blitter is created, for the particular
+  pair of formats, so nothing is decided per pixel. A source with
+  alpha is blended onto the destination; other sources are copied.
+
+  The usual sequence of operations is
+  blitter_create
+  blitter_blit (probably many times)
+  blitter_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "surface.h"
+
+// Flags for blitter_create(). Dithering only affects conversion to 
+//  formats with fewer bits per channel -- at present, RGB565.
+#define BLITTER_DITHER         1 // Dither by error diffusion along rows
+#define BLITTER_DITHER_ORDERED 2 // Dither with a Bayer threshold matrix
+
+struct _Blitter;
+typedef struct _Blitter Blitter;
+
+BEGIN_DECLS
+
+/** Create a blitter from surfaces of src_format to surfaces of
+    dest_format. Every pair of formats is supported. This method 
+    always succeeds, and must eventually be followed by a call to 
+    blitter_destroy(). */
+Blitter         *blitter_create (SurfaceFormat src_format, 
+                   SurfaceFormat dest_format, int flags);
+
+/** Free the blitter. */
+void             blitter_destroy (Blitter *self);
+
+/** Copy, or blend, a width x height rectangle with its top-left corner
+    at (src_x,src_y) in src, to (x,y) in dest. The rectangle is clipped
+    to both surfaces, which must have the formats given to 
+    blitter_create(), and must not overlap in memory. */
+void             blitter_blit (const Blitter *self, Surface *dest, 
+                   int x, int y, const Surface *src, int src_x, int src_y,
+                   int width, int height);
+
+/** Get a short description of the conversion routine, for logging. */
+const char      *blitter_get_name (const Blitter *self);
+
+END_DECLS
+
@@ -0,0 +1,111 @@
+/*============================================================================
+
+  caret.c
+
+  Implementation of the "methods" defined in caret.h.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "caret.h"
+
+struct _Caret
+  {
+  Surface *surface;
+  Surface *saved; // The pixels under the caret, while it is shown
+  int width;
+  int height;
+  BYTE r;
+  BYTE g;
+  BYTE b;
+  BOOL shown;
+  int x; // Where the caret is shown
+  int y;
+  };
+
+
+/*==========================================================================
+  caret_create
+*==========================================================================*/
+Caret *caret_create (Surface *surface, int width, int height,
+      BYTE r, BYTE g, BYTE b)
+  {
+  LOG_IN
+  Caret *self = malloc (sizeof (Caret));
+  memset (self, 0, sizeof (Caret));
+  self->surface = surface;
+  self->width = width;
+  self->height = height;
+  self->r = r;
+  self->g = g;
+  self->b = b;
+  self->saved = surface_create (width, height, surface->format);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  caret_destroy
+*==========================================================================*/
+void caret_destroy (Caret *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    surface_destroy (self->saved);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  caret_show
+*==========================================================================*/
+void caret_show (Caret *self, int x, int y)
+  {
+  if (self->shown)
+    {
+    if (x == self->x && y == self->y) return;
+    caret_hide (self);
+    }
+  // surface_blit() clips both ways alike, so a caret that is partly off
+  //  the surface is saved and restored consistently
+  surface_blit (self->saved, 0, 0, self->surface, x, y, self->width,
+    self->height);
+  surface_fill_rect (self->surface, x, y, self->width, self->height,
+    self->r, self->g, self->b);
+  self->x = x;
+  self->y = y;
+  self->shown = TRUE;
+  }
+
+
+/*==========================================================================
+  caret_hide
+*==========================================================================*/
+void caret_hide (Caret *self)
+  {
+  if (!self->shown) return;
+  surface_blit (self->surface, self->x, self->y, self->saved, 0, 0,
+    self->width, self->height);
+  self->shown = FALSE;
+  }
+
+
+/*==========================================================================
+  caret_get_height
+*==========================================================================*/
+int caret_get_height (const Caret *self)
+  {
+  return self->height;
+  }
+
@@ -0,0 +1,57 @@
+/*============================================================================
+
+  caret.h
+
+  A "class" that shows a cursor, or text caret, over what is already on
+  a surface, without disturbing it. When the caret is shown, the pixels
+  under it are saved into a small surface of their own, and when it is
+  hidden they are copied back, so the text underneath never has to be
+  redrawn -- blinking the caret costs two copies of a rectangle the
+  size of the caret, however much text is on the screen.
+
+  Whatever draws on the surface must hide the caret before drawing
+  anything that might overlap it, and show it again afterwards;
+  otherwise hiding the caret would put back stale pixels.
+
+  The usual sequence of operations is
+  caret_create
+  caret_show, caret_hide (probably many times)
+  caret_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "surface.h"
+
+struct _Caret;
+typedef struct _Caret Caret;
+
+BEGIN_DECLS
+
+/** Create a caret that is drawn on the surface as a solid rectangle
+    of the specified size and colour. The caret is initially hidden.
+    This method always succeeds, and must eventually be followed by a
+    call to caret_destroy(). */
+Caret           *caret_create (Surface *surface, int width, int height,
+                   BYTE r, BYTE g, BYTE b);
+
+/** Free the caret. If it is shown, it stays on the surface. */
+void             caret_destroy (Caret *self);
+
+/** Show the caret with its top-left corner at (x,y), first hiding it
+    if it is shown somewhere else. */
+void             caret_show (Caret *self, int x, int y);
+
+/** Hide the caret, putting back what was under it. Nothing happens if
+    it is not shown. */
+void             caret_hide (Caret *self);
+
+/** Get the height of the caret in pixels. */
+int              caret_get_height (const Caret *self);
+
+END_DECLS
+
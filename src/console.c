@@ -0,0 +1,612 @@
+/*============================================================================
+
+  console.c
+
+  Implementation of the "methods" defined in console.h.
+
+  There are two buffers of cells: the one that text is written to,
+  and a copy of what is actually on the screen. console_update()
+  compares them, and draws only the cells that differ.
+
+  Each distinct character, in each combination of the attributes that
+  change its shape, is rendered once into a bitmap of exactly one
+  cell, with the glyph already placed on the baseline. Drawing a cell
+  is then one call to surface_mix_coverage(), which writes every pixel
+  of the cell in the foreground and background colours -- no
+  clearing, no clipping of glyphs to their neighbours, and no reading
+  of the screen. The cell bitmaps are kept in a hash table, and never
+  discarded: a console only ever shows a few hundred distinct
+  characters.
+
+  The cell buffer is a ring of rows, so scrolling just blanks the top
+  row, makes it the bottom one, and remembers how far the console has
+  scrolled -- text pours through at the same cost however large the
+  screen is. At the next update, the pixels on the screen are moved up
+  by the same amount, and the copy of the screen's cells with them, so
+  only the cells that differ after the move -- usually just the new
+  bottom row -- are drawn.
+
+  The cursor is a Caret: an underline across the cursor's cell, drawn
+  over the text and taken away again by copying back the pixels it
+  covered. console_update() takes it away before drawing anything, so
+  the pixels it saved are never stale, and puts it back afterwards.
+  Blinking just shows or hides the caret, so a blinking cursor redraws
+  no text at all.
+
+  A cell holds one character, so a mark that continues the grapheme 
+  cluster of the character before it -- a combining accent, say, or
+  an emoji modifier -- has nowhere to go. If the character and the
+  mark have a precomposed form, as an "e" and a combining acute accent
+  do, the character is replaced by it; otherwise, rather than take a
+  cell of its own, and appear a cell away from the character it 
+  belongs to, the mark is dropped, as the Linux console does. Either
+  way, the cursor doesn't move.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "caret.h"
+#include "grapheme.h"
+#include "normalize.h"
+#include "console.h"
+
+// Number of hash buckets for cell bitmaps -- must be a power of two
+#define CONSOLE_BUCKETS 512
+
+// Tab stops are at multiples of this
+#define CONSOLE_TAB 8
+
+// Attributes that change the shape of the cell bitmap, rather than
+//  just its colours
+#define CONSOLE_SHAPE_ATTRS \
+  (CONSOLE_ATTR_BOLD | CONSOLE_ATTR_ITALIC | CONSOLE_ATTR_UNDERLINE)
+
+// A character that is never drawn, to mark cells of the screen whose
+//  contents are unknown
+#define CONSOLE_INVALID ((UTF32)-1)
+
+typedef struct _CellBitmap
+  {
+  UTF32 c;
+  int attrs; // The CONSOLE_SHAPE_ATTRS it was rendered with
+  BYTE *coverage; // cell_width x cell_height coverage values
+  struct _CellBitmap *next; // Next bitmap in the same hash bucket
+  } CellBitmap;
+
+struct _Console
+  {
+  Surface *surface;
+  GlyphCache *glyphs;
+  int cell_width;
+  int cell_height;
+  int shift; // Distance from the top of a glyph cache cell to ours
+  int cols;
+  int rows;
+  ConsoleCell *cells; // What should be on the screen
+  int top; // The row of cells that is at the top of the screen
+  ConsoleCell *shown; // What is on the screen
+  int scrolled; // Rows scrolled since the last update
+  int col; // The cursor position
+  int row;
+  ConsoleCell pen; // Colours and attributes for new characters
+  CellBitmap *buckets [CONSOLE_BUCKETS];
+  BYTE palette [256][3];
+  Caret *caret;
+  BOOL cursor_visible; // TRUE unless the cursor has been turned off
+  BOOL blink_on; // TRUE in the part of a blink that shows the cursor
+  int cursor_x; // Where the caret goes, as of the last update
+  int cursor_y;
+  GraphemeState cluster; // The characters written since the cursor 
+                         //   last moved other than by writing
+  };
+
+
+/*==========================================================================
+  console_make_palette
+
+  Fill in the standard 256-colour terminal palette
+
+*==========================================================================*/
+static void console_make_palette (Console *self)
+  {
+  static const BYTE basic [16][3] =
+    {
+      {   0,   0,   0 }, { 170,   0,   0 }, {   0, 170,   0 },
+      { 170,  85,   0 }, {   0,   0, 170 }, { 170,   0, 170 },
+      {   0, 170, 170 }, { 170, 170, 170 }, {  85,  85,  85 },
+      { 255,  85,  85 }, {  85, 255,  85 }, { 255, 255,  85 },
+      {  85,  85, 255 }, { 255,  85, 255 }, {  85, 255, 255 },
+      { 255, 255, 255 }
+    };
+  static const BYTE levels [6] = { 0, 95, 135, 175, 215, 255 };
+
+  memcpy (self->palette, basic, sizeof (basic));
+  for (int i = 0; i < 216; i++)
+    {
+    self->palette[16 + i][0] = levels[i / 36];
+    self->palette[16 + i][1] = levels[(i / 6) % 6];
+    self->palette[16 + i][2] = levels[i % 6];
+    }
+  for (int i = 0; i < 24; i++)
+    {
+    BYTE v = 8 + 10 * i;
+    self->palette[232 + i][0] = v;
+    self->palette[232 + i][1] = v;
+    self->palette[232 + i][2] = v;
+    }
+  }
+
+
+/*==========================================================================
+  console_blank
+
+  Fill cells with spaces in the current colours
+
+*==========================================================================*/
+static void console_blank (Console *self, ConsoleCell *cells, int n)
+  {
+  for (int i = 0; i < n; i++)
+    {
+    cells[i] = self->pen;
+    cells[i].c = ' ';
+    }
+  }
+
+
+/*==========================================================================
+  console_create
+*==========================================================================*/
+Console *console_create (Surface *surface, GlyphCache *glyphs)
+  {
+  LOG_IN
+  Console *self = malloc (sizeof (Console));
+  memset (self, 0, sizeof (Console));
+  self->surface = surface;
+  self->glyphs = glyphs;
+
+  // The glyph cache's cells have room for the tallest glyph in the
+  //  face, which is more than the line spacing, so glyphs are moved
+  //  up to put the baseline where the face's ascender says it should
+  //  be
+  FT_Face face = glyphcache_get_face (glyphs);
+  self->cell_height = face->size->metrics.height / 64;
+  self->shift = glyphcache_get_ascent (glyphs)
+    - face->size->metrics.ascender / 64;
+  const char *samples = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  for (const char *s = samples; *s; s++)
+    {
+    const CachedGlyph *g = glyphcache_get (glyphs, *s,
+      GLYPH_STYLE_REGULAR);
+    if (g->advance > self->cell_width) self->cell_width = g->advance;
+    }
+  if (self->cell_width < 1) self->cell_width = 1;
+  if (self->cell_height < 1) self->cell_height = 1;
+
+  self->cols = surface->width / self->cell_width;
+  self->rows = surface->height / self->cell_height;
+  if (self->cols < 1) self->cols = 1;
+  if (self->rows < 1) self->rows = 1;
+  int n = self->cols * self->rows;
+  self->cells = malloc (n * sizeof (ConsoleCell));
+  self->shown = malloc (n * sizeof (ConsoleCell));
+
+  console_make_palette (self);
+  self->pen.fg = CONSOLE_DEFAULT_FG;
+  self->pen.bg = CONSOLE_DEFAULT_BG;
+  console_blank (self, self->cells, n);
+  // Nothing on the screen is known to be a cell, so the first update
+  //  draws everything
+  for (int i = 0; i < n; i++)
+    self->shown[i].c = CONSOLE_INVALID;
+
+  // An underline cursor, like the Linux console's, leaves the
+  //  character under it readable
+  int caret_height = self->cell_height / 8;
+  if (caret_height < 2) caret_height = 2;
+  if (caret_height > self->cell_height) caret_height = self->cell_height;
+  const BYTE *colour = self->palette[CONSOLE_DEFAULT_FG];
+  self->caret = caret_create (surface, self->cell_width, caret_height,
+    colour[0], colour[1], colour[2]);
+  self->cursor_visible = TRUE;
+  self->blink_on = TRUE;
+  grapheme_init (&self->cluster);
+
+  log_debug ("Console has %dx%d cells of %dx%d px", self->cols,
+    self->rows, self->cell_width, self->cell_height);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  console_destroy
+*==========================================================================*/
+void console_destroy (Console *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    int n_bitmaps = 0;
+    for (int i = 0; i < CONSOLE_BUCKETS; i++)
+      {
+      CellBitmap *b = self->buckets[i];
+      while (b)
+        {
+        CellBitmap *next = b->next;
+        free (b->coverage);
+        free (b);
+        b = next;
+        n_bitmaps++;
+        }
+      }
+    log_debug ("Console rendered %d cell bitmaps", n_bitmaps);
+    caret_destroy (self->caret);
+    free (self->cells);
+    free (self->shown);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  console_render_cell
+
+  Render a character into a new cell bitmap
+
+*==========================================================================*/
+static BYTE *console_render_cell (Console *self, UTF32 c, int attrs)
+  {
+  int w = self->cell_width;
+  int h = self->cell_height;
+  BYTE *coverage = calloc (w * h, 1);
+
+  int style = GLYPH_STYLE_REGULAR;
+  if (attrs & CONSOLE_ATTR_BOLD) style |= GLYPH_STYLE_BOLD;
+  if (attrs & CONSOLE_ATTR_ITALIC) style |= GLYPH_STYLE_ITALIC;
+  const CachedGlyph *g = glyphcache_get (self->glyphs, c, style);
+  if (g->buffer)
+    {
+    // Copy the part of the glyph that falls inside the cell
+    int gy = g->y_off - self->shift;
+    for (int i = 0; i < g->rows; i++)
+      {
+      int y = gy + i;
+      if (y < 0 || y >= h) continue;
+      for (int j = g->spans[i].start; j < g->spans[i].end; j++)
+        {
+        int x = g->x_off + j;
+        if (x >= 0 && x < w)
+          coverage[y * w + x] = g->buffer[i * g->pitch + j];
+        }
+      }
+    }
+
+  if (attrs & CONSOLE_ATTR_UNDERLINE)
+    {
+    // One pixel below the baseline, and thicker for larger faces
+    FT_Face face = glyphcache_get_face (self->glyphs);
+    int y = face->size->metrics.ascender / 64 + 1;
+    int thickness = 1 + h / 24;
+    for (int i = y; i < y + thickness && i < h; i++)
+      memset (coverage + i * w, 255, w);
+    }
+  return coverage;
+  }
+
+
+/*==========================================================================
+  console_get_cell_bitmap
+
+  Find the bitmap for a character and attributes, rendering it if
+  necessary
+
+*==========================================================================*/
+static const BYTE *console_get_cell_bitmap (Console *self, UTF32 c,
+      int attrs)
+  {
+  attrs &= CONSOLE_SHAPE_ATTRS;
+  unsigned int bucket = ((unsigned int)c * 31 + attrs)
+    & (CONSOLE_BUCKETS - 1);
+  for (CellBitmap *b = self->buckets[bucket]; b; b = b->next)
+    if (b->c == c && b->attrs == attrs) return b->coverage;
+
+  CellBitmap *b = malloc (sizeof (CellBitmap));
+  b->c = c;
+  b->attrs = attrs;
+  b->coverage = console_render_cell (self, c, attrs);
+  b->next = self->buckets[bucket];
+  self->buckets[bucket] = b;
+  return b->coverage;
+  }
+
+
+/*==========================================================================
+  console_row
+
+  Get the cells of a row of the screen
+
+*==========================================================================*/
+static inline ConsoleCell *console_row (const Console *self, int row)
+  {
+  row += self->top;
+  if (row >= self->rows) row -= self->rows;
+  return self->cells + row * self->cols;
+  }
+
+
+/*==========================================================================
+  console_scroll
+
+  Move the contents of the console up one row
+
+*==========================================================================*/
+static void console_scroll (Console *self)
+  {
+  console_blank (self, console_row (self, 0), self->cols);
+  self->top++;
+  if (self->top == self->rows) self->top = 0;
+  self->scrolled++;
+  }
+
+
+/*==========================================================================
+  console_newline
+*==========================================================================*/
+static void console_newline (Console *self)
+  {
+  self->col = 0;
+  if (self->row == self->rows - 1)
+    console_scroll (self);
+  else
+    self->row++;
+  }
+
+
+/*==========================================================================
+  console_put
+*==========================================================================*/
+void console_put (Console *self, UTF32 c)
+  {
+  if (!grapheme_is_boundary (&self->cluster, c) && grapheme_is_mark (c))
+    {
+    // The cluster's first character was put in the cell before the
+    //  cursor
+    if (self->col > 0)
+      {
+      ConsoleCell *cell = console_row (self, self->row) + self->col - 1;
+      UTF32 composed = normalize_compose (cell->c, c);
+      if (composed) cell->c = composed;
+      }
+    return;
+    }
+  switch (c)
+    {
+    case '\n':
+      console_newline (self);
+      break;
+    case '\r':
+      self->col = 0;
+      break;
+    case '\b':
+      if (self->col > 0) self->col--;
+      break;
+    case '\t':
+      self->col = (self->col / CONSOLE_TAB + 1) * CONSOLE_TAB;
+      if (self->col >= self->cols) self->col = self->cols - 1;
+      break;
+    default:
+      if (c < 32 || c == 127) break;
+      if (self->col >= self->cols) console_newline (self);
+      ConsoleCell *cell = console_row (self, self->row) + self->col;
+      *cell = self->pen;
+      cell->c = c;
+      // The cursor can be one past the last column, so that a
+      //  character in the last column doesn't scroll the console
+      //  until another one follows it
+      self->col++;
+    }
+  }
+
+
+/*==========================================================================
+  console_write
+*==========================================================================*/
+void console_write (Console *self, const UTF32 *text, int len)
+  {
+  for (int i = 0; i < len; i++)
+    console_put (self, text[i]);
+  }
+
+
+/*==========================================================================
+  console_set_colours
+*==========================================================================*/
+void console_set_colours (Console *self, int fg, int bg)
+  {
+  self->pen.fg = fg;
+  self->pen.bg = bg;
+  }
+
+
+/*==========================================================================
+  console_set_attributes
+*==========================================================================*/
+void console_set_attributes (Console *self, int attrs)
+  {
+  self->pen.attrs = attrs;
+  }
+
+
+/*==========================================================================
+  console_move_to
+*==========================================================================*/
+void console_move_to (Console *self, int col, int row)
+  {
+  self->col = col < 0 ? 0 : col >= self->cols ? self->cols - 1 : col;
+  self->row = row < 0 ? 0 : row >= self->rows ? self->rows - 1 : row;
+  grapheme_init (&self->cluster);
+  }
+
+
+/*==========================================================================
+  console_clear
+*==========================================================================*/
+void console_clear (Console *self)
+  {
+  console_blank (self, self->cells, self->cols * self->rows);
+  self->top = 0;
+  self->col = 0;
+  self->row = 0;
+  grapheme_init (&self->cluster);
+  }
+
+
+/*==========================================================================
+  console_erase
+*==========================================================================*/
+void console_erase (Console *self, int col, int row, int n)
+  {
+  if (col < 0) col = 0;
+  while (n > 0 && row < self->rows)
+    {
+    int count = self->cols - col;
+    if (count > n) count = n;
+    if (count > 0 && row >= 0)
+      console_blank (self, console_row (self, row) + col, count);
+    n -= count > 0 ? count : 0;
+    col = 0;
+    row++;
+    }
+  }
+
+
+/*==========================================================================
+  console_apply_scroll
+
+  Move the screen up by the rows the cell buffer has scrolled, so that
+  the cells that were on the screen are still where the buffer says
+
+*==========================================================================*/
+static void console_apply_scroll (Console *self)
+  {
+  int cols = self->cols;
+  int n = self->scrolled;
+  int keep = self->rows - n;
+  self->scrolled = 0;
+  if (keep > 0)
+    {
+    Surface *s = self->surface;
+    // Copying upwards, row by row, is safe within one surface
+    for (int i = 0; i < keep * self->cell_height; i++)
+      surface_blit (s, 0, i, s, 0, i + n * self->cell_height,
+        cols * self->cell_width, 1);
+    memmove (self->shown, self->shown + n * cols,
+      keep * cols * sizeof (ConsoleCell));
+    }
+  else
+    keep = 0;
+  for (int i = keep * cols; i < self->rows * cols; i++)
+    self->shown[i].c = CONSOLE_INVALID;
+  }
+
+
+/*==========================================================================
+  console_update
+*==========================================================================*/
+int console_update (Console *self)
+  {
+  caret_hide (self->caret);
+  if (self->scrolled) console_apply_scroll (self);
+
+  int drawn = 0;
+  for (int row = 0; row < self->rows; row++)
+    {
+    const ConsoleCell *cell = console_row (self, row);
+    ConsoleCell *shown = self->shown + row * self->cols;
+    for (int col = 0; col < self->cols; col++, cell++, shown++)
+      {
+      if (cell->c == shown->c && cell->fg == shown->fg
+          && cell->bg == shown->bg && cell->attrs == shown->attrs)
+        continue;
+      const BYTE *coverage = console_get_cell_bitmap (self, cell->c,
+        cell->attrs);
+      const BYTE *fg = self->palette[cell->fg];
+      const BYTE *bg = self->palette[cell->bg];
+      if (cell->attrs & CONSOLE_ATTR_REVERSE)
+        {
+        const BYTE *t = fg;
+        fg = bg;
+        bg = t;
+        }
+      surface_mix_coverage (self->surface, col * self->cell_width,
+        row * self->cell_height, coverage, self->cell_width,
+        self->cell_height, self->cell_width, fg[0], fg[1], fg[2],
+        bg[0], bg[1], bg[2]);
+      *shown = *cell;
+      drawn++;
+      }
+    }
+
+  // The cursor stays on while text is appearing, and starts blinking
+  //  again when it stops
+  if (drawn) self->blink_on = TRUE;
+  int col = self->col < self->cols ? self->col : self->cols - 1;
+  self->cursor_x = col * self->cell_width;
+  self->cursor_y = (self->row + 1) * self->cell_height
+    - caret_get_height (self->caret);
+  if (self->cursor_visible && self->blink_on)
+    caret_show (self->caret, self->cursor_x, self->cursor_y);
+  return drawn;
+  }
+
+
+/*==========================================================================
+  console_get_size
+*==========================================================================*/
+void console_get_size (const Console *self, int *cols, int *rows)
+  {
+  *cols = self->cols;
+  *rows = self->rows;
+  }
+
+
+/*==========================================================================
+  console_get_cursor
+*==========================================================================*/
+void console_get_cursor (const Console *self, int *col, int *row)
+  {
+  *col = self->col;
+  *row = self->row;
+  }
+
+
+/*==========================================================================
+  console_blink
+*==========================================================================*/
+void console_blink (Console *self)
+  {
+  self->blink_on = !self->blink_on;
+  if (self->cursor_visible && self->blink_on)
+    caret_show (self->caret, self->cursor_x, self->cursor_y);
+  else
+    caret_hide (self->caret);
+  }
+
+
+/*==========================================================================
+  console_set_cursor_visible
+*==========================================================================*/
+void console_set_cursor_visible (Console *self, BOOL visible)
+  {
+  self->cursor_visible = visible;
+  if (!visible) caret_hide (self->caret);
+  }
+
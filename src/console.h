@@ -0,0 +1,134 @@
+/*============================================================================
+
+  console.h
+
+  A "class" that shows text on a grid of fixed-size character cells,
+  like a text console. Every cell is the same size, worked out from
+  the face, so there is no layout: the position of a character on the
+  screen follows directly from its row and column.
+
+  Writing text only changes a buffer of cells in memory.
+  console_update() then draws the cells that differ from what is on
+  the screen, each as a single pre-rendered cell bitmap, so an update
+  that changes a few characters costs a few cells, however large the
+  screen is.
+
+  Colours are indices into the usual 256-colour terminal palette:
+  0-15 are the standard and bright colours, 16-231 a 6x6x6 colour
+  cube, and 232-255 a ramp of greys.
+
+  The usual sequence of operations is
+  console_create
+  console_write, console_set_colours, etc (probably many times)
+  console_update
+  console_blink (periodically, while waiting for more text)
+  console_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "surface.h"
+#include "glyphcache.h"
+
+// Attribute flags -- these can be ORed together
+#define CONSOLE_ATTR_BOLD      1
+#define CONSOLE_ATTR_ITALIC    2
+#define CONSOLE_ATTR_UNDERLINE 4
+#define CONSOLE_ATTR_REVERSE   8
+
+// The colours of text on a new console
+#define CONSOLE_DEFAULT_FG 7 // Light grey
+#define CONSOLE_DEFAULT_BG 0 // Black
+
+/** One character cell. */
+typedef struct _ConsoleCell
+  {
+  UTF32 c; // The character, or a space if the cell is empty
+  BYTE fg; // Foreground colour
+  BYTE bg; // Background colour
+  BYTE attrs; // CONSOLE_ATTR_XXX flags
+  } ConsoleCell;
+
+struct _Console;
+typedef struct _Console Console;
+
+BEGIN_DECLS
+
+/** Create a console that fills the surface with as many whole cells
+    as will fit. The cells are as wide as the widest of the digits and
+    Latin capitals in the face -- which, in a monospaced face, is the
+    width of every character -- and as high as the face's line spacing.
+    The console starts empty, with the cursor at the top left.
+    Nothing is drawn until console_update() is called. This method
+    always succeeds, and must eventually be followed by a call to
+    console_destroy(). */
+Console         *console_create (Surface *surface, GlyphCache *glyphs);
+
+/** Free the console. What is on the screen stays there. */
+void             console_destroy (Console *self);
+
+/** Write characters at the cursor, in the current colours and
+    attributes, moving the cursor on. Text wraps at the right-hand
+    edge, and the console scrolls up when the cursor moves below the
+    bottom row. Newline moves to the start of the next row, as a
+    terminal does with its usual output settings; carriage return,
+    backspace, and tab move the cursor; other control characters are
+    ignored. Since a cell holds only one character, a mark, like a
+    combining accent, that belongs to the character before it is 
+    composed with that character, if they have a precomposed form, and
+    ignored otherwise. */
+void             console_write (Console *self, const UTF32 *text, int len);
+
+/** Write one character, as console_write() does. */
+void             console_put (Console *self, UTF32 c);
+
+/** Set the colours of characters written from now on. */
+void             console_set_colours (Console *self, int fg, int bg);
+
+/** Set the CONSOLE_ATTR_XXX attributes of characters written from
+    now on. */
+void             console_set_attributes (Console *self, int attrs);
+
+/** Move the cursor to a specific cell. Positions outside the grid are
+    moved to the nearest edge. */
+void             console_move_to (Console *self, int col, int row);
+
+/** Clear the whole console, in the current background colour, and
+    move the cursor to the top left. */
+void             console_clear (Console *self);
+
+/** Erase n cells, starting at a specific cell and carrying on along
+    the row and onto the following rows, by filling them with spaces
+    in the current colours. The cursor does not move. */
+void             console_erase (Console *self, int col, int row, int n);
+
+/** Draw the cells that have changed since the last update, and the
+    cursor where it now is. Returns the number of cells drawn. */
+int              console_update (Console *self);
+
+/** Show or hide the cursor, in the part of the blink that shows it.
+    This is meant to be called at a regular interval -- a few times a
+    second -- while the console is waiting for something to show. Only
+    the pixels under the cursor are drawn. */
+void             console_blink (Console *self);
+
+/** Turn the cursor on or off. It is on when the console is created,
+    and appears at the next update. Turning it off takes it off the
+    screen immediately. */
+void             console_set_cursor_visible (Console *self, BOOL visible);
+
+/** Get the number of columns and rows in the grid. */
+void             console_get_size (const Console *self, int *cols,
+                   int *rows);
+
+/** Get the position of the cursor. The column can be one past the
+    last column, when a character has just been written there. */
+void             console_get_cursor (const Console *self, int *col,
+                   int *row);
+
+END_DECLS
+
@@ -0,0 +1,469 @@
+/*============================================================================
+
+  fontmetrics.c
+
+  Implementation of the "methods" defined in fontmetrics.h.
+
+  Characters below FONTMETRICS_DIRECT, which is most text in most
+  western languages, have their advances in simple arrays indexed by
+  character and style. All other characters, and kerning pairs, are
+  in open-addressed hash tables with linear probing. Every kerning pair
+  that has been looked up is stored, even if its value is zero, so
+  that FreeType is only asked about each pair once.
+
+  Nothing here uses atomics or locks: the tables are only written by
+  fontmetrics_prepare() which, by contract, never runs at the same time
+  as a reader. The tables can grow (and move) during preparation, but
+  not during reading.
+
+  Metrics that are read from a face, rather than the glyph cache, come
+  from FT_Get_Advance(), which only loads the glyph's outline, or
+  just reads the font's table of advances when no hinting is needed.
+  Scalable metrics keep the font units in the tables, and multiply
+  them by the current scale as they are read.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <freetype/ftadvanc.h>
+#include "defs.h"
+#include "log.h"
+#include "fontmetrics.h"
+
+// Characters below this value have their advances in direct tables
+#define FONTMETRICS_DIRECT 256
+// Number of distinct style combinations
+#define FONTMETRICS_STYLES 4
+// Initial size of the hash tables -- must be a power of two
+#define FONTMETRICS_INITIAL_SIZE 64
+
+typedef struct _AdvanceEntry
+  {
+  BOOL used;
+  UTF32 c;
+  int style;
+  int advance;
+  } AdvanceEntry;
+
+typedef struct _KerningEntry
+  {
+  BOOL used;
+  UTF32 left;
+  UTF32 right;
+  int kerning;
+  } KerningEntry;
+
+struct _FontMetrics
+  {
+  GlyphCache *glyphs; // Where the metrics come from, or NULL to use...
+  FT_Face face; // ...the face directly
+  BOOL unscaled; // TRUE if the tables hold font units
+  FT_Fixed scale; // Font units to 1/64 pixels, if unscaled
+  int line_spacing;
+  int cell_height;
+  BOOL has_kerning;
+  // Advances of small characters, or -1 if not prepared
+  int direct [FONTMETRICS_STYLES][FONTMETRICS_DIRECT];
+  AdvanceEntry *advances;
+  int n_advances;
+  int advances_size;
+  KerningEntry *kerning;
+  int n_kerning;
+  int kerning_size;
+  };
+
+
+/*==========================================================================
+  fontmetrics_hash
+*==========================================================================*/
+static inline unsigned int fontmetrics_hash (UTF32 a, UTF32 b)
+  {
+  return ((uint32_t)a * 2654435761u) ^ ((uint32_t)b * 40503u);
+  }
+
+
+/*==========================================================================
+  fontmetrics_new
+
+  Create an empty set of metrics for the face
+
+*==========================================================================*/
+static FontMetrics *fontmetrics_new (FT_Face face)
+  {
+  FontMetrics *self = malloc (sizeof (FontMetrics));
+  memset (self, 0, sizeof (FontMetrics));
+  self->face = face;
+  self->line_spacing = face->size->metrics.height / 64;
+  self->has_kerning = FT_HAS_KERNING (face);
+  for (int s = 0; s < FONTMETRICS_STYLES; s++)
+    for (int c = 0; c < FONTMETRICS_DIRECT; c++)
+      self->direct[s][c] = -1;
+  self->advances_size = FONTMETRICS_INITIAL_SIZE;
+  self->advances = calloc (self->advances_size, sizeof (AdvanceEntry));
+  self->kerning_size = FONTMETRICS_INITIAL_SIZE;
+  self->kerning = calloc (self->kerning_size, sizeof (KerningEntry));
+  return self;
+  }
+
+
+/*==========================================================================
+  fontmetrics_create
+*==========================================================================*/
+FontMetrics *fontmetrics_create (GlyphCache *glyphs)
+  {
+  LOG_IN
+  FontMetrics *self = fontmetrics_new (glyphcache_get_face (glyphs));
+  self->glyphs = glyphs;
+  self->cell_height = glyphcache_get_cell_height (glyphs);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  fontmetrics_create_for_face
+*==========================================================================*/
+FontMetrics *fontmetrics_create_for_face (FT_Face face)
+  {
+  LOG_IN
+  FontMetrics *self = fontmetrics_new (face);
+  // The same cell as the glyph cache would have
+  FT_Fixed y_scale = face->size->metrics.y_scale;
+  self->cell_height = FT_MulFix (face->bbox.yMax, y_scale) / 64
+    - FT_MulFix (face->bbox.yMin, y_scale) / 64;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  fontmetrics_create_scalable
+*==========================================================================*/
+FontMetrics *fontmetrics_create_scalable (FT_Face face)
+  {
+  LOG_IN
+  FontMetrics *self = fontmetrics_new (face);
+  self->unscaled = TRUE;
+  fontmetrics_set_size (self, face->size->metrics.y_ppem);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  fontmetrics_set_size
+*==========================================================================*/
+void fontmetrics_set_size (FontMetrics *self, int size)
+  {
+  if (!self->unscaled) return;
+  FT_Face face = self->face;
+  // This is how FreeType itself works out the scale, and the line
+  //  spacing, for a size in pixels
+  self->scale = FT_DivFix (size * 64, face->units_per_EM);
+  self->line_spacing = (FT_MulFix (face->height, self->scale) + 32) / 64;
+  self->cell_height = FT_MulFix (face->bbox.yMax, self->scale) / 64
+    - FT_MulFix (face->bbox.yMin, self->scale) / 64;
+  }
+
+
+/*==========================================================================
+  fontmetrics_scale
+
+  Convert a value from the tables of scalable metrics to the nearest
+  whole pixel
+
+*==========================================================================*/
+static inline int fontmetrics_scale (const FontMetrics *self, int value)
+  {
+  return (FT_MulFix (value, self->scale) + 32) >> 6;
+  }
+
+
+/*==========================================================================
+  fontmetrics_face_advance
+
+  Read the advance of a character from the face
+
+*==========================================================================*/
+static int fontmetrics_face_advance (const FontMetrics *self, UTF32 c,
+      int style)
+  {
+  FT_Face face = self->face;
+  // The same flags as the glyph cache uses to load glyphs
+  FT_Int32 flags = style == GLYPH_STYLE_REGULAR ?
+    FT_LOAD_DEFAULT : FT_LOAD_NO_BITMAP;
+  if (self->unscaled) flags |= FT_LOAD_NO_SCALE;
+  FT_Fixed advance = 0;
+  FT_Get_Advance (face, FT_Get_Char_Index (face, c), flags, &advance);
+  if (self->unscaled)
+    {
+    if (style & GLYPH_STYLE_BOLD) advance += face->units_per_EM / 24;
+    return advance;
+    }
+  // Scaled advances are in 16.16 pixels. Bold glyphs are widened as
+  //  the glyph cache widens them.
+  int ret = advance >> 16;
+  if (style & GLYPH_STYLE_BOLD)
+    ret += FT_MulFix (face->units_per_EM, face->size->metrics.y_scale)
+      / 24 / 64;
+  return ret;
+  }
+
+
+/*==========================================================================
+  fontmetrics_face_kerning
+
+  Read the kerning between two characters from the face
+
+*==========================================================================*/
+static int fontmetrics_face_kerning (const FontMetrics *self, UTF32 left,
+      UTF32 right)
+  {
+  FT_Face face = self->face;
+  FT_Vector delta;
+  if (FT_Get_Kerning (face, FT_Get_Char_Index (face, left),
+       FT_Get_Char_Index (face, right), self->unscaled ?
+       FT_KERNING_UNSCALED : FT_KERNING_DEFAULT, &delta) != 0)
+    return 0;
+  return self->unscaled ? delta.x : delta.x / 64;
+  }
+
+
+/*==========================================================================
+  fontmetrics_destroy
+*==========================================================================*/
+void fontmetrics_destroy (FontMetrics *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    free (self->advances);
+    free (self->kerning);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  fontmetrics_find_advance
+
+  Find the slot for (c,style) in the advance table -- either the slot
+  that holds it, or the empty slot where it should go.
+
+*==========================================================================*/
+static AdvanceEntry *fontmetrics_find_advance (AdvanceEntry *table,
+      int size, UTF32 c, int style)
+  {
+  unsigned int i = fontmetrics_hash (c, style) & (size - 1);
+  while (table[i].used && (table[i].c != c || table[i].style != style))
+    i = (i + 1) & (size - 1);
+  return &table[i];
+  }
+
+
+/*==========================================================================
+  fontmetrics_find_kerning
+*==========================================================================*/
+static KerningEntry *fontmetrics_find_kerning (KerningEntry *table,
+      int size, UTF32 left, UTF32 right)
+  {
+  unsigned int i = fontmetrics_hash (left, right) & (size - 1);
+  while (table[i].used && (table[i].left != left || table[i].right != right))
+    i = (i + 1) & (size - 1);
+  return &table[i];
+  }
+
+
+/*==========================================================================
+  fontmetrics_add_advance
+*==========================================================================*/
+static void fontmetrics_add_advance (FontMetrics *self, UTF32 c, int style,
+      int advance)
+  {
+  // Keep the load factor below 0.5, so probe sequences are short
+  if ((self->n_advances + 1) * 2 > self->advances_size)
+    {
+    int new_size = self->advances_size * 2;
+    AdvanceEntry *table = calloc (new_size, sizeof (AdvanceEntry));
+    for (int i = 0; i < self->advances_size; i++)
+      {
+      AdvanceEntry *e = &self->advances[i];
+      if (e->used) *fontmetrics_find_advance (table, new_size,
+         e->c, e->style) = *e;
+      }
+    free (self->advances);
+    self->advances = table;
+    self->advances_size = new_size;
+    }
+  AdvanceEntry *e = fontmetrics_find_advance (self->advances,
+    self->advances_size, c, style);
+  e->used = TRUE;
+  e->c = c;
+  e->style = style;
+  e->advance = advance;
+  self->n_advances++;
+  }
+
+
+/*==========================================================================
+  fontmetrics_add_kerning
+*==========================================================================*/
+static void fontmetrics_add_kerning (FontMetrics *self, UTF32 left,
+      UTF32 right, int kerning)
+  {
+  if ((self->n_kerning + 1) * 2 > self->kerning_size)
+    {
+    int new_size = self->kerning_size * 2;
+    KerningEntry *table = calloc (new_size, sizeof (KerningEntry));
+    for (int i = 0; i < self->kerning_size; i++)
+      {
+      KerningEntry *e = &self->kerning[i];
+      if (e->used) *fontmetrics_find_kerning (table, new_size,
+         e->left, e->right) = *e;
+      }
+    free (self->kerning);
+    self->kerning = table;
+    self->kerning_size = new_size;
+    }
+  KerningEntry *e = fontmetrics_find_kerning (self->kerning,
+    self->kerning_size, left, right);
+  e->used = TRUE;
+  e->left = left;
+  e->right = right;
+  e->kerning = kerning;
+  self->n_kerning++;
+  }
+
+
+/*==========================================================================
+  fontmetrics_prepare
+*==========================================================================*/
+void fontmetrics_prepare (FontMetrics *self, const UTF32 *text, int len,
+      int style)
+  {
+  style &= FONTMETRICS_STYLES - 1;
+  if (!self->glyphs)
+    {
+    for (int i = 0; i < len; i++)
+      {
+      UTF32 c = text[i];
+      if (c >= 0 && c < FONTMETRICS_DIRECT)
+        {
+        if (self->direct[style][c] < 0)
+          self->direct[style][c] = fontmetrics_face_advance (self, c, style);
+        }
+      else if (!fontmetrics_find_advance (self->advances,
+           self->advances_size, c, style)->used)
+        fontmetrics_add_advance (self, c, style,
+          fontmetrics_face_advance (self, c, style));
+      if (self->has_kerning && i > 0 && !fontmetrics_find_kerning
+           (self->kerning, self->kerning_size, text[i - 1], c)->used)
+        fontmetrics_add_kerning (self, text[i - 1], c,
+          fontmetrics_face_kerning (self, text[i - 1], c));
+      }
+    return;
+    }
+
+  const CachedGlyph *prev = NULL;
+  for (int i = 0; i < len; i++)
+    {
+    UTF32 c = text[i];
+    const CachedGlyph *g = NULL;
+    if (c >= 0 && c < FONTMETRICS_DIRECT)
+      {
+      if (self->direct[style][c] < 0)
+        {
+        g = glyphcache_get (self->glyphs, c, style);
+        self->direct[style][c] = g->advance;
+        }
+      }
+    else if (!fontmetrics_find_advance (self->advances,
+         self->advances_size, c, style)->used)
+      {
+      g = glyphcache_get (self->glyphs, c, style);
+      fontmetrics_add_advance (self, c, style, g->advance);
+      }
+
+    if (self->has_kerning && i > 0 && !fontmetrics_find_kerning
+         (self->kerning, self->kerning_size, text[i - 1], c)->used)
+      {
+      // Both glyphs are already in the glyph cache, so this is cheap
+      if (!g) g = glyphcache_get (self->glyphs, c, style);
+      if (!prev) prev = glyphcache_get (self->glyphs, text[i - 1], style);
+      fontmetrics_add_kerning (self, text[i - 1], c,
+        glyphcache_get_kerning (self->glyphs, prev, g));
+      }
+    prev = g;
+    }
+  }
+
+
+/*==========================================================================
+  fontmetrics_get_advance
+*==========================================================================*/
+int fontmetrics_get_advance (const FontMetrics *self, UTF32 c, int style)
+  {
+  style &= FONTMETRICS_STYLES - 1;
+  int advance = 0;
+  if (c >= 0 && c < FONTMETRICS_DIRECT)
+    {
+    advance = self->direct[style][c];
+    if (advance < 0) advance = 0;
+    }
+  else
+    {
+    const AdvanceEntry *e = fontmetrics_find_advance (self->advances,
+      self->advances_size, c, style);
+    if (e->used) advance = e->advance;
+    }
+  return self->unscaled ? fontmetrics_scale (self, advance) : advance;
+  }
+
+
+/*==========================================================================
+  fontmetrics_get_kerning
+*==========================================================================*/
+int fontmetrics_get_kerning (const FontMetrics *self, UTF32 left,
+      UTF32 right)
+  {
+  if (!self->has_kerning) return 0;
+  const KerningEntry *e = fontmetrics_find_kerning (self->kerning,
+    self->kerning_size, left, right);
+  if (!e->used) return 0;
+  return self->unscaled ? fontmetrics_scale (self, e->kerning) : e->kerning;
+  }
+
+
+/*==========================================================================
+  fontmetrics_get_line_spacing
+*==========================================================================*/
+int fontmetrics_get_line_spacing (const FontMetrics *self)
+  {
+  return self->line_spacing;
+  }
+
+
+/*==========================================================================
+  fontmetrics_get_cell_height
+*==========================================================================*/
+int fontmetrics_get_cell_height (const FontMetrics *self)
+  {
+  return self->cell_height;
+  }
+
+
+/*==========================================================================
+  fontmetrics_get_glyphcache
+*==========================================================================*/
+GlyphCache *fontmetrics_get_glyphcache (const FontMetrics *self)
+  {
+  return self->glyphs;
+  }
+
@@ -0,0 +1,101 @@
+/*============================================================================
+
+  fontmetrics.h
+
+  A "class" that holds the glyph metrics needed for layout -- the
+  character-to-glyph mapping, advances, and kerning -- in tables that
+  can be read by many threads at once without locking.
+
+  Metrics are added by fontmetrics_prepare(), which uses the glyph
+  cache, and so FreeType, and must only be called by one thread at a
+  time, when no other thread is reading. Once all the text to be laid
+  out has been prepared, any number of threads can call the
+  fontmetrics_get_xxx functions concurrently, because nothing is
+  written while they do.
+
+  Metrics can also be read straight from a face, without a glyph
+  cache and without rendering any glyphs, either at the face's current
+  size or in font units. Font-unit metrics can be scaled to any size
+  with fontmetrics_set_size(), which costs nothing, so text can be laid
+  out at many sizes -- to find the largest size at which it fits a
+  box, for example -- while preparing the metrics only once. The
+  scaled advances are only estimates, because hinting can round the
+  real advances differently.
+
+  The usual sequence of operations is
+  fontmetrics_create
+  fontmetrics_prepare (for each text)
+  fontmetrics_get_advance, etc (from any thread)
+  fontmetrics_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "glyphcache.h"
+
+struct _FontMetrics;
+typedef struct _FontMetrics FontMetrics;
+
+BEGIN_DECLS
+
+/** Create an empty set of metrics for glyphs from the glyph cache.
+    This method always succeeds, and must eventually be followed by a
+    call to fontmetrics_destroy(). */
+FontMetrics     *fontmetrics_create (GlyphCache *glyphs);
+
+/** Create an empty set of metrics that are read from the face, at its
+    current size, without rendering the glyphs. Apart from that, they
+    are the same as the metrics from fontmetrics_create(). The face
+    must not be used by any other thread while the metrics are
+    prepared. This method always succeeds, and must eventually be
+    followed by a call to fontmetrics_destroy(). */
+FontMetrics     *fontmetrics_create_for_face (FT_Face face);
+
+/** Create an empty set of metrics that are read from the face in font
+    units, and scaled to the size set by fontmetrics_set_size() --
+    initially, the face's current size -- when they are read. This
+    method always succeeds, and must eventually be followed by a call
+    to fontmetrics_destroy(). */
+FontMetrics     *fontmetrics_create_scalable (FT_Face face);
+
+/** Set the size, in pixels, to which the metrics from a set created
+    by fontmetrics_create_scalable() are scaled. This has no effect on
+    other sets of metrics. */
+void             fontmetrics_set_size (FontMetrics *self, int size);
+
+/** Free the metrics tables. */
+void             fontmetrics_destroy (FontMetrics *self);
+
+/** Make sure that the metrics for the len characters of text in the
+    specified style, and the kerning between adjacent characters,
+    are in the tables. This is not thread-safe. */
+void             fontmetrics_prepare (FontMetrics *self, const UTF32 *text,
+                    int len, int style);
+
+/** Get the advance of character c in the specified style, in pixels.
+    The character must have been prepared, or the result is zero. */
+int              fontmetrics_get_advance (const FontMetrics *self, UTF32 c,
+                    int style);
+
+/** Get the kerning adjustment, in pixels, between characters left and
+    right. The pair must have been prepared, or the result is zero. */
+int              fontmetrics_get_kerning (const FontMetrics *self,
+                    UTF32 left, UTF32 right);
+
+/** Get the distance between the tops of adjacent lines of text. */
+int              fontmetrics_get_line_spacing (const FontMetrics *self);
+
+/** Get the height of a character cell -- see
+    glyphcache_get_cell_height(). */
+int              fontmetrics_get_cell_height (const FontMetrics *self);
+
+/** Get the glyph cache from which the metrics are taken, or NULL if
+    they are read from a face. */
+GlyphCache      *fontmetrics_get_glyphcache (const FontMetrics *self);
+
+END_DECLS
+
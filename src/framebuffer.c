@@ -11,6 +11,19 @@
   to pixels. However, it doesn't allow for non-sequential row ordering,
   or palette mapping, or any of that stuff.
 
+  The framebuffer's memory can be larger than the screen -- the 
+  "virtual" resolution can be wider or (more usually) taller than the
+  visible one, and the screen shows the part of it at (xoffset,yoffset).
+  Drivers use this for double-buffering and scrolling by panning. So 
+  the whole of the memory is mapped, using the size and row length that
+  the driver reports, and the visible window is found at the offsets.
+
+  The mapped memory is also described by a Surface, which does all
+  the bulk drawing, so the same code draws on the framebuffer and on
+  off-screen buffers. 16-bpp and 24-bpp framebuffers are drawn 
+  correctly by the Surface, although framebuffer_set_pixel() and 
+  framebuffer_get_pixel() still assume 32 bpp.
+
   Note that all the methods in this implementation require that the
   user have write access to the framebuffer device in /dev. 
 
@@ -45,13 +58,18 @@ struct _FrameBuffer
   int fd; // File descriptor
   int w; // Displayed width in pixels
   int h; // Displayer height in pixels
-  int fb_data_size; // Total amount of mapped memory
+  int virtual_w; // Width of the whole of the memory in pixels
+  int virtual_h; // Height of the whole of the memory in pixels
+  int xoffset; // Position of the displayed window in the memory
+  int yoffset;
+  size_t fb_data_size; // Total amount of mapped memory
   BYTE *fb_data; // Pointer to the mapped memory
   char *fbdev; // Original device name
   int fb_bytes; // Number of bytes per pixel -- must by 3 or 4
-  int line_length; // Number of pixels in a line, as reported by the device
+  int line_length; // Number of bytes in a line, as reported by the device
   int stride; // Bytes between vertically-adjacent rows of pixels
-  int slop; // Amount of line_length that does not correspond to pixels.
+  Surface *surface; // Describes the displayed window
+  Surface *virtual_surface; // Describes the whole of the memory
   }; 
 
 
@@ -66,6 +84,8 @@ FrameBuffer *framebuffer_create (const char *fbdev)
   self->fd = -1;
   self->fb_data = NULL;
   self->fb_data_size = 0;
+  self->surface = NULL;
+  self->virtual_surface = NULL;
   LOG_OUT 
   return self;
   }
@@ -84,28 +104,91 @@ BOOL framebuffer_init (FrameBuffer *self, char **error)
     struct fb_var_screeninfo vinfo;
     struct fb_fix_screeninfo finfo;
 
-    ioctl (self->fd, FBIOGET_FSCREENINFO, &finfo);
-    ioctl (self->fd, FBIOGET_VSCREENINFO, &vinfo);
-
-    log_debug ("fb_init: xres %d", vinfo.xres); 
-    log_debug ("fb_init: yres %d", vinfo.yres); 
-    log_debug ("fb_init: bpp %d",  vinfo.bits_per_pixel); 
-    log_debug ("fb_init: line_length %d",  finfo.line_length); 
-
-    self->line_length = finfo.line_length; 
-    self->w = vinfo.xres;
-    self->h = vinfo.yres;
-    int fb_bpp = vinfo.bits_per_pixel;
-    int fb_bytes = fb_bpp / 8;
-    self->fb_bytes = fb_bytes;
-    self->fb_data_size = self->w * self->h * fb_bytes;
-    self->stride = max (self->line_length, self->w * self->fb_bytes);
-    self->slop = self->stride - (self->w * self->fb_bytes);
+    if (ioctl (self->fd, FBIOGET_FSCREENINFO, &finfo) == 0
+        && ioctl (self->fd, FBIOGET_VSCREENINFO, &vinfo) == 0)
+      {
+      log_debug ("fb_init: xres %d", vinfo.xres); 
+      log_debug ("fb_init: yres %d", vinfo.yres); 
+      log_debug ("fb_init: xres_virtual %d", vinfo.xres_virtual); 
+      log_debug ("fb_init: yres_virtual %d", vinfo.yres_virtual); 
+      log_debug ("fb_init: offset %d,%d", vinfo.xoffset, vinfo.yoffset); 
+      log_debug ("fb_init: bpp %d",  vinfo.bits_per_pixel); 
+      log_debug ("fb_init: line_length %d",  finfo.line_length); 
+      log_debug ("fb_init: smem_len %d",  finfo.smem_len); 
 
-    self->fb_data = mmap (0, self->fb_data_size, 
-	     PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, (off_t)0);
+      int fb_bpp = vinfo.bits_per_pixel;
+      self->fb_bytes = fb_bpp / 8;
+      self->line_length = finfo.line_length; 
+      self->w = vinfo.xres;
+      self->h = vinfo.yres;
+      // Some drivers leave the virtual resolution at zero, meaning
+      //  that it is the same as the visible one
+      self->virtual_w = max (vinfo.xres_virtual, vinfo.xres);
+      self->virtual_h = max (vinfo.yres_virtual, vinfo.yres);
+      self->xoffset = vinfo.xoffset;
+      self->yoffset = vinfo.yoffset;
+      self->stride = max (self->line_length, 
+        self->virtual_w * self->fb_bytes);
+      // The driver knows how much memory there is, and won't map any 
+      //  more than that; if it is less than the virtual resolution 
+      //  needs, only the rows that fit can be used. Not all drivers 
+      //  report it, though
+      self->fb_data_size = (size_t)self->stride * self->virtual_h;
+      if (finfo.smem_len > 0 && finfo.smem_len < self->fb_data_size)
+        {
+        self->fb_data_size = finfo.smem_len;
+        self->virtual_h = finfo.smem_len / self->stride;
+        }
 
-    ret = TRUE;
+      if (self->yoffset + self->h > self->virtual_h
+          || self->xoffset + self->w > self->virtual_w)
+        {
+        self->fb_data = NULL;
+        if (error)
+          asprintf (error, "Framebuffer memory is too small for %dx%d "
+            "at offset %d,%d", self->w, self->h, self->xoffset, 
+            self->yoffset);
+        }
+      else
+        {
+        self->fb_data = mmap (0, self->fb_data_size, 
+          PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, (off_t)0);
+        if (self->fb_data != MAP_FAILED)
+          {
+          SurfaceFormat format = SURFACE_FORMAT_BGRX8888;
+          if (fb_bpp == 24) 
+            format = SURFACE_FORMAT_BGR888;
+          else if (fb_bpp == 16) 
+            format = SURFACE_FORMAT_RGB565;
+          else if (fb_bpp != 32)
+            log_warning ("Unsupported framebuffer depth %d -- assuming 32", 
+              fb_bpp);
+          self->virtual_surface = surface_create_for_data (self->fb_data, 
+            self->virtual_w, self->virtual_h, self->stride, format);
+          self->surface = surface_create_for_data (self->fb_data 
+            + self->yoffset * self->stride + self->xoffset * self->fb_bytes,
+            self->w, self->h, self->stride, format);
+          ret = TRUE;
+          }
+        else
+          {
+          self->fb_data = NULL;
+          if (error)
+            asprintf (error, "Can't map framebuffer: %s", strerror (errno));
+          }
+        }
+      }
+    else
+      {
+      if (error)
+        asprintf (error, "%s is not a framebuffer: %s", self->fbdev, 
+          strerror (errno));
+      }
+    if (!ret)
+      {
+      close (self->fd);
+      self->fd = -1;
+      }
     }
   else
     {
@@ -123,7 +206,7 @@ BOOL framebuffer_init (FrameBuffer *self, char **error)
 *==========================================================================*/
 void framebuffer_clear (FrameBuffer *self)
   {
-  memset (self->fb_data, 0, self->stride * self->h);
+  surface_clear (self->surface);
   }
 
 /*==========================================================================
@@ -134,6 +217,10 @@ void framebuffer_deinit (FrameBuffer *self)
   LOG_IN
   if (self)
     {
+    surface_destroy (self->surface);
+    self->surface = NULL;
+    surface_destroy (self->virtual_surface);
+    self->virtual_surface = NULL;
     if (self->fb_data) 
       {
       munmap (self->fb_data, self->fb_data_size);
@@ -157,11 +244,11 @@ void framebuffer_set_pixel (FrameBuffer *self, int x, int y,
   {
   if (x > 0 && x < self->w && y > 0 && y < self->h)
     {
-    int index32 = (y * self->w + x) * self->fb_bytes + y * self->slop;
-    self->fb_data [index32++] = b;
-    self->fb_data [index32++] = g;
-    self->fb_data [index32++] = r;
-    self->fb_data [index32] = 0;
+    BYTE *p = self->surface->data + y * self->stride + x * self->fb_bytes;
+    p[0] = b;
+    p[1] = g;
+    p[2] = r;
+    p[3] = 0;
     }
   }
 
@@ -204,10 +291,11 @@ void framebuffer_get_pixel (const FrameBuffer *self,
   {
   if (x > 0 && x < self->w && y > 0 && y < self->h)
     {
-    int index32 = (y * self->w + x) * self->fb_bytes + (y * self->slop);
-    *b = self->fb_data [index32++];
-    *g = self->fb_data [index32++];
-    *r = self->fb_data [index32];
+    const BYTE *p = self->surface->data + y * self->stride 
+      + x * self->fb_bytes;
+    *b = p[0];
+    *g = p[1];
+    *r = p[2];
     }
   else
     {
@@ -225,4 +313,52 @@ BYTE *framebuffer_get_data (FrameBuffer *self)
   return self->fb_data;
   }
 
+/*==========================================================================
+  framebuffer_get_surface
+*==========================================================================*/
+Surface *framebuffer_get_surface (FrameBuffer *self)
+  {
+  return self->surface;
+  }
+
+/*==========================================================================
+  framebuffer_get_virtual_surface
+*==========================================================================*/
+Surface *framebuffer_get_virtual_surface (FrameBuffer *self)
+  {
+  return self->virtual_surface;
+  }
+
+/*==========================================================================
+  framebuffer_get_offset
+*==========================================================================*/
+void framebuffer_get_offset (const FrameBuffer *self, int *x, int *y)
+  {
+  *x = self->xoffset;
+  *y = self->yoffset;
+  }
+
+/*==========================================================================
+  framebuffer_pan
+*==========================================================================*/
+BOOL framebuffer_pan (FrameBuffer *self, int x, int y)
+  {
+  if (x < 0 || y < 0 || x + self->w > self->virtual_w 
+      || y + self->h > self->virtual_h) return FALSE;
+  struct fb_var_screeninfo vinfo;
+  if (ioctl (self->fd, FBIOGET_VSCREENINFO, &vinfo) != 0) return FALSE;
+  vinfo.xoffset = x;
+  vinfo.yoffset = y;
+  if (ioctl (self->fd, FBIOPAN_DISPLAY, &vinfo) != 0)
+    {
+    log_debug ("Can't pan framebuffer to %d,%d: %s", x, y, 
+      strerror (errno));
+    return FALSE;
+    }
+  self->xoffset = x;
+  self->yoffset = y;
+  self->surface->data = self->fb_data + y * self->stride 
+    + x * self->fb_bytes;
+  return TRUE;
+  }
 
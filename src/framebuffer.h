@@ -18,6 +18,7 @@
 #pragma once
 
 #include "defs.h"
+#include "surface.h"
 
 struct _FrameBuffer;
 typedef struct _FrameBuffer FrameBuffer;
@@ -30,8 +31,9 @@ FrameBuffer     *framebuffer_create (const char *fbdev);
 
 /** Initialize the framebuffer device, get its properties, and map its
     data area into memory. This method can fail, usually for lack of
-    permissions. If it succeeds, the caller must eventually call 
-    framebuffer_deinit(). */
+    permissions; if so, *error is written with a message that the 
+    caller should eventually free. If it succeeds, the caller must 
+    eventually call framebuffer_deinit(). */
 BOOL             framebuffer_init (FrameBuffer *self, char **error);
 
 /** Tidy up the work done by framebuffer_init(). */
@@ -69,5 +71,31 @@ BYTE            *framebuffer_get_data (FrameBuffer *self);
 /** Set the whole framebuffer to black. */
 void             framebuffer_clear (FrameBuffer *self);
 
+/** Get a surface that describes the part of the framebuffer's memory
+    that is on the screen, so that it can be drawn on like any other 
+    surface. The surface belongs to the framebuffer, and is only valid 
+    between framebuffer_init() and framebuffer_deinit(). */
+Surface         *framebuffer_get_surface (FrameBuffer *self);
+
+/** Get a surface that describes the whole of the framebuffer's memory,
+    at its virtual resolution, which may be larger than the screen. 
+    The screen shows the part of it at the position given by 
+    framebuffer_get_offset(). The same lifetime rules as 
+    framebuffer_get_surface() apply. */
+Surface         *framebuffer_get_virtual_surface (FrameBuffer *self);
+
+/** Get the position, in the virtual surface, of the top-left corner
+    of the part that is on the screen. */
+void             framebuffer_get_offset (const FrameBuffer *self, 
+                      int *x, int *y);
+
+/** Show a different part of the virtual surface on the screen, by 
+    moving its top-left corner to (x,y). This is done by the display 
+    hardware, without copying any pixels. The surface returned by 
+    framebuffer_get_surface() moves to match. Returns FALSE, and 
+    changes nothing, if the position is out of range or the driver
+    can't pan. */
+BOOL             framebuffer_pan (FrameBuffer *self, int x, int y);
+
 END_DECLS
 
@@ -0,0 +1,649 @@
+/*============================================================================
+
+  glyphcache.c
+
+  Implementation of the "methods" defined in glyphcache.h.
+
+  The cache is a hash table, keyed on the character and the style, 
+  with chaining for collisions. Glyphs are never evicted -- a typical
+  run uses a few dozen distinct characters, and even a large
+  character set at a modest size amounts to a few hundred kB of
+  bitmaps.
+
+  The table is split into shards, each with its own spinlock, so that
+  threads adding different glyphs rarely wait for one another. The
+  lock is only taken to add a glyph. Because glyphs are never removed,
+  and a glyph is fully set up before it is linked into its bucket,
+  readers can walk the chains without any lock at all, and there is
+  nothing to reclaim. Each glyph has a state -- reserved, rendering, 
+  or ready -- that is changed atomically, so exactly one thread
+  renders it, and any other thread that needs it waits until it
+  is ready.
+
+  Bold is synthesized with FT_Outline_Embolden() and italic with a
+  shear transform of the outline, using the same strength and slant
+  as FreeType's own FT_GlyphSlot_Embolden() and FT_GlyphSlot_Oblique().
+  Because the transformations are applied to the outline before
+  rendering, the styled glyphs are anti-aliased just as well as
+  the regular ones.
+
+  Glyphs can be rendered in parallel, in two steps. glyphcache_request()
+  adds placeholder entries for missing glyphs to the hash table, and to
+  a list of pending glyphs. glyphcache_render_pending() then splits the
+  list into batches, which are rendered by scheduler tasks, each using
+  the face belonging to the thread it runs on. 
+
+  glyphcache_reserve() and glyphcache_render_reserved() do the same
+  thing one glyph at a time, for callers that want to use each glyph
+  as soon as it is ready, rather than waiting for a whole batch.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <freetype/ftoutln.h>
+#include "defs.h"
+#include "log.h"
+#include "glyphcache.h"
+
+// Number of shards, and of hash buckets in each, as powers of two
+#define GLYPHCACHE_SHARD_BITS 4
+#define GLYPHCACHE_BUCKET_BITS 6
+#define GLYPHCACHE_SHARDS (1 << GLYPHCACHE_SHARD_BITS)
+#define GLYPHCACHE_BUCKETS (1 << GLYPHCACHE_BUCKET_BITS)
+// Number of pending glyphs rendered by each scheduler task
+#define GLYPHCACHE_BATCH 16
+
+// Values of CachedGlyph.state
+#define GLYPH_STATE_RESERVED  0 // In the table, but nobody is rendering it
+#define GLYPH_STATE_RENDERING 1 // Being rendered by some thread
+#define GLYPH_STATE_READY     2 // Rendered, and will never change again
+
+typedef struct _GlyphShard
+  {
+  pthread_spinlock_t lock; // Held while adding a glyph to the shard
+  CachedGlyph *buckets [GLYPHCACHE_BUCKETS];
+  } GlyphShard;
+
+struct _GlyphCache
+  {
+  FT_Face face; // The face the glyphs are rendered from
+  int ascent; // Pixels from the top of the cell to the baseline
+  int cell_height; // Pixels from the top of the cell to the bottom
+  GlyphShard shards [GLYPHCACHE_SHARDS];
+  FT_Library ft; // The library the face belongs to, if known
+  char *ttf_file; // The file the face was loaded from, if known
+  Scheduler *scheduler; // The scheduler whose workers use the cache
+  FT_Face *worker_faces; // Per-thread copies of the face, or NULL
+  int n_worker_faces;
+  pthread_mutex_t ft_lock; // Serializes opening and closing faces
+  CachedGlyph **pending; // Glyphs requested but not rendered
+  int n_pending;
+  int pending_size;
+  };
+
+typedef struct _RenderBatch
+  {
+  GlyphCache *cache;
+  CachedGlyph **glyphs;
+  int n_glyphs;
+  } RenderBatch;
+
+// Returned in place of a glyph that can't be rendered just now. It
+//  has no bitmap and no advance, and is never in any bucket.
+static const CachedGlyph glyphcache_empty = { .state = GLYPH_STATE_READY };
+
+
+/*==========================================================================
+  glyphcache_bucket
+
+  Get the hash bucket for a glyph. The character and style are mixed 
+  by multiplying them by large odd constants, which spreads every bit
+  of them into the top bits of the hash; the shard is taken from the
+  very top bits, and the bucket from the ones below. So the glyphs of
+  any one style, even of a run of consecutive characters, are spread
+  across all the shards.
+
+*==========================================================================*/
+static inline CachedGlyph **glyphcache_bucket (const GlyphCache *self, 
+      UTF32 c, int style, GlyphShard **shard)
+  {
+  uint32_t h = ((uint32_t)c * 0x9E3779B1u) ^ ((uint32_t)style * 0x85EBCA6Bu);
+  GlyphShard *s = 
+    (GlyphShard *)&self->shards[h >> (32 - GLYPHCACHE_SHARD_BITS)];
+  if (shard) *shard = s;
+  return &s->buckets[(h >> (32 - GLYPHCACHE_SHARD_BITS 
+    - GLYPHCACHE_BUCKET_BITS)) & (GLYPHCACHE_BUCKETS - 1)];
+  }
+
+
+/*==========================================================================
+  glyphcache_create
+*==========================================================================*/
+GlyphCache *glyphcache_create (FT_Face face)
+  {
+  LOG_IN
+  GlyphCache *self = malloc (sizeof (GlyphCache));
+  memset (self, 0, sizeof (GlyphCache));
+  self->face = face;
+  // bbox.yMax is the height of a bounding box that will enclose
+  //  any glyph in the face, starting from the glyph baseline. It is
+  //  in font units, so it has to be scaled to the current size
+  //  before converting from 64'ths of a pixel.
+  self->ascent = FT_MulFix (face->bbox.yMax,
+    face->size->metrics.y_scale) / 64;
+  self->cell_height = self->ascent - FT_MulFix (face->bbox.yMin,
+    face->size->metrics.y_scale) / 64;
+  for (int i = 0; i < GLYPHCACHE_SHARDS; i++)
+    pthread_spin_init (&self->shards[i].lock, PTHREAD_PROCESS_PRIVATE);
+  pthread_mutex_init (&self->ft_lock, NULL);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  glyphcache_destroy
+*==========================================================================*/
+void glyphcache_destroy (GlyphCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    for (int s = 0; s < GLYPHCACHE_SHARDS; s++)
+      {
+      for (int i = 0; i < GLYPHCACHE_BUCKETS; i++)
+        {
+        CachedGlyph *g = self->shards[s].buckets[i];
+        while (g)
+          {
+          CachedGlyph *next = g->next;
+          free (g->buffer);
+          free (g->spans);
+          free (g);
+          g = next;
+          }
+        }
+      pthread_spin_destroy (&self->shards[s].lock);
+      }
+    for (int i = 0; i < self->n_worker_faces; i++)
+      if (self->worker_faces[i]) FT_Done_Face (self->worker_faces[i]);
+    free (self->worker_faces);
+    free (self->ttf_file);
+    free (self->pending);
+    pthread_mutex_destroy (&self->ft_lock);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  glyphcache_render
+
+  Load and rasterize a glyph from the specified face, applying any 
+  synthetic styling to its outline, and copy the result into an
+  existing CachedGlyph, whose character and style are already set.
+  The caller must have claimed the glyph with glyphcache_claim().
+
+*==========================================================================*/
+static void glyphcache_render (const GlyphCache *self, FT_Face face, 
+      CachedGlyph *glyph)
+  {
+  UTF32 c = glyph->c;
+  int style = glyph->style;
+
+  // If there is no glyph in the face for the character,
+  //  FT_Get_Char_Index returns zero, which is the face's "missing
+  //  glyph" glyph.
+  FT_UInt gi = FT_Get_Char_Index (face, c);
+  glyph->index = gi;
+
+  // Styling works on outlines, so don't let FreeType substitute an
+  //  embedded bitmap when a style is requested.
+  FT_Load_Glyph (face, gi, style == GLYPH_STYLE_REGULAR ?
+    FT_LOAD_DEFAULT : FT_LOAD_NO_BITMAP);
+  FT_GlyphSlot slot = face->glyph;
+
+  // Advance is the amount of x spacing, in pixels, allocated
+  //   to this glyph
+  int advance = slot->metrics.horiAdvance / 64;
+
+  if (slot->format == FT_GLYPH_FORMAT_OUTLINE)
+    {
+    if (style & GLYPH_STYLE_BOLD)
+      {
+      // Thicken the strokes by 1/24 of the em size, and widen the
+      //  advance to match, so that emboldened glyphs don't collide.
+      FT_Pos strength = FT_MulFix (face->units_per_EM,
+        face->size->metrics.y_scale) / 24;
+      FT_Outline_Embolden (&slot->outline, strength);
+      advance += strength / 64;
+      }
+    if (style & GLYPH_STYLE_ITALIC)
+      {
+      // Shear by about 12 degrees. The matrix is in 16.16 fixed point.
+      FT_Matrix shear;
+      shear.xx = 0x10000L;
+      shear.xy = 0x0366AL;
+      shear.yx = 0;
+      shear.yy = 0x10000L;
+      FT_Outline_Transform (&slot->outline, &shear);
+      }
+    }
+
+  // Rendering a loaded glyph creates the bitmap
+  FT_Render_Glyph (slot, FT_RENDER_MODE_NORMAL);
+
+  // FreeType's bitmaps often have empty rows and columns at the
+  //  edges, which would only have to be skipped every time the glyph
+  //  is drawn, so find the smallest rectangle that holds all the
+  //  coverage.
+  const FT_Bitmap *bitmap = &slot->bitmap;
+  int top = -1, bottom = 0, left = bitmap->width, right = 0;
+  for (int i = 0; i < (int)bitmap->rows; i++)
+    {
+    const BYTE *row = bitmap->buffer + i * bitmap->pitch;
+    int start = 0, end = bitmap->width;
+    while (start < end && !row[start]) start++;
+    while (end > start && !row[end - 1]) end--;
+    if (start == end) continue;
+    if (top < 0) top = i;
+    bottom = i + 1;
+    if (start < left) left = start;
+    if (end > right) right = end;
+    }
+  if (top < 0) top = bottom = left = right = 0; // Nothing visible
+
+  // TT fonts have no built-in padding, so we must work out where in
+  //  the character cell to place the bitmap. bitmap_top is the
+  //  height of the top row of the bitmap above the baseline, so we
+  //  push the bitmap down from the top of the cell by the ascent, and
+  //  then back up by this amount. Horizontally, the untrimmed bitmap
+  //  is centred in the space between its width and the advance.
+  glyph->advance = advance;
+  glyph->width = right - left;
+  glyph->rows = bottom - top;
+  glyph->pitch = glyph->width;
+  glyph->x_off = (advance - (int)bitmap->width) / 2 + left;
+  glyph->y_off = self->ascent - slot->bitmap_top + top;
+
+  // Copy the trimmed bitmap out of the glyph slot, which will be 
+  //  overwritten by the next load, and note where each row's coverage
+  //  starts and ends.
+  if (glyph->width > 0 && glyph->rows > 0)
+    {
+    glyph->buffer = malloc (glyph->pitch * glyph->rows);
+    glyph->spans = malloc (glyph->rows * sizeof (GlyphSpan));
+    for (int i = 0; i < glyph->rows; i++)
+      {
+      BYTE *row = glyph->buffer + i * glyph->pitch;
+      memcpy (row, bitmap->buffer + (top + i) * bitmap->pitch + left, 
+        glyph->width);
+      int start = 0, end = glyph->width;
+      while (start < end && !row[start]) start++;
+      while (end > start && !row[end - 1]) end--;
+      glyph->spans[i].start = start;
+      glyph->spans[i].end = end;
+      }
+    }
+
+  // Publish the glyph -- everything written above is visible to any
+  //  thread that sees the new state
+  __atomic_store_n (&glyph->state, GLYPH_STATE_READY, __ATOMIC_RELEASE);
+  log_trace ("Rendered glyph %d style %d: %dx%d", c, style,
+    glyph->width, glyph->rows);
+  }
+
+
+/*==========================================================================
+  glyphcache_thread_face
+
+  Get the face to be used by the current thread, opening it if this is
+  the thread's first use of it. A thread that isn't one of the 
+  scheduler's workers -- usually the main thread -- uses the original
+  face. Returns NULL if a worker can't have a face of its own. Only
+  worker w ever writes worker_faces[w], so no lock is needed, except
+  around FreeType itself.
+
+*==========================================================================*/
+static FT_Face glyphcache_thread_face (GlyphCache *self)
+  {
+  int w = self->scheduler ? 
+    scheduler_current_worker (self->scheduler) : -1;
+  if (w < 0) return self->face;
+  if (!self->ttf_file || w >= self->n_worker_faces) return NULL;
+  if (!self->worker_faces[w])
+    {
+    FT_Face face;
+    // FreeType requires that faces are opened one at a time
+    pthread_mutex_lock (&self->ft_lock);
+    BOOL ok = FT_New_Face (self->ft, self->ttf_file, 0, &face) == 0;
+    pthread_mutex_unlock (&self->ft_lock);
+    if (!ok) 
+      {
+      log_warning ("Can't open %s for thread %d", self->ttf_file, w);
+      return NULL;
+      }
+    FT_Set_Pixel_Sizes (face, self->face->size->metrics.x_ppem, 
+      self->face->size->metrics.y_ppem);
+    self->worker_faces[w] = face;
+    }
+  return self->worker_faces[w];
+  }
+
+
+/*==========================================================================
+  glyphcache_find
+
+  Find a glyph in the table, whatever its state, without locking. 
+  Returns NULL if it isn't there.
+
+*==========================================================================*/
+static CachedGlyph *glyphcache_find (const GlyphCache *self, UTF32 c, 
+      int style)
+  {
+  CachedGlyph **bucket = glyphcache_bucket (self, c, style, NULL);
+  for (CachedGlyph *g = __atomic_load_n (bucket, __ATOMIC_ACQUIRE); 
+       g; g = g->next)
+    {
+    if (g->c == c && g->style == style) return g;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+  glyphcache_add
+
+  Add an empty, unrendered glyph to the hash table, unless another 
+  thread has just added it. *added is set TRUE if the glyph returned 
+  is a new one. 
+
+*==========================================================================*/
+static CachedGlyph *glyphcache_add (GlyphCache *self, UTF32 c, int style,
+      BOOL *added)
+  {
+  GlyphShard *shard;
+  CachedGlyph **bucket = glyphcache_bucket (self, c, style, &shard);
+  pthread_spin_lock (&shard->lock);
+  CachedGlyph *glyph = glyphcache_find (self, c, style);
+  *added = (glyph == NULL);
+  if (!glyph)
+    {
+    glyph = malloc (sizeof (CachedGlyph));
+    memset (glyph, 0, sizeof (CachedGlyph));
+    glyph->c = c;
+    glyph->style = style;
+    glyph->state = GLYPH_STATE_RESERVED;
+    glyph->next = *bucket;
+    // Readers don't lock, so the glyph must be complete before it
+    //  is linked in
+    __atomic_store_n (bucket, glyph, __ATOMIC_RELEASE);
+    }
+  pthread_spin_unlock (&shard->lock);
+  return glyph;
+  }
+
+
+/*==========================================================================
+  glyphcache_claim
+
+  Claim the right to render a reserved glyph. Returns FALSE if some 
+  other thread is rendering it, or has already done so.
+
+*==========================================================================*/
+static BOOL glyphcache_claim (CachedGlyph *glyph)
+  {
+  int expected = GLYPH_STATE_RESERVED;
+  return __atomic_compare_exchange_n (&glyph->state, &expected, 
+    GLYPH_STATE_RENDERING, FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+  }
+
+
+/*==========================================================================
+  glyphcache_unclaim
+
+  Give up a claim, when there's no face to render with, so that 
+  another thread can try later.
+
+*==========================================================================*/
+static void glyphcache_unclaim (CachedGlyph *glyph)
+  {
+  __atomic_store_n (&glyph->state, GLYPH_STATE_RESERVED, __ATOMIC_RELEASE);
+  }
+
+
+/*==========================================================================
+  glyphcache_get
+*==========================================================================*/
+const CachedGlyph *glyphcache_get (GlyphCache *self, UTF32 c, int style)
+  {
+  CachedGlyph *glyph = glyphcache_find (self, c, style);
+  if (!glyph)
+    {
+    BOOL added;
+    glyph = glyphcache_add (self, c, style, &added);
+    }
+
+  // The glyph might have been requested, but not rendered yet, or
+  //  another thread might be rendering it now
+  while (__atomic_load_n (&glyph->state, __ATOMIC_ACQUIRE) 
+       != GLYPH_STATE_READY)
+    {
+    if (glyphcache_claim (glyph))
+      {
+      FT_Face face = glyphcache_thread_face (self);
+      if (face)
+        glyphcache_render (self, face, glyph);
+      else
+        {
+        // Another thread might claim the glyph as soon as it is 
+        //  given up, so the caller mustn't see it until it is READY
+        glyphcache_unclaim (glyph);
+        return &glyphcache_empty;
+        }
+      }
+    else
+      sched_yield ();
+    }
+  return glyph;
+  }
+
+
+/*==========================================================================
+  glyphcache_set_font_file
+*==========================================================================*/
+void glyphcache_set_font_file (GlyphCache *self, FT_Library ft, 
+      const char *ttf_file)
+  {
+  self->ft = ft;
+  free (self->ttf_file);
+  self->ttf_file = strdup (ttf_file);
+  }
+
+
+/*==========================================================================
+  glyphcache_request
+*==========================================================================*/
+void glyphcache_request (GlyphCache *self, const UTF32 *text, int len, 
+      int style)
+  {
+  for (int i = 0; i < len; i++)
+    {
+    UTF32 c = text[i];
+    if (glyphcache_find (self, c, style)) continue;
+    BOOL added;
+    CachedGlyph *g = glyphcache_add (self, c, style, &added);
+    if (!added) continue;
+
+    if (self->n_pending == self->pending_size)
+      {
+      self->pending_size = self->pending_size ? self->pending_size * 2 : 64;
+      self->pending = realloc (self->pending, 
+        self->pending_size * sizeof (CachedGlyph *));
+      }
+    self->pending[self->n_pending++] = g;
+    }
+  }
+
+
+/*==========================================================================
+  glyphcache_render_claimed
+
+  Render a glyph on the calling thread, if no other thread has got 
+  to it first.
+
+*==========================================================================*/
+static void glyphcache_render_claimed (GlyphCache *self, CachedGlyph *glyph)
+  {
+  if (!glyphcache_claim (glyph)) return;
+  FT_Face face = glyphcache_thread_face (self);
+  // If we couldn't get a face, the glyph will be rendered on demand
+  if (face)
+    glyphcache_render (self, face, glyph);
+  else
+    glyphcache_unclaim (glyph);
+  }
+
+
+/*==========================================================================
+  glyphcache_render_task
+*==========================================================================*/
+static void glyphcache_render_task (void *arg)
+  {
+  RenderBatch *batch = arg;
+  for (int i = 0; i < batch->n_glyphs; i++)
+    glyphcache_render_claimed (batch->cache, batch->glyphs[i]);
+  }
+
+
+/*==========================================================================
+  glyphcache_set_scheduler
+*==========================================================================*/
+void glyphcache_set_scheduler (GlyphCache *self, Scheduler *scheduler)
+  {
+  self->scheduler = scheduler;
+  if (!scheduler) return;
+  // Make room for a face for each worker thread. This must be done 
+  //  before the workers start rendering, because they can't safely
+  //  change the array.
+  int n_threads = scheduler_get_threads (scheduler);
+  if (self->n_worker_faces < n_threads)
+    {
+    self->worker_faces = realloc (self->worker_faces, 
+      n_threads * sizeof (FT_Face));
+    for (int i = self->n_worker_faces; i < n_threads; i++)
+      self->worker_faces[i] = NULL;
+    self->n_worker_faces = n_threads;
+    }
+  }
+
+
+/*==========================================================================
+  glyphcache_render_pending
+*==========================================================================*/
+void glyphcache_render_pending (GlyphCache *self, Scheduler *scheduler)
+  {
+  if (self->n_pending == 0) return;
+  log_debug ("Rendering %d pending glyphs", self->n_pending);
+
+  if (!self->ttf_file || !scheduler)
+    {
+    for (int i = 0; i < self->n_pending; i++)
+      glyphcache_render_claimed (self, self->pending[i]);
+    self->n_pending = 0;
+    return;
+    }
+
+  if (scheduler != self->scheduler) 
+    glyphcache_set_scheduler (self, scheduler);
+
+  int n_batches = (self->n_pending + GLYPHCACHE_BATCH - 1) 
+    / GLYPHCACHE_BATCH;
+  RenderBatch *batches = malloc (n_batches * sizeof (RenderBatch));
+  for (int i = 0; i < n_batches; i++)
+    {
+    RenderBatch *b = &batches[i];
+    b->cache = self;
+    b->glyphs = self->pending + i * GLYPHCACHE_BATCH;
+    b->n_glyphs = self->n_pending - i * GLYPHCACHE_BATCH;
+    if (b->n_glyphs > GLYPHCACHE_BATCH) b->n_glyphs = GLYPHCACHE_BATCH;
+    scheduler_submit (scheduler, glyphcache_render_task, b);
+    }
+  scheduler_wait (scheduler);
+  free (batches);
+  self->n_pending = 0;
+  }
+
+
+/*==========================================================================
+  glyphcache_reserve
+*==========================================================================*/
+CachedGlyph *glyphcache_reserve (GlyphCache *self, UTF32 c, int style)
+  {
+  if (glyphcache_find (self, c, style)) return NULL;
+  BOOL added;
+  CachedGlyph *glyph = glyphcache_add (self, c, style, &added);
+  return added ? glyph : NULL;
+  }
+
+
+/*==========================================================================
+  glyphcache_render_reserved
+*==========================================================================*/
+void glyphcache_render_reserved (GlyphCache *self, CachedGlyph *glyph)
+  {
+  glyphcache_render_claimed (self, glyph);
+  }
+
+
+/*==========================================================================
+  glyphcache_get_kerning
+*==========================================================================*/
+int glyphcache_get_kerning (GlyphCache *self, 
+      const CachedGlyph *left, const CachedGlyph *right)
+  {
+  if (!FT_HAS_KERNING (self->face)) return 0;
+  // FreeType faces are not thread-safe, so use this thread's own face
+  FT_Face face = glyphcache_thread_face (self);
+  FT_Vector delta;
+  if (!face || FT_Get_Kerning (face, left->index, right->index,
+       FT_KERNING_DEFAULT, &delta) != 0) return 0;
+  return delta.x / 64;
+  }
+
+
+/*==========================================================================
+  glyphcache_get_ascent
+*==========================================================================*/
+int glyphcache_get_ascent (const GlyphCache *self)
+  {
+  return self->ascent;
+  }
+
+
+/*==========================================================================
+  glyphcache_get_cell_height
+*==========================================================================*/
+int glyphcache_get_cell_height (const GlyphCache *self)
+  {
+  return self->cell_height;
+  }
+
+
+/*==========================================================================
+  glyphcache_get_face
+*==========================================================================*/
+FT_Face glyphcache_get_face (const GlyphCache *self)
+  {
+  return self->face;
+  }
+
@@ -0,0 +1,163 @@
+/*============================================================================
+
+  glyphcache.h
+
+  A "class" that renders glyphs from a FreeType face, and keeps the
+  resulting bitmaps, so that each character is rasterized only once
+  per style.
+
+  Styles are synthetic: bold and italic glyphs are produced by
+  transforming the outline of the regular glyph, rather than by loading
+  another font file.
+
+  The cache can be shared by the worker threads of a scheduler, and
+  the one thread that created it. Any of these threads can get glyphs
+  at the same time. Glyphs that are already cached are found without
+  taking any lock.
+
+  The usual sequence of operations is
+  glyphcache_create
+  glyphcache_get (probably many times)
+  glyphcache_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <freetype2/ft2build.h>
+#include <freetype/freetype.h>
+#include "defs.h"
+#include "scheduler.h"
+
+// Style flags -- these can be ORed together
+#define GLYPH_STYLE_REGULAR 0
+#define GLYPH_STYLE_BOLD    1
+#define GLYPH_STYLE_ITALIC  2
+
+struct _GlyphCache;
+typedef struct _GlyphCache GlyphCache;
+
+/** The part of one row of a glyph's bitmap that has any coverage: 
+    columns start to end - 1. If the row is empty, start and end are
+    the same. */
+typedef struct _GlyphSpan
+  {
+  short start;
+  short end;
+  } GlyphSpan;
+
+/** A rendered glyph. All measurements are in pixels. (x_off,y_off) is
+    the position of the top-left corner of the bitmap, relative to the
+    top-left corner of the character cell; the cell's top is the top of
+    the face's bounding box. The bitmap is the smallest rectangle that
+    holds all the glyph's coverage, so its first and last rows and 
+    columns are never empty, but rows between them can be; spans 
+    says which pixels of each row need to be drawn at all. */
+typedef struct _CachedGlyph
+  {
+  UTF32 c; // The character this glyph represents
+  FT_UInt index; // The glyph index in the face
+  int style; // GLYPH_STYLE_XXX flags used to render it
+  int x_off; // Horizontal offset of the bitmap within the cell
+  int y_off; // Vertical offset of the bitmap within the cell
+  int advance; // Distance to move the pen after drawing
+  int width; // Width of the bitmap
+  int rows; // Height of the bitmap
+  int pitch; // Bytes between rows in the bitmap
+  BYTE *buffer; // 8-bit coverage values, or NULL if width or rows are 0
+  GlyphSpan *spans; // One for each row, or NULL if buffer is NULL
+  int state; // Whether the glyph is rendered -- for the cache's use only
+  struct _CachedGlyph *next; // Next glyph in the same hash bucket
+  } CachedGlyph;
+
+BEGIN_DECLS
+
+/** Create a new, empty cache for glyphs from the specified face.
+    The face must already have its size set, and must not be changed
+    while the cache is in use. This method always succeeds, and must
+    eventually be followed by a call to glyphcache_destroy(). */
+GlyphCache        *glyphcache_create (FT_Face face);
+
+/** Free all the cached glyphs, and the cache itself. This method does
+    not close the face. */
+void               glyphcache_destroy (GlyphCache *self);
+
+/** Get the rendered glyph for character c in the specified style,
+    rasterizing it only if it is not already in the cache. The glyph
+    remains owned by the cache. This method always returns a glyph --
+    if the face has no glyph for the character, the result is the
+    face's "missing glyph" glyph, usually an empty box. It can be
+    called from worker threads, once glyphcache_set_scheduler() and
+    glyphcache_set_font_file() have been called; if another thread is
+    rendering the same glyph, this method waits for it. */
+const CachedGlyph *glyphcache_get (GlyphCache *self, UTF32 c, int style);
+
+/** Tell the cache where the face was loaded from, so that it can 
+    open additional copies of it for use by other threads. Without
+    this, glyphcache_render_pending() renders on the calling thread. */
+void               glyphcache_set_font_file (GlyphCache *self, 
+                      FT_Library ft, const char *ttf_file);
+
+/** Tell the cache which scheduler's worker threads will use it, so
+    that each can have its own copy of the face -- a FreeType face can
+    only be used by one thread at a time. This must be called while
+    no worker is using the cache. */
+void               glyphcache_set_scheduler (GlyphCache *self, 
+                      Scheduler *scheduler);
+
+/** Note that the len characters of text will be needed in the 
+    specified style. Characters that are not already in the cache are
+    added to a list of pending glyphs, for rendering by
+    glyphcache_render_pending(). The list belongs to the thread that 
+    created the cache, and only that thread may call this method. */
+void               glyphcache_request (GlyphCache *self, 
+                      const UTF32 *text, int len, int style);
+
+/** Render all the pending glyphs, in parallel, using the scheduler.
+    Each worker thread uses its own copy of the face. The cache is 
+    set to use this scheduler, if it wasn't already. This method 
+    returns when all the glyphs are ready. */
+void               glyphcache_render_pending (GlyphCache *self, 
+                      Scheduler *scheduler);
+
+/** Add a placeholder for a glyph that is not in the cache, and return
+    it, so that it can be rendered later by glyphcache_render_reserved(),
+    perhaps on one of the scheduler's worker threads. Returns NULL if 
+    the glyph is already in the cache, or has already been reserved or
+    requested. */
+CachedGlyph       *glyphcache_reserve (GlyphCache *self, UTF32 c, 
+                      int style);
+
+/** Render a glyph returned by glyphcache_reserve(), using the face 
+    that belongs to the calling thread. Nothing is done if another 
+    thread has already started rendering the glyph. If the glyph could
+    not be rendered, it is left for glyphcache_get() to render on 
+    demand. */
+void               glyphcache_render_reserved (GlyphCache *self, 
+                      CachedGlyph *glyph);
+
+/** Get the kerning adjustment, in pixels, to be added to the advance
+    of glyph left when it is followed by glyph right. This is usually 
+    zero or negative, and is always zero if the face has no kerning
+    information. Like glyphcache_get(), this can be called from
+    worker threads. */
+int                glyphcache_get_kerning (GlyphCache *self, 
+                      const CachedGlyph *left, const CachedGlyph *right);
+
+/** Get the distance, in pixels, from the top of the character cell to
+    the glyph baseline. */
+int                glyphcache_get_ascent (const GlyphCache *self);
+
+/** Get the height, in pixels, of a character cell -- the height of a
+    box that will enclose any glyph in the face. This is usually a
+    little larger than the line spacing, so glyphs on adjacent lines
+    can overlap slightly. */
+int                glyphcache_get_cell_height (const GlyphCache *self);
+
+/** Get the face from which the cached glyphs are rendered. */
+FT_Face            glyphcache_get_face (const GlyphCache *self);
+
+END_DECLS
+
@@ -0,0 +1,97 @@
+/*============================================================================
+
+  grapheme.c
+
+  Implementation of the functions defined in grapheme.h.
+
+  The rules of UAX #29 are tried in order, and the first that applies
+  decides. Apart from the properties of the characters either side of
+  the position, they only need to know whether the characters before 
+  it are a pictograph, followed by any number of marks, for emoji 
+  sequences joined by ZWJ (GB11), and how many regional indicators 
+  there are in a row, so that they are paired into flags (GB12, GB13).
+
+  The rule numbers are those of the standard.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "defs.h"
+#include "log.h"
+#include "grapheme.h"
+#include "grapheme_table.h"
+
+
+/*==========================================================================
+  grapheme_init
+*==========================================================================*/
+void grapheme_init (GraphemeState *state)
+  {
+  state->prev = -1;
+  state->ri = 0;
+  state->pictographic = FALSE;
+  }
+
+
+/*==========================================================================
+  grapheme_rules
+*==========================================================================*/
+static BOOL grapheme_rules (const GraphemeState *state, int b)
+  {
+  int a = state->prev;
+  // GB1, GB3, GB4, GB5
+  if (a < 0) return TRUE;
+  if (a == GCB_CR && b == GCB_LF) return FALSE;
+  if (a == GCB_CONTROL || a == GCB_CR || a == GCB_LF) return TRUE;
+  if (b == GCB_CONTROL || b == GCB_CR || b == GCB_LF) return TRUE;
+  // GB6, GB7, GB8 -- Hangul syllables
+  if (a == GCB_L && (b == GCB_L || b == GCB_V || b == GCB_LV 
+       || b == GCB_LVT))
+    return FALSE;
+  if ((a == GCB_LV || a == GCB_V) && (b == GCB_V || b == GCB_T))
+    return FALSE;
+  if ((a == GCB_LVT || a == GCB_T) && b == GCB_T) return FALSE;
+  // GB9, GB9a, GB9b
+  if (b == GCB_EXTEND || b == GCB_ZWJ || b == GCB_SPACINGMARK) 
+    return FALSE;
+  if (a == GCB_PREPEND) return FALSE;
+  // GB11
+  if (a == GCB_ZWJ && b == GCB_EXTPICT && state->pictographic) 
+    return FALSE;
+  // GB12, GB13
+  if (a == GCB_RI && b == GCB_RI && state->ri % 2 == 1) return FALSE;
+  // GB999
+  return TRUE;
+  }
+
+
+/*==========================================================================
+  grapheme_is_boundary
+*==========================================================================*/
+BOOL grapheme_is_boundary (GraphemeState *state, UTF32 c)
+  {
+  int b = grapheme_class (c);
+  BOOL ret = grapheme_rules (state, b);
+  if (b == GCB_EXTPICT)
+    state->pictographic = TRUE;
+  else if (b != GCB_EXTEND && b != GCB_ZWJ)
+    state->pictographic = FALSE;
+  state->ri = b == GCB_RI ? state->ri + 1 : 0;
+  state->prev = b;
+  return ret;
+  }
+
+
+/*==========================================================================
+  grapheme_is_mark
+*==========================================================================*/
+BOOL grapheme_is_mark (UTF32 c)
+  {
+  int gcb = grapheme_class (c);
+  return gcb == GCB_EXTEND || gcb == GCB_ZWJ;
+  }
+
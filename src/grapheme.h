@@ -0,0 +1,60 @@
+/*============================================================================
+
+  grapheme.h
+
+  Functions for finding the boundaries of grapheme clusters -- the
+  sequences of characters that a reader sees as one character, like an
+  "e" followed by a combining acute accent, a flag made of two regional
+  indicators, or an emoji with a skin-tone modifier -- following the 
+  Unicode text segmentation rules (UAX #29).
+
+  A cluster must never be split: a line is not broken inside one, and
+  the characters that are combined with the first -- the marks -- are
+  drawn over it, rather than after it.
+
+  The property of each character is found with two loads from a table
+  that is generated, when fbtextdemo is built, from the Unicode
+  Character Database. The rules only need to remember a little about
+  the characters already seen, which is kept in a GraphemeState, so
+  text can be segmented one character at a time, as it arrives, in
+  linear time, and without allocating anything.
+
+  The usual sequence of operations is
+  grapheme_init
+  grapheme_is_boundary (for each character)
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+/** What the rules need to know about the characters seen so far. The
+    fields are private. */
+typedef struct _GraphemeState
+  {
+  int prev; // Property of the last character, or -1 at the start
+  int ri; // Number of regional indicators in a row, ending at prev
+  BOOL pictographic; // TRUE after a pictograph and any marks after it
+  } GraphemeState;
+
+BEGIN_DECLS
+
+/** Set the state to the start of the text. */
+void             grapheme_init (GraphemeState *state);
+
+/** Returns TRUE if a grapheme cluster starts at c, the next character
+    of the text, and records c in the state. The first character of
+    the text always starts a cluster. */
+BOOL             grapheme_is_boundary (GraphemeState *state, UTF32 c);
+
+/** Returns TRUE if c is a mark -- a character that is combined with the
+    character before it, like a combining accent, a variation selector,
+    an emoji modifier, or a zero-width joiner -- and so takes no space
+    of its own, when it is not the first character of a cluster. */
+BOOL             grapheme_is_mark (UTF32 c);
+
+END_DECLS
+
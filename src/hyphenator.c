@@ -0,0 +1,531 @@
+/*============================================================================
+
+  hyphenator.c
+
+  Implementation of the "methods" defined in hyphenator.h.
+
+  A pattern like "hen5at" says that, wherever the letters "henat"
+  appear in a word, the gap between the "n" and the "a" gets the value
+  5. Every pattern that matches anywhere in the word is applied, and
+  each gap keeps the highest value any pattern gives it; an odd value
+  means a hyphen can go there. A "." in a pattern matches the start or
+  end of the word.
+
+  The patterns are first read into a simple trie, in which each node
+  has a list of children, and then compiled into a trie in a single
+  array, in which the children of each node are next to each other,
+  sorted by character, so they can be found with a binary search.
+  Matching a word takes one walk down the trie for each position in
+  the word, and each walk stops as soon as no pattern can match.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include "defs.h"
+#include "log.h"
+#include "hyphenator.h"
+
+// The usual minimum numbers of characters before and after a hyphen,
+//  for files that don't specify them
+#define HYPHENATOR_LEFT_MIN  2
+#define HYPHENATOR_RIGHT_MIN 3
+
+// The longest pattern that is read -- real patterns are much shorter
+#define HYPHENATOR_MAX_PATTERN 32
+
+// A node of the trie while it is being built
+typedef struct _BuildNode
+  {
+  UTF32 c;
+  int child; // First child, or -1
+  int sibling; // Next child of the same parent, or -1
+  int values; // Offset of the pattern's values, or -1 if no pattern
+              //  ends here
+  } BuildNode;
+
+// A node of the compiled trie
+typedef struct _TrieNode
+  {
+  UTF32 c;
+  int values; // As in BuildNode
+  int first_child; // Index of the first child
+  int n_children;
+  } TrieNode;
+
+struct _Hyphenator
+  {
+  TrieNode *nodes; // nodes[0] is the root
+  int n_nodes;
+  BYTE *values; // Values of all the patterns, one more than the
+                //  number of characters in each
+  UTF32 *alphabet; // The letters in the patterns, in order
+  int n_letters;
+  int left_min;
+  int right_min;
+  };
+
+// The state of reading a pattern file
+typedef struct _HyphenatorBuilder
+  {
+  BuildNode *nodes;
+  int n_nodes;
+  int nodes_size;
+  BYTE *values;
+  int n_values;
+  int values_size;
+  int n_patterns;
+  } HyphenatorBuilder;
+
+
+/*==========================================================================
+  hyphenator_add_node
+*==========================================================================*/
+static int hyphenator_add_node (HyphenatorBuilder *b, UTF32 c)
+  {
+  if (b->n_nodes == b->nodes_size)
+    {
+    b->nodes_size *= 2;
+    b->nodes = realloc (b->nodes, b->nodes_size * sizeof (BuildNode));
+    }
+  BuildNode *n = &b->nodes[b->n_nodes];
+  n->c = c;
+  n->child = -1;
+  n->sibling = -1;
+  n->values = -1;
+  return b->n_nodes++;
+  }
+
+
+/*==========================================================================
+  hyphenator_add_pattern
+
+  Add a pattern of n letters, with its n + 1 values, to the trie
+
+*==========================================================================*/
+static void hyphenator_add_pattern (HyphenatorBuilder *b,
+      const UTF32 *letters, int n, const BYTE *values)
+  {
+  int node = 0;
+  for (int i = 0; i < n; i++)
+    {
+    int child = b->nodes[node].child;
+    while (child >= 0 && b->nodes[child].c != letters[i])
+      child = b->nodes[child].sibling;
+    if (child < 0)
+      {
+      child = hyphenator_add_node (b, letters[i]);
+      b->nodes[child].sibling = b->nodes[node].child;
+      b->nodes[node].child = child;
+      }
+    node = child;
+    }
+
+  if (b->n_values + n + 1 > b->values_size)
+    {
+    b->values_size = b->values_size * 2 + n + 1;
+    b->values = realloc (b->values, b->values_size);
+    }
+  // A repeated pattern replaces the earlier one
+  b->nodes[node].values = b->n_values;
+  memcpy (b->values + b->n_values, values, n + 1);
+  b->n_values += n + 1;
+  b->n_patterns++;
+  }
+
+
+/*==========================================================================
+  hyphenator_decode
+
+  Get the next character from a line of the file, which is in UTF-8 or,
+  if latin1 is TRUE, ISO-8859-1, and move *p past it
+
+*==========================================================================*/
+static UTF32 hyphenator_decode (const BYTE **p, BOOL latin1)
+  {
+  const BYTE *s = *p;
+  UTF32 c = *s++;
+  if (!latin1 && c >= 0xc0)
+    {
+    int more = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+    c &= 0x3f >> more;
+    for (; more > 0 && (*s & 0xc0) == 0x80; more--)
+      c = (c << 6) | (*s++ & 0x3f);
+    }
+  *p = s;
+  return c;
+  }
+
+
+/*==========================================================================
+  hyphenator_lower
+
+  Convert a character to lower case. This does not use towlower(),
+  which only works for ASCII unless the program sets a locale; it
+  covers the Latin, Greek, and Cyrillic letters that patterns are
+  usually written for.
+
+*==========================================================================*/
+static UTF32 hyphenator_lower (UTF32 c)
+  {
+  if ((c >= 'A' && c <= 'Z') || (c >= 0xc0 && c <= 0xde && c != 0xd7))
+    return c + 0x20;
+  if (c >= 0x100 && c <= 0x17f)
+    {
+    // Latin Extended-A mostly pairs upper and lower case, with the
+    //  upper case first -- but from U+0139 to U+0148, and from U+0179,
+    //  the lower case is at the odd code
+    BOOL odd_upper = (c >= 0x139 && c <= 0x148) || c >= 0x179;
+    if (c != 0x130 && c != 0x138 && c != 0x149 && c != 0x17f
+        && (c & 1) == (odd_upper ? 1 : 0))
+      return c + 1;
+    return c;
+    }
+  if ((c >= 0x391 && c <= 0x3ab && c != 0x3a2) || (c >= 0x410 && c <= 0x42f))
+    return c + 0x20;
+  if (c >= 0x400 && c <= 0x40f) return c + 0x50;
+  return c;
+  }
+
+
+/*==========================================================================
+  hyphenator_parse_pattern
+
+  Add one pattern, like "hen5at", from a file to the trie
+
+*==========================================================================*/
+static void hyphenator_parse_pattern (HyphenatorBuilder *b,
+      const BYTE *s, const BYTE *end, BOOL latin1)
+  {
+  UTF32 letters [HYPHENATOR_MAX_PATTERN];
+  BYTE values [HYPHENATOR_MAX_PATTERN + 1];
+  int n = 0;
+  memset (values, 0, sizeof (values));
+  while (s < end)
+    {
+    if (*s >= '0' && *s <= '9')
+      {
+      values[n] = *s++ - '0';
+      continue;
+      }
+    UTF32 c = hyphenator_decode (&s, latin1);
+    // Patterns with the non-standard extensions that some .dic files
+    //  use, to change the spelling around the hyphen, are skipped
+    if (c == '/' || n == HYPHENATOR_MAX_PATTERN) return;
+    letters[n++] = hyphenator_lower (c);
+    }
+  if (n > 0) hyphenator_add_pattern (b, letters, n, values);
+  }
+
+
+/*==========================================================================
+  hyphenator_parse_line
+*==========================================================================*/
+static void hyphenator_parse_line (Hyphenator *self, HyphenatorBuilder *b,
+      char *line, BOOL latin1)
+  {
+  char *comment = strchr (line, '%');
+  if (comment) *comment = 0;
+
+  // Keywords in libhyphen's format
+  int n;
+  if (sscanf (line, " LEFTHYPHENMIN %d", &n) == 1)
+    self->left_min = n;
+  else if (sscanf (line, " RIGHTHYPHENMIN %d", &n) == 1)
+    self->right_min = n;
+  else if (isupper ((BYTE)line[strspn (line, " \t")]))
+    log_debug ("Ignoring hyphenation keyword %s", line);
+  else
+    {
+    // Everything else is patterns, separated by spaces, except the
+    //  TeX commands that surround them in .tex files
+    char *save = NULL;
+    for (char *t = strtok_r (line, " \t\r\n", &save); t;
+         t = strtok_r (NULL, " \t\r\n", &save))
+      {
+      if (strpbrk (t, "\\{}")) continue;
+      hyphenator_parse_pattern (b, (const BYTE *)t,
+        (const BYTE *)t + strlen (t), latin1);
+      }
+    }
+  }
+
+
+/*==========================================================================
+  hyphenator_compare_nodes
+
+  Sort build node indices by character
+
+*==========================================================================*/
+static const BuildNode *hyphenator_sort_nodes;
+static int hyphenator_compare_nodes (const void *a, const void *b)
+  {
+  UTF32 ca = hyphenator_sort_nodes[*(const int *)a].c;
+  UTF32 cb = hyphenator_sort_nodes[*(const int *)b].c;
+  return ca < cb ? -1 : ca > cb ? 1 : 0;
+  }
+
+
+/*==========================================================================
+  hyphenator_compare_chars
+*==========================================================================*/
+static int hyphenator_compare_chars (const void *a, const void *b)
+  {
+  UTF32 ca = *(const UTF32 *)a;
+  UTF32 cb = *(const UTF32 *)b;
+  return ca < cb ? -1 : ca > cb ? 1 : 0;
+  }
+
+
+/*==========================================================================
+  hyphenator_compile
+
+  Lay the trie out in one array, breadth first, so that the children
+  of every node are together, in order of their characters
+
+*==========================================================================*/
+static void hyphenator_compile (Hyphenator *self, HyphenatorBuilder *b)
+  {
+  self->n_nodes = b->n_nodes;
+  self->nodes = malloc (b->n_nodes * sizeof (TrieNode));
+  // For each compiled node, the build node it came from
+  int *from = malloc (b->n_nodes * sizeof (int));
+  int *children = malloc (b->n_nodes * sizeof (int));
+
+  self->nodes[0].c = 0;
+  self->nodes[0].values = b->nodes[0].values;
+  from[0] = 0;
+  int next = 1;
+  for (int i = 0; i < next; i++)
+    {
+    int n = 0;
+    for (int c = b->nodes[from[i]].child; c >= 0; c = b->nodes[c].sibling)
+      children[n++] = c;
+    hyphenator_sort_nodes = b->nodes;
+    qsort (children, n, sizeof (int), hyphenator_compare_nodes);
+    self->nodes[i].first_child = next;
+    self->nodes[i].n_children = n;
+    for (int j = 0; j < n; j++)
+      {
+      TrieNode *node = &self->nodes[next + j];
+      node->c = b->nodes[children[j]].c;
+      node->values = b->nodes[children[j]].values;
+      from[next + j] = children[j];
+      }
+    next += n;
+    }
+
+  free (children);
+  free (from);
+  self->values = b->values;
+  b->values = NULL;
+
+  // The alphabet is every character in the trie except '.', which
+  //  stands for the ends of the word
+  self->alphabet = malloc (self->n_nodes * sizeof (UTF32));
+  for (int i = 1; i < self->n_nodes; i++)
+    if (self->nodes[i].c != '.')
+      self->alphabet[self->n_letters++] = self->nodes[i].c;
+  qsort (self->alphabet, self->n_letters, sizeof (UTF32),
+    hyphenator_compare_chars);
+  int n = 0;
+  for (int i = 0; i < self->n_letters; i++)
+    if (n == 0 || self->alphabet[n - 1] != self->alphabet[i])
+      self->alphabet[n++] = self->alphabet[i];
+  self->n_letters = n;
+  }
+
+
+/*==========================================================================
+  hyphenator_create
+*==========================================================================*/
+Hyphenator *hyphenator_create (const char *filename, char **error)
+  {
+  LOG_IN
+  Hyphenator *self = NULL;
+  FILE *f = fopen (filename, "r");
+  if (f)
+    {
+    self = malloc (sizeof (Hyphenator));
+    memset (self, 0, sizeof (Hyphenator));
+    self->left_min = HYPHENATOR_LEFT_MIN;
+    self->right_min = HYPHENATOR_RIGHT_MIN;
+
+    HyphenatorBuilder b;
+    memset (&b, 0, sizeof (b));
+    b.nodes_size = 1024;
+    b.nodes = malloc (b.nodes_size * sizeof (BuildNode));
+    hyphenator_add_node (&b, 0);
+
+    char *line = NULL;
+    size_t line_size = 0;
+    BOOL first = TRUE;
+    BOOL latin1 = FALSE;
+    while (getline (&line, &line_size, f) >= 0)
+      {
+      // A libhyphen file starts with the name of its character set --
+      //  the only line in capitals, apart from keywords
+      if (first && isupper ((BYTE)line[0]) && !strchr (line, ' '))
+        {
+        latin1 = strncmp (line, "ISO8859-1", 9) == 0
+          && !isdigit ((BYTE)line[9]);
+        if (!latin1 && strncmp (line, "UTF-8", 5) != 0)
+          log_warning ("%s: character set %s is treated as UTF-8",
+            filename, strtok (line, "\r\n"));
+        first = FALSE;
+        continue;
+        }
+      first = FALSE;
+      hyphenator_parse_line (self, &b, line, latin1);
+      }
+    free (line);
+    fclose (f);
+
+    if (b.n_patterns > 0)
+      {
+      hyphenator_compile (self, &b);
+      log_debug ("Read %d hyphenation patterns from %s into %d nodes",
+        b.n_patterns, filename, self->n_nodes);
+      }
+    else
+      {
+      asprintf (error, "No hyphenation patterns in %s", filename);
+      free (self);
+      self = NULL;
+      }
+    free (b.nodes);
+    free (b.values);
+    }
+  else
+    asprintf (error, "Can't open %s: %s", filename, strerror (errno));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  hyphenator_destroy
+*==========================================================================*/
+void hyphenator_destroy (Hyphenator *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    free (self->nodes);
+    free (self->values);
+    free (self->alphabet);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  hyphenator_find_child
+
+  Find the child of a node for a character, or return NULL
+
+*==========================================================================*/
+static inline const TrieNode *hyphenator_find_child (const Hyphenator *self,
+      const TrieNode *node, UTF32 c)
+  {
+  int low = node->first_child;
+  int high = low + node->n_children - 1;
+  while (low <= high)
+    {
+    int mid = (low + high) / 2;
+    UTF32 mc = self->nodes[mid].c;
+    if (mc == c) return &self->nodes[mid];
+    if (mc < c)
+      low = mid + 1;
+    else
+      high = mid - 1;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+  hyphenator_is_letter
+
+  Returns TRUE if the (lower-case) character is in the patterns
+
+*==========================================================================*/
+static BOOL hyphenator_is_letter (const Hyphenator *self, UTF32 c)
+  {
+  return bsearch (&c, self->alphabet, self->n_letters, sizeof (UTF32),
+    hyphenator_compare_chars) != NULL;
+  }
+
+
+/*==========================================================================
+  hyphenator_hyphenate
+*==========================================================================*/
+int hyphenator_hyphenate (const Hyphenator *self, const UTF32 *word,
+      int len, BOOL *breaks)
+  {
+  memset (breaks, 0, len * sizeof (BOOL));
+  if (len > HYPHENATOR_MAX_WORD) return 0;
+
+  // The letters must be together, with nothing but punctuation before
+  //  and after them
+  int first = 0;
+  int end = len;
+  while (first < end && !hyphenator_is_letter (self,
+           hyphenator_lower (word[first])))
+    first++;
+  while (end > first && !hyphenator_is_letter (self,
+           hyphenator_lower (word[end - 1])))
+    end--;
+  int letters = end - first;
+  if (letters < self->left_min + self->right_min) return 0;
+
+  // The letters, in lower case, with a '.' at each end, and the value
+  //  of the gap before each of them
+  UTF32 w [HYPHENATOR_MAX_WORD + 2];
+  BYTE points [HYPHENATOR_MAX_WORD + 3];
+  int n = letters + 2;
+  w[0] = '.';
+  for (int i = 0; i < letters; i++)
+    {
+    w[i + 1] = hyphenator_lower (word[first + i]);
+    if (!hyphenator_is_letter (self, w[i + 1])) return 0;
+    }
+  w[n - 1] = '.';
+  memset (points, 0, sizeof (points));
+
+  for (int start = 0; start < n; start++)
+    {
+    const TrieNode *node = self->nodes;
+    for (int i = start; i < n; i++)
+      {
+      node = hyphenator_find_child (self, node, w[i]);
+      if (!node) break;
+      if (node->values >= 0)
+        {
+        const BYTE *v = self->values + node->values;
+        for (int j = 0; j <= i - start + 1; j++)
+          if (v[j] > points[start + j]) points[start + j] = v[j];
+        }
+      }
+    }
+
+  int count = 0;
+  for (int i = self->left_min; i <= letters - self->right_min; i++)
+    {
+    if (points[i + 1] & 1)
+      {
+      breaks[first + i] = TRUE;
+      count++;
+      }
+    }
+  return count;
+  }
+
@@ -0,0 +1,65 @@
+/*============================================================================
+
+  hyphenator.h
+
+  A "class" that finds the places where words can be hyphenated, using
+  Frank Liang's method -- the one TeX uses -- and a file of patterns
+  for a specific language. The patterns are read once, and compiled
+  into a trie, so hyphenating a word is a few short walks through the
+  trie, and allocates nothing.
+
+  Pattern files are plain text, either one pattern per line in UTF-8,
+  as in the hyph-utf8 project's .pat.txt files, or in the .dic format
+  used by libhyphen (and so LibreOffice), which may start with the name
+  of its character set, and may set the minimum number of characters
+  before and after a hyphen with LEFTHYPHENMIN and RIGHTHYPHENMIN
+  lines. Most Linux distributions package the latter, in
+  /usr/share/hyphen.
+
+  A hyphenator is never changed after it is created, so any number of
+  threads can use it at the same time.
+
+  The usual sequence of operations is
+  hyphenator_create
+  hyphenator_hyphenate (probably many times)
+  hyphenator_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// Words longer than this are never hyphenated
+#define HYPHENATOR_MAX_WORD 64
+
+struct _Hyphenator;
+typedef struct _Hyphenator Hyphenator;
+
+BEGIN_DECLS
+
+/** Create a hyphenator with the patterns in the specified file. If
+    the file can't be read, or contains no patterns, returns NULL, and
+    writes *error with a message that the caller should eventually free.
+    Otherwise, the result must eventually be passed to
+    hyphenator_destroy(). */
+Hyphenator      *hyphenator_create (const char *filename, char **error);
+
+/** Free the hyphenator. NULL is allowed. */
+void             hyphenator_destroy (Hyphenator *self);
+
+/** Find the places where a word of len characters can be hyphenated.
+    breaks[i] is set TRUE if a hyphen can go before character i, and
+    FALSE if not, for each i from 0 to len - 1. Case does not matter.
+    Punctuation before and after the letters, like quotes or a full
+    stop, is allowed, but a word with anything else that is not in the
+    patterns -- a digit, or a hyphen -- is not hyphenated. Returns the
+    number of places found, which is 0 for words that are too short, or
+    too long, to hyphenate. */
+int              hyphenator_hyphenate (const Hyphenator *self,
+                   const UTF32 *word, int len, BOOL *breaks);
+
+END_DECLS
+
@@ -0,0 +1,289 @@
+/*============================================================================
+
+  image.c
+
+  Implementation of the functions defined in image.h.
+
+  PPM is simple enough to read directly, a row at a time, straight
+  into the surface. PNG is read with libpng's "simplified" API, which
+  converts whatever is in the file -- palettes, grey levels, 16-bit 
+  samples -- into 8-bit BGRA in one call. libpng gives colours that 
+  are not premultiplied by alpha, so they are premultiplied here, to 
+  match what surfaces expect.
+
+  Saving a PPM is a matter of converting rows to RGB888 with a Blitter,
+  and writing them. The source is usually the framebuffer, whose 
+  memory is uncached, or write-combined, and so very slow to read in 
+  small pieces. So each band of rows is first copied out with 
+  memcpy(), which reads device memory as fast as it can be read,
+  and then converted in cached memory.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#ifdef HAVE_PNG
+#include <png.h>
+#endif
+#include "defs.h"
+#include "log.h"
+#include "image.h"
+#include "blitter.h"
+
+// The size of the buffer that rows are converted in, before they are 
+//  written, when saving a PPM
+#define IMAGE_WRITE_BUFFER (1024 * 1024)
+
+// The largest width or height of a PPM that will be loaded
+#define IMAGE_MAX_DIMENSION 32767
+
+
+/*==========================================================================
+  image_ppm_number
+
+  Read a decimal number from a PPM header, skipping whitespace and 
+  comments. Returns -1 if there isn't one, or if it is larger than
+  IMAGE_MAX_DIMENSION.
+
+*==========================================================================*/
+static int image_ppm_number (FILE *f)
+  {
+  int c = fgetc (f);
+  for (;;)
+    {
+    while (c != EOF && isspace (c)) c = fgetc (f);
+    if (c != '#') break;
+    while (c != EOF && c != '\n') c = fgetc (f);
+    }
+  if (c == EOF || !isdigit (c)) return -1;
+  int n = 0;
+  while (c != EOF && isdigit (c))
+    {
+    n = n * 10 + (c - '0');
+    if (n > IMAGE_MAX_DIMENSION) return -1;
+    c = fgetc (f);
+    }
+  // The single whitespace character after the number is part of it
+  return n;
+  }
+
+
+/*==========================================================================
+  image_load_ppm
+
+  Load a binary (P6) PPM, with 8-bit samples, from a file positioned
+  just after the magic number
+
+*==========================================================================*/
+static Surface *image_load_ppm (FILE *f, const char *filename, 
+      char **error)
+  {
+  int width = image_ppm_number (f);
+  int height = image_ppm_number (f);
+  int maxval = image_ppm_number (f);
+  if (width <= 0 || height <= 0 || maxval <= 0 || maxval > 255
+      || (size_t)width * 4 > SIZE_MAX / (size_t)height)
+    {
+    asprintf (error, "%s: unsupported PPM header", filename);
+    return NULL;
+    }
+
+  Surface *self = surface_create (width, height, SURFACE_FORMAT_BGR888);
+  if (!self)
+    {
+    asprintf (error, "%s: not enough memory for %dx%d image", filename,
+      width, height);
+    return NULL;
+    }
+  for (int y = 0; y < height; y++)
+    {
+    BYTE *row = self->data + y * self->stride;
+    if (fread (row, 3, width, f) != (size_t)width)
+      {
+      asprintf (error, "%s: PPM file is truncated", filename);
+      surface_destroy (self);
+      return NULL;
+      }
+    for (int x = 0; x < width; x++)
+      {
+      BYTE *p = row + x * 3;
+      BYTE r = p[0];
+      p[0] = p[2];
+      p[2] = r;
+      if (maxval != 255)
+        for (int i = 0; i < 3; i++) p[i] = p[i] * 255 / maxval;
+      }
+    }
+  return self;
+  }
+
+
+#ifdef HAVE_PNG
+/*==========================================================================
+  image_load_png
+*==========================================================================*/
+static Surface *image_load_png (const char *filename, char **error)
+  {
+  png_image png;
+  memset (&png, 0, sizeof (png));
+  png.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_file (&png, filename))
+    {
+    asprintf (error, "%s: %s", filename, png.message);
+    return NULL;
+    }
+
+  BOOL alpha = (png.format & PNG_FORMAT_FLAG_ALPHA) != 0;
+  png.format = alpha ? PNG_FORMAT_BGRA : PNG_FORMAT_BGR;
+  Surface *self = surface_create (png.width, png.height, 
+    alpha ? SURFACE_FORMAT_BGRA8888 : SURFACE_FORMAT_BGR888);
+  if (!self)
+    {
+    asprintf (error, "%s: not enough memory for %dx%d image", filename,
+      (int)png.width, (int)png.height);
+    png_image_free (&png);
+    return NULL;
+    }
+  if (!png_image_finish_read (&png, NULL, self->data, self->stride, NULL))
+    {
+    asprintf (error, "%s: %s", filename, png.message);
+    png_image_free (&png);
+    surface_destroy (self);
+    return NULL;
+    }
+
+  if (alpha)
+    {
+    for (int y = 0; y < self->height; y++)
+      {
+      BYTE *p = self->data + y * self->stride;
+      for (int x = 0; x < self->width; x++, p += 4)
+        {
+        p[0] = p[0] * p[3] / 255;
+        p[1] = p[1] * p[3] / 255;
+        p[2] = p[2] * p[3] / 255;
+        }
+      }
+    }
+  return self;
+  }
+#endif
+
+
+/*==========================================================================
+  image_load
+*==========================================================================*/
+Surface *image_load (const char *filename, char **error)
+  {
+  LOG_IN
+  Surface *ret = NULL;
+  FILE *f = fopen (filename, "rb");
+  if (f)
+    {
+    BYTE magic[8];
+    size_t n = fread (magic, 1, 8, f);
+    if (n >= 2 && magic[0] == 'P' && magic[1] == '6')
+      {
+      fseek (f, 2, SEEK_SET);
+      ret = image_load_ppm (f, filename, error);
+      }
+    else if (n == 8 && memcmp (magic, "\x89PNG\r\n\x1a\n", 8) == 0)
+      {
+#ifdef HAVE_PNG
+      ret = image_load_png (filename, error);
+#else
+      asprintf (error, "%s: this program was built without PNG support",
+        filename);
+#endif
+      }
+    else
+      asprintf (error, "%s: not a binary PPM or PNG file", filename);
+    fclose (f);
+    }
+  else
+    asprintf (error, "Can't open %s: %s", filename, strerror (errno));
+
+  if (ret)
+    log_debug ("Loaded %dx%d image from %s", ret->width, ret->height, 
+      filename);
+  LOG_OUT
+  return ret;
+  }
+
+
+/*==========================================================================
+  image_write_all
+
+  Write the whole of a buffer, even if write() only writes some of it
+
+*==========================================================================*/
+static BOOL image_write_all (int fd, const BYTE *buff, size_t size)
+  {
+  while (size > 0)
+    {
+    ssize_t n = write (fd, buff, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    buff += n;
+    size -= n;
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+  image_save_ppm
+*==========================================================================*/
+BOOL image_save_ppm (const Surface *surface, int fd, char **error)
+  {
+  LOG_IN
+  BOOL ret = TRUE;
+  int width = surface->width;
+  int height = surface->height;
+
+  char header[64];
+  int header_len = snprintf (header, sizeof (header), "P6\n%d %d\n255\n",
+    width, height);
+  if (!image_write_all (fd, (const BYTE *)header, header_len)) ret = FALSE;
+
+  // The output rows are packed together, so that a whole band can be 
+  //  written at once
+  int rows = IMAGE_WRITE_BUFFER / (width * 3);
+  if (rows < 1) rows = 1;
+  if (rows > height) rows = height;
+  Surface *copy = surface_create (width, rows, surface->format);
+  BYTE *rgb_data = malloc ((size_t)width * 3 * rows);
+  Surface *rgb = surface_create_for_data (rgb_data, width, rows, 
+    width * 3, SURFACE_FORMAT_RGB888);
+  Blitter *blitter = blitter_create (surface->format, 
+    SURFACE_FORMAT_RGB888, 0);
+  log_debug ("Saving %dx%d PPM in bands of %d rows, with %s kernel", 
+    width, height, rows, blitter_get_name (blitter));
+
+  for (int y = 0; ret && y < height; y += rows)
+    {
+    int n = height - y < rows ? height - y : rows;
+    surface_blit (copy, 0, 0, surface, 0, y, width, n);
+    blitter_blit (blitter, rgb, 0, 0, copy, 0, 0, width, n);
+    if (!image_write_all (fd, rgb_data, (size_t)width * 3 * n)) 
+      ret = FALSE;
+    }
+
+  if (!ret)
+    asprintf (error, "Can't write image: %s", strerror (errno));
+  blitter_destroy (blitter);
+  surface_destroy (rgb);
+  free (rgb_data);
+  surface_destroy (copy);
+  LOG_OUT
+  return ret;
+  }
+
@@ -0,0 +1,41 @@
+/*============================================================================
+
+  image.h
+
+  Functions for loading image files into surfaces, and for saving
+  surfaces as images. Binary PPM files are read and written directly;
+  PNG files are read with libpng, if the program was built with it.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "surface.h"
+
+BEGIN_DECLS
+
+/** Load an image file into a new surface, which the caller must 
+    eventually free with surface_destroy(). The format of the file is
+    worked out from its contents, not its name. Images without alpha
+    are loaded as BGR888 surfaces, and images with alpha as BGRA8888,
+    so a Blitter can put either onto another surface. Returns NULL on
+    failure, and writes *error with a message that the caller should 
+    eventually free. */
+Surface         *image_load (const char *filename, char **error);
+
+/** Write the contents of a surface, in any format, to an open file
+    descriptor as a binary PPM image. The surface is read in bands of
+    whole rows, which are converted to RGB in a buffer that is reused
+    for each band, and written with one write() call per band. This
+    makes it practical to take a screenshot of a large framebuffer, 
+    whose memory is slow to read a pixel at a time. Returns FALSE on
+    failure, and writes *error with a message that the caller should
+    eventually free. */
+BOOL             image_save_ppm (const Surface *surface, int fd, 
+                   char **error);
+
+END_DECLS
+
@@ -0,0 +1,505 @@
+/*============================================================================
+
+  layout.c
+
+  Implementation of the functions defined in layout.h.
+
+  Layout is a single pass over the text. The text is split into the
+  pieces between the places where the Unicode line breaking rules allow
+  a line to be broken -- usually, but not only, the spaces. Each piece
+  is measured, using
+  the advances and kerning of its glyphs from the metrics table, 
+  and placed on the current
+  line if it fits, or at the start of a new line if it doesn't. The
+  pen position of every character is recorded as we go, so drawing
+  the layout needs no further measurement. Pieces that end up next to
+  each other on a line, with no space between them, are joined into a
+  single word, so that they are drawn, and justified, as one.
+
+  The width of each line is recorded too, so aligning the lines is a
+  second pass over the words, not the text: each line's words are 
+  moved right by the space left over on the line, or half of it, or --
+  to justify -- the space is shared out between the gaps between the
+  words. Nothing is measured again. Placing the lines at the middle or
+  bottom of the box just moves them all down.
+
+  A word that doesn't fit on a line can be hyphenated, if there is a
+  hyphenator. The places where it can be broken are found only when it
+  doesn't fit, and only once, however many lines it is split across.
+  The first part of the word, with a hyphen after it, is copied to the
+  end of the layout's text, so that every word in the layout is still
+  a run of characters; the characters it was copied from are not drawn.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <string.h>
+#include "defs.h"
+#include "log.h"
+#include "layout.h"
+#include "linebreak.h"
+#include "grapheme.h"
+
+// The places where the word being laid out can be hyphenated
+typedef struct _LayoutBreaks
+  {
+  int end; // Index after the last character of the word in the text,
+           //   or -1 if no word has been hyphenated yet
+  int first; // Index of the first character of the word
+  BOOL breaks [HYPHENATOR_MAX_WORD];
+  } LayoutBreaks;
+
+
+/*==========================================================================
+  layout_is_space
+*==========================================================================*/
+static inline BOOL layout_is_space (UTF32 c)
+  {
+  return c == ' ' || c == '\t' || linebreak_is_newline (c);
+  }
+
+
+/*==========================================================================
+  layout_measure_word
+
+  Work out the pen position of each character in a word, relative to
+  the start of the word, and return the advance of the whole word.
+
+  A mark that is part of a grapheme cluster -- a combining accent, for
+  example -- doesn't move the pen, and is centred over the character 
+  at the start of the cluster, just as every glyph is centred in its
+  own advance. Most fonts give marks no advance, but a monospaced font
+  may give them a whole cell; either way, they end up over the 
+  character. wordcache_compose() places the glyphs in the same way.
+
+*==========================================================================*/
+static int layout_measure_word (const FontMetrics *metrics, const UTF32 *s,
+      int len, int style, int *glyph_x)
+  {
+  int pen = 0;
+  int base = 0; // Pen position of the start of the current cluster
+  int base_advance = 0;
+  UTF32 prev = 0; // The last character that was not a mark
+  GraphemeState state;
+  grapheme_init (&state);
+  for (int i = 0; i < len; i++)
+    {
+    int advance = fontmetrics_get_advance (metrics, s[i], style);
+    if (!grapheme_is_boundary (&state, s[i]) && grapheme_is_mark (s[i]))
+      {
+      int x = base + (base_advance - advance) / 2;
+      glyph_x[i] = x > 0 ? x : 0;
+      continue;
+      }
+    if (i > 0) pen += fontmetrics_get_kerning (metrics, prev, s[i]);
+    glyph_x[i] = pen;
+    base = pen;
+    base_advance = advance;
+    pen += advance;
+    prev = s[i];
+    }
+  return pen;
+  }
+
+
+/*==========================================================================
+  layout_find_break
+
+  Find where to hyphenate the part of a word from first to end, whose
+  characters have the pen positions in glyph_x, so that the first part
+  and a hyphen fit in room pixels. Returns the number of characters in
+  the first part, or zero if the word can't be broken to fit.
+
+*==========================================================================*/
+static int layout_find_break (const FontMetrics *metrics,
+      const Hyphenator *hyphenator, LayoutBreaks *b, const UTF32 *text,
+      int first, int end, const int *glyph_x, int room, int style)
+  {
+  // If the word has been split already, this is the rest of it, and
+  //  the places it can be broken are already known
+  if (b->end != end)
+    {
+    b->end = end;
+    b->first = first;
+    if (end - first > HYPHENATOR_MAX_WORD
+        || hyphenator_hyphenate (hyphenator, text + first, end - first,
+             b->breaks) == 0)
+      b->first = end;
+    }
+
+  int hyphen = fontmetrics_get_advance (metrics, LAYOUT_HYPHEN, style);
+  for (int i = end - 1; i > first && i > b->first; i--)
+    {
+    if (!b->breaks[i - b->first]) continue;
+    UTF32 last = text[i - 1];
+    int w = glyph_x[i - 1 - first] 
+      + fontmetrics_get_advance (metrics, last, style) 
+      + fontmetrics_get_kerning (metrics, last, LAYOUT_HYPHEN) + hyphen;
+    if (w <= room) return i - first;
+    }
+  return 0;
+  }
+
+
+/*==========================================================================
+  layout_move_word
+
+  Move a word, and the characters in it, right by dx pixels
+
+*==========================================================================*/
+static void layout_move_word (Layout *self, LayoutWord *word, int dx)
+  {
+  word->x += dx;
+  for (int i = 0; i < word->len; i++)
+    {
+    int *gx = &self->glyph_x[word->first + i];
+    if (*gx >= 0) *gx += dx;
+    }
+  }
+
+
+/*==========================================================================
+  layout_align_line
+
+  Move the words of a line to align it. last is TRUE for the last line
+  of the text, or of a paragraph, which is not justified.
+
+*==========================================================================*/
+static void layout_align_line (Layout *self, LayoutLine *line, BOOL last)
+  {
+  int spare = self->width - line->width;
+  if (spare <= 0 || line->n_words == 0) return;
+  LayoutWord *words = self->words + line->first_word;
+  int gaps = line->n_words - 1;
+  int align = self->align & LAYOUT_ALIGN_HORIZONTAL;
+  switch (align)
+    {
+    case LAYOUT_ALIGN_RIGHT:
+    case LAYOUT_ALIGN_CENTRE:
+      if (align == LAYOUT_ALIGN_CENTRE) spare /= 2;
+      for (int i = 0; i < line->n_words; i++)
+        layout_move_word (self, &words[i], spare);
+      line->width += spare;
+      break;
+    case LAYOUT_ALIGN_JUSTIFY:
+      if (last || gaps == 0) break;
+      // Each word moves by its share of the spare space, rounded so
+      //  that the shares add up to exactly the space there is
+      for (int i = 1; i < line->n_words; i++)
+        layout_move_word (self, &words[i], spare * i / gaps);
+      line->width = self->width;
+      break;
+    }
+  }
+
+
+/*==========================================================================
+  layout_create
+*==========================================================================*/
+Layout *layout_create (const FontMetrics *metrics, const UTF32 *text, int len,
+      int width, int height, int style, int align,
+      const Hyphenator *hyphenator)
+  {
+  LOG_IN
+  Layout *self = malloc (sizeof (Layout));
+  memset (self, 0, sizeof (Layout));
+  self->refcount = 1;
+  self->width = width;
+  self->height = height;
+  self->style = style;
+  self->align = align;
+  self->hyphenator = hyphenator;
+  self->complete = TRUE;
+  self->len = len;
+
+  // Each part of a hyphenated word that is copied takes at least one
+  //  character from the text, and adds at most one more, so the copies
+  //  need at most twice the space of the text. 
+  int size = hyphenator ? 3 * len + 1 : len + 1;
+  self->text = malloc (size * sizeof (UTF32));
+  memcpy (self->text, text, len * sizeof (UTF32));
+  self->glyph_x = malloc (size * sizeof (int));
+  for (int i = 0; i < len; i++) self->glyph_x[i] = -1;
+  int copy = len; // Where the next copied part of a word goes
+
+  // There can't be more words than characters, nor more lines than
+  //  words -- except that each hyphen adds a word.
+  int max_words = len + 1;
+  if (hyphenator) max_words += len;
+  LayoutBreaks breaks;
+  breaks.end = -1;
+  self->words = malloc (max_words * sizeof (LayoutWord));
+  self->lines = malloc (max_words * sizeof (LayoutLine));
+
+  self->line_spacing = fontmetrics_get_line_spacing (metrics);
+  self->cell_height = fontmetrics_get_cell_height (metrics);
+  int space_x = fontmetrics_get_advance (metrics, ' ', style);
+
+  // The places where lines can be broken -- the text is split into
+  //  pieces that end at these places, or at spaces
+  BYTE *can_break = malloc (len + 1);
+  linebreak_find (text, len, can_break);
+
+  // The line breaking rules keep most grapheme clusters together, but
+  //  not all -- and a cluster must never be split
+  GraphemeState state;
+  grapheme_init (&state);
+  for (int i = 0; i < len; i++)
+    if (!grapheme_is_boundary (&state, text[i])) 
+      can_break[i] = LINEBREAK_NONE;
+
+  int x = 0; // The end of the last word on the line
+  int y = 0;
+  LayoutLine *line = NULL;
+  BOOL space = FALSE; // TRUE if there are spaces before the next piece
+  BOOL ended = FALSE; // TRUE if the last line was ended by a hyphen
+  int i = 0;
+  while (i < len)
+    {
+    // A newline moves down a line -- or two, if there is nothing on
+    //  the line, for a blank line -- unless a hyphen has just done so
+    if (can_break[i] == LINEBREAK_MANDATORY)
+      {
+      if (line) line->newline = TRUE;
+      if (!ended) y += self->line_spacing;
+      x = 0;
+      line = NULL;
+      ended = FALSE;
+      }
+    if (layout_is_space (text[i])) 
+      { 
+      space = TRUE;
+      i++; 
+      continue; 
+      }
+    int first = i;
+    i++;
+    while (i < len && !layout_is_space (text[i]) 
+        && can_break[i] == LINEBREAK_NONE) 
+      i++;
+    int wlen = i - first;
+
+    int *gx = self->glyph_x + first;
+    int advance = layout_measure_word (metrics, text + first, wlen,
+      style, gx);
+
+    // A piece that follows the last one without a space -- after a
+    //  hyphen, or between two Chinese characters, for example -- is
+    //  part of the same word, if it is on the same line
+    BOOL joined = line && line->n_words > 0 && !space;
+    space = FALSE;
+    int start = 0;
+    if (joined)
+      start = x + fontmetrics_get_kerning (metrics, text[first - 1],
+        text[first]);
+    else if (line && line->n_words > 0)
+      start = x + space_x;
+
+    // If the text won't fit, hyphenate it, if as much as a syllable
+    //  will fit on this line. Otherwise, move down to the next line --
+    //  unless this line is empty, in which case the word will never
+    //  fit, and we may as well draw what we can of it (or of its first
+    //  part, if it can be hyphenated).
+    int split = 0;
+    if (start + advance > width)
+      {
+      if (hyphenator)
+        split = layout_find_break (metrics, hyphenator, &breaks, text,
+          first, i, gx, width - start, style);
+      if (!split && line && line->n_words > 0)
+        {
+        start = 0;
+        joined = FALSE;
+        y += self->line_spacing;
+        line = NULL;
+        if (hyphenator && advance > width)
+          split = layout_find_break (metrics, hyphenator, &breaks, text,
+            first, i, gx, width, style);
+        }
+      }
+
+    // If we're already below the specified height, we're done. Note
+    //  that the positions of this word's characters have already been
+    //  written, so they must be reset.
+    if (y + self->line_spacing > height)
+      {
+      for (int j = 0; j < wlen; j++) gx[j] = -1;
+      self->complete = FALSE;
+      break;
+      }
+
+    // The first part of a hyphenated word is placed as a word of its
+    //  own, and the rest of the word is laid out next
+    if (split)
+      {
+      for (int j = 0; j < wlen; j++) gx[j] = -1;
+      memcpy (self->text + copy, text + first, split * sizeof (UTF32));
+      self->text[copy + split] = LAYOUT_HYPHEN;
+      i = first + split;
+      first = copy;
+      wlen = split + 1;
+      copy += wlen;
+      gx = self->glyph_x + first;
+      advance = layout_measure_word (metrics, self->text + first, wlen,
+        style, gx);
+      joined = FALSE;
+      }
+
+    if (!line)
+      {
+      line = &self->lines[self->n_lines];
+      line->first_word = self->n_words;
+      line->n_words = 0;
+      line->y = y;
+      line->width = 0;
+      line->newline = FALSE;
+      self->n_lines++;
+      }
+
+    if (joined)
+      self->words[self->n_words - 1].len += wlen;
+    else
+      {
+      LayoutWord *word = &self->words[self->n_words];
+      word->first = first;
+      word->len = wlen;
+      word->x = start;
+      word->line = self->n_lines - 1;
+      self->n_words++;
+      line->n_words++;
+      }
+
+    for (int j = 0; j < wlen; j++) gx[j] += start;
+    x = start + advance;
+    line->width = x;
+    ended = FALSE;
+
+    if (split)
+      {
+      x = 0;
+      y += self->line_spacing;
+      line = NULL;
+      ended = TRUE;
+      }
+    }
+  free (can_break);
+
+  if ((align & LAYOUT_ALIGN_HORIZONTAL) != LAYOUT_ALIGN_LEFT)
+    {
+    // If the text didn't all fit, the last line shown is not the last
+    //  line of the text
+    for (int l = 0; l < self->n_lines; l++)
+      layout_align_line (self, &self->lines[l], self->lines[l].newline
+        || (self->complete && l == self->n_lines - 1));
+    }
+
+  int spare = height;
+  if (self->n_lines > 0)
+    spare -= self->lines[self->n_lines - 1].y + self->line_spacing;
+  int valign = align & LAYOUT_ALIGN_VERTICAL;
+  if (spare > 0 && valign != LAYOUT_ALIGN_TOP)
+    {
+    if (valign == LAYOUT_ALIGN_MIDDLE) spare /= 2;
+    for (int l = 0; l < self->n_lines; l++)
+      self->lines[l].y += spare;
+    }
+
+  log_debug ("Laid out %d characters as %d words on %d lines", len,
+    self->n_words, self->n_lines);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  layout_ref
+*==========================================================================*/
+Layout *layout_ref (Layout *self)
+  {
+  self->refcount++;
+  return self;
+  }
+
+
+/*==========================================================================
+  layout_unref
+*==========================================================================*/
+void layout_unref (Layout *self)
+  {
+  if (self && --self->refcount == 0)
+    {
+    free (self->text);
+    free (self->glyph_x);
+    free (self->words);
+    free (self->lines);
+    free (self);
+    }
+  }
+
+
+/*==========================================================================
+  layout_parse_align
+*==========================================================================*/
+int layout_parse_align (const char *name)
+  {
+  if (strcmp (name, "left") == 0) return LAYOUT_ALIGN_LEFT;
+  if (strcmp (name, "right") == 0) return LAYOUT_ALIGN_RIGHT;
+  if (strcmp (name, "centre") == 0 || strcmp (name, "center") == 0)
+    return LAYOUT_ALIGN_CENTRE;
+  if (strcmp (name, "justify") == 0) return LAYOUT_ALIGN_JUSTIFY;
+  return -1;
+  }
+
+
+/*==========================================================================
+  layout_parse_valign
+*==========================================================================*/
+int layout_parse_valign (const char *name)
+  {
+  if (strcmp (name, "top") == 0) return LAYOUT_ALIGN_TOP;
+  if (strcmp (name, "middle") == 0) return LAYOUT_ALIGN_MIDDLE;
+  if (strcmp (name, "bottom") == 0) return LAYOUT_ALIGN_BOTTOM;
+  return -1;
+  }
+
+
+/*==========================================================================
+  layout_fits
+*==========================================================================*/
+BOOL layout_fits (const Layout *self)
+  {
+  if (!self->complete) return FALSE;
+  for (int l = 0; l < self->n_lines; l++)
+    if (self->lines[l].width > self->width) return FALSE;
+  return TRUE;
+  }
+
+
+/*==========================================================================
+  layout_line_equal
+*==========================================================================*/
+BOOL layout_line_equal (const Layout *a, int la, const Layout *b, int lb)
+  {
+  const LayoutLine *line_a = &a->lines[la];
+  const LayoutLine *line_b = &b->lines[lb];
+  if (a->style != b->style || line_a->y != line_b->y
+      || line_a->n_words != line_b->n_words)
+    return FALSE;
+  for (int i = 0; i < line_a->n_words; i++)
+    {
+    const LayoutWord *wa = &a->words[line_a->first_word + i];
+    const LayoutWord *wb = &b->words[line_b->first_word + i];
+    if (wa->x != wb->x || wa->len != wb->len) return FALSE;
+    if (memcmp (a->text + wa->first, b->text + wb->first,
+         wa->len * sizeof (UTF32)) != 0)
+      return FALSE;
+    }
+  return TRUE;
+  }
+
@@ -0,0 +1,143 @@
+/*============================================================================
+
+  layout.h
+
+  Functions for breaking text into lines that fit a bounding box, and
+  working out where every character should be drawn, with the lines
+  aligned to the left or right of the box, centred in it, or justified
+  to fill it, and placed at the top, middle, or bottom of the box.
+
+  A Layout is the result of laying out a specific text, in a specific
+  box, in a specific style. It doesn't draw anything, so it can be
+  kept and drawn as often as necessary. Layouts are reference-counted,
+  because the same layout can be held by a cache and by a caller at
+  the same time.
+
+  The usual sequence of operations is
+  layout_create
+  (draw the words in layout->words)
+  layout_unref
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "fontmetrics.h"
+#include "hyphenator.h"
+
+// How lines are aligned across the box
+#define LAYOUT_ALIGN_LEFT    0
+#define LAYOUT_ALIGN_RIGHT   1
+#define LAYOUT_ALIGN_CENTRE  2
+#define LAYOUT_ALIGN_JUSTIFY 3 // Stretch the spaces to fill the width,
+                               //   except on the last line
+#define LAYOUT_ALIGN_HORIZONTAL 0x0f // Mask for the values above
+
+// Where the lines are placed in the box -- ORed with one of the above
+#define LAYOUT_ALIGN_TOP     0x00
+#define LAYOUT_ALIGN_MIDDLE  0x10
+#define LAYOUT_ALIGN_BOTTOM  0x20
+#define LAYOUT_ALIGN_VERTICAL 0xf0 // Mask for the values above
+
+// The character drawn at the end of the first part of a hyphenated word
+#define LAYOUT_HYPHEN '-'
+
+/** A word in a layout -- that is, a run of characters that is drawn
+    without a line break. */
+typedef struct _LayoutWord
+  {
+  int first; // Index of the first character in the layout's text
+  int len; // Number of characters
+  int x; // Pen position of the first character, relative to the box
+  int line; // The line the word is on
+  } LayoutWord;
+
+/** A line in a layout. */
+typedef struct _LayoutLine
+  {
+  int first_word; // Index of the first word on the line
+  int n_words; // Number of words on the line
+  int y; // Top of the line, relative to the box
+  int width; // Distance from the box edge to the end of the last word
+  BOOL newline; // TRUE if the line is ended by a newline in the text
+  } LayoutLine;
+
+typedef struct _Layout
+  {
+  int refcount;
+  UTF32 *text; // A copy of the text laid out -- not null-terminated.
+               //   The first parts of hyphenated words, with their
+               //   hyphens, are copied after the end of the text.
+  int len; // Number of characters in the text, not including copies
+  int *glyph_x; // Pen position of each character, relative to the box,
+                //   or -1 if the character is not drawn
+  LayoutWord *words;
+  int n_words;
+  LayoutLine *lines;
+  int n_lines;
+  int line_spacing; // Distance between the tops of adjacent lines
+  int cell_height; // Height of the area a line's glyphs can occupy
+  int width; // Width of the box the text was laid out in
+  int height; // Height of the box the text was laid out in
+  int style; // GLYPH_STYLE_XXX flags
+  int align; // LAYOUT_ALIGN_XXX flags
+  const Hyphenator *hyphenator; // NULL if words are not hyphenated
+  BOOL complete; // TRUE if all the text is in the layout
+  } Layout;
+
+BEGIN_DECLS
+
+/** Lay out len characters of text in a box of the specified size,
+    using glyph metrics from the metrics table, which must already have
+    been prepared for the text. Layout doesn't change the metrics, or
+    use FreeType, so several threads can lay out text at the same time,
+    with the same metrics. Lines are broken where the Unicode line
+    breaking rules allow -- at spaces, after hyphens, and between
+    Chinese characters, for example -- and must be broken at newlines;
+    a word that doesn't fit at the end of a line is hyphenated,
+    if hyphenator is not NULL and it can be, and otherwise moved to the
+    next line. The metrics must include the hyphen, if there is a
+    hyphenator. A word that is too wide for the box, and can't be
+    hyphenated, is placed on a line
+    by itself. Lines that would extend below the bottom of the box
+    are not included in the layout at all. The lines are then aligned
+    as align, a horizontal LAYOUT_ALIGN_XXX value ORed with a vertical
+    one, says. This method
+    always succeeds, and the result should eventually be passed to
+    layout_unref(). */
+Layout          *layout_create (const FontMetrics *metrics, const UTF32 *text,
+                    int len, int width, int height, int style, int align,
+                    const Hyphenator *hyphenator);
+
+/** Add a reference to a layout. Each call must be matched by a call
+    to layout_unref(). */
+Layout          *layout_ref (Layout *self);
+
+/** Remove a reference to a layout, freeing it when the last reference
+    is removed. */
+void             layout_unref (Layout *self);
+
+/** Parse the name of an alignment -- "left", "right", "centre" (or
+    "center"), or "justify" -- returning the LAYOUT_ALIGN_XXX value, or
+    -1 if the name is not recognized. */
+int              layout_parse_align (const char *name);
+
+/** Parse the name of a vertical alignment -- "top", "middle", or
+    "bottom" -- returning the LAYOUT_ALIGN_XXX value, or -1 if the name
+    is not recognized. */
+int              layout_parse_valign (const char *name);
+
+/** Returns TRUE if all the text is in the layout, and no line is
+    wider than the box -- which can only happen if a word is. */
+BOOL             layout_fits (const Layout *self);
+
+/** Returns TRUE if line la of layout a would be drawn exactly the same
+    as line lb of layout b -- same characters, in the same places. */
+BOOL             layout_line_equal (const Layout *a, int la,
+                    const Layout *b, int lb);
+
+END_DECLS
+
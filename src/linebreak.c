@@ -0,0 +1,193 @@
+/*============================================================================
+
+  linebreak.c
+
+  Implementation of the functions defined in linebreak.h.
+
+  The rules of UAX #14 are tried in order for each position in the
+  text, and the first that applies decides. Most only look at the
+  characters either side of the position; the rest need a little 
+  state -- the character before any spaces, for the rules about 
+  brackets and quotes, and the number of regional indicators in a row,
+  so that flags are not split. Combining marks take the class of the
+  character they follow (LB9), so they never begin a line.
+
+  The rule numbers are those of the standard.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include "defs.h"
+#include "log.h"
+#include "linebreak.h"
+#include "linebreak_table.h"
+
+
+/*==========================================================================
+  linebreak_is_alphabetic
+*==========================================================================*/
+static inline BOOL linebreak_is_alphabetic (int c)
+  {
+  return c == LB_AL || c == LB_HL;
+  }
+
+
+/*==========================================================================
+  linebreak_is_hangul
+*==========================================================================*/
+static inline BOOL linebreak_is_hangul (int c)
+  {
+  return c == LB_JL || c == LB_JV || c == LB_JT || c == LB_H2 
+    || c == LB_H3;
+  }
+
+
+/*==========================================================================
+  linebreak_pair
+
+  Apply the rules from LB11 on, which depend on the classes of the
+  characters before and after the position, a and b, and on the class 
+  of the character before any spaces before the position, sp, and the 
+  class of the character before a, aa. ri is the number of regional
+  indicators in a row that end with a.
+
+*==========================================================================*/
+static BYTE linebreak_pair (int aa, int a, int sp, int b, int ri)
+  {
+  // LB11, LB12, LB12a
+  if (a == LB_WJ || b == LB_WJ || a == LB_GL) return LINEBREAK_NONE;
+  if (b == LB_GL && a != LB_SP && a != LB_BA && a != LB_HY) 
+    return LINEBREAK_NONE;
+  // LB13
+  if (b == LB_CL || b == LB_CP || b == LB_EX || b == LB_IS || b == LB_SY)
+    return LINEBREAK_NONE;
+  // LB14 to LB17 -- these apply with or without spaces between
+  if (sp == LB_OP) return LINEBREAK_NONE;
+  if (sp == LB_QU && b == LB_OP) return LINEBREAK_NONE;
+  if ((sp == LB_CL || sp == LB_CP) && b == LB_NS) return LINEBREAK_NONE;
+  if (sp == LB_B2 && b == LB_B2) return LINEBREAK_NONE;
+  // LB18
+  if (a == LB_SP) return LINEBREAK_ALLOWED;
+  // LB19, LB20
+  if (a == LB_QU || b == LB_QU) return LINEBREAK_NONE;
+  if (a == LB_CB || b == LB_CB) return LINEBREAK_ALLOWED;
+  // LB21, LB21a, LB21b, LB22
+  if (b == LB_BA || b == LB_HY || b == LB_NS || a == LB_BB) 
+    return LINEBREAK_NONE;
+  if (aa == LB_HL && (a == LB_HY || a == LB_BA)) return LINEBREAK_NONE;
+  if (a == LB_SY && b == LB_HL) return LINEBREAK_NONE;
+  if (b == LB_IN) return LINEBREAK_NONE;
+  // LB23, LB23a, LB24
+  if ((linebreak_is_alphabetic (a) && b == LB_NU)
+      || (a == LB_NU && linebreak_is_alphabetic (b)))
+    return LINEBREAK_NONE;
+  if ((a == LB_PR && (b == LB_ID || b == LB_EB || b == LB_EM))
+      || ((a == LB_ID || a == LB_EB || a == LB_EM) && b == LB_PO))
+    return LINEBREAK_NONE;
+  if (((a == LB_PR || a == LB_PO) && linebreak_is_alphabetic (b))
+      || (linebreak_is_alphabetic (a) && (b == LB_PR || b == LB_PO)))
+    return LINEBREAK_NONE;
+  // LB25, as pairs
+  if (((a == LB_CL || a == LB_CP || a == LB_NU) 
+        && (b == LB_PO || b == LB_PR))
+      || ((a == LB_PO || a == LB_PR) && (b == LB_OP || b == LB_NU))
+      || ((a == LB_HY || a == LB_IS || a == LB_NU || a == LB_SY) 
+        && b == LB_NU))
+    return LINEBREAK_NONE;
+  // LB26, LB27
+  if ((a == LB_JL && (b == LB_JL || b == LB_JV || b == LB_H2 
+         || b == LB_H3))
+      || ((a == LB_JV || a == LB_H2) && (b == LB_JV || b == LB_JT))
+      || ((a == LB_JT || a == LB_H3) && b == LB_JT))
+    return LINEBREAK_NONE;
+  if ((linebreak_is_hangul (a) && b == LB_PO) 
+      || (a == LB_PR && linebreak_is_hangul (b)))
+    return LINEBREAK_NONE;
+  // LB28, LB29, LB30
+  if (linebreak_is_alphabetic (a) && linebreak_is_alphabetic (b))
+    return LINEBREAK_NONE;
+  if (a == LB_IS && linebreak_is_alphabetic (b)) return LINEBREAK_NONE;
+  if (((linebreak_is_alphabetic (a) || a == LB_NU) && b == LB_OP)
+      || (a == LB_CP && (linebreak_is_alphabetic (b) || b == LB_NU)))
+    return LINEBREAK_NONE;
+  // LB30a, LB30b
+  if (a == LB_RI && b == LB_RI && ri % 2 == 1) return LINEBREAK_NONE;
+  if (a == LB_EB && b == LB_EM) return LINEBREAK_NONE;
+  // LB31
+  return LINEBREAK_ALLOWED;
+  }
+
+
+/*==========================================================================
+  linebreak_find
+*==========================================================================*/
+void linebreak_find (const UTF32 *text, int len, BYTE *breaks)
+  {
+  if (len == 0) return;
+
+  // LB2 -- never break at the start of the text. LB10 -- a combining
+  //  mark with nothing to combine with is alphabetic
+  breaks[0] = LINEBREAK_NONE;
+  int a = linebreak_class (text[0]);
+  BOOL zwj = a == LB_ZWJ;
+  if (a == LB_CM || a == LB_ZWJ) a = LB_AL;
+  int aa = LB_AL;
+  int sp = a;
+  int ri = a == LB_RI;
+
+  for (int i = 1; i < len; i++)
+    {
+    int b = linebreak_class (text[i]);
+    BYTE brk;
+
+    // LB4, LB5, LB6 -- newlines
+    if (a == LB_BK || a == LB_LF || a == LB_NL 
+        || (a == LB_CR && b != LB_LF))
+      brk = LINEBREAK_MANDATORY;
+    else if (b == LB_BK || b == LB_CR || b == LB_LF || b == LB_NL)
+      brk = LINEBREAK_NONE;
+    // LB7, LB8, LB8a
+    else if (b == LB_SP || b == LB_ZW)
+      brk = LINEBREAK_NONE;
+    else if (sp == LB_ZW)
+      brk = LINEBREAK_ALLOWED;
+    else if (zwj)
+      brk = LINEBREAK_NONE;
+    // LB9 -- a combining mark is treated as the character before it,
+    //  so it changes nothing
+    else if ((b == LB_CM || b == LB_ZWJ) && a != LB_SP)
+      {
+      breaks[i] = LINEBREAK_NONE;
+      zwj = b == LB_ZWJ;
+      continue;
+      }
+    else
+      {
+      if (b == LB_CM || b == LB_ZWJ) b = LB_AL; // LB10
+      brk = linebreak_pair (aa, a, sp, b, ri);
+      }
+
+    breaks[i] = brk;
+    zwj = b == LB_ZWJ;
+    if (b == LB_CM || b == LB_ZWJ) b = LB_AL; // LB10
+    ri = b == LB_RI ? ri + 1 : 0;
+    aa = a;
+    a = b;
+    if (b != LB_SP) sp = b;
+    }
+  }
+
+
+/*==========================================================================
+  linebreak_is_newline
+*==========================================================================*/
+BOOL linebreak_is_newline (UTF32 c)
+  {
+  int lb = linebreak_class (c);
+  return lb == LB_BK || lb == LB_CR || lb == LB_LF || lb == LB_NL;
+  }
+
@@ -0,0 +1,48 @@
+/*============================================================================
+
+  linebreak.h
+
+  Functions for finding where a line of text may be broken, following
+  the Unicode line breaking algorithm (UAX #14). As well as at spaces,
+  lines may be broken after hyphens, after the slashes in a URL, and
+  between most Chinese and Japanese characters, for example, and must
+  be broken at newlines -- but not before a closing bracket or a full
+  stop, nor after an opening bracket.
+
+  The class of each character is found with two loads from a table
+  that is generated, when fbtextdemo is built, from the Unicode
+  Character Database; tools/unicode_tables.pl explains how. The rules
+  are then applied in a single pass over the text, which allocates
+  nothing. The pair rules for numbers (LB25) are used in their simpler
+  form, and the special case for East Asian brackets (LB30) is not
+  made, as the standard allows.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+// What may happen before each character
+#define LINEBREAK_NONE      0 // The line must not be broken
+#define LINEBREAK_ALLOWED   1 // The line may be broken
+#define LINEBREAK_MANDATORY 2 // The line must be broken, after a newline
+
+BEGIN_DECLS
+
+/** Find where len characters of text may be broken into lines.
+    breaks[i] is set to one of the LINEBREAK_XXX values, for what may
+    happen before character i, for each i from 0 to len - 1. breaks[0]
+    is always LINEBREAK_NONE. A line never breaks before a space; a 
+    break after spaces is before the first character that follows 
+    them. */
+void             linebreak_find (const UTF32 *text, int len, BYTE *breaks);
+
+/** Returns TRUE if the character ends a line -- a newline, or another
+    character that the breaking rules treat in the same way. */
+BOOL             linebreak_is_newline (UTF32 c);
+
+END_DECLS
+
@@ -10,24 +10,62 @@
   It allows text strings to be placed at specific locations, with
   specified size, using a specific TTF font file.
 
-  Note: this program only ASCII or ISO-88591-1 input at present.
-  It only really works with a black screen background -- there is no 
-  logic for merging the anti-aliasing greyscale data with the background.
+  Input text is UTF-8, from the command line or from stdin; bytes
+  that aren't valid UTF-8 are shown as U+FFFD. Text is drawn directly 
+  to the framebuffer, and only really works with a black screen 
+  background, unless a background image is given. 
+  Then the text is blended onto the image in an off-screen surface, 
+  and the parts that change are copied to the framebuffer.
 
   Copyright (c)2020 Kevin Boone, GPL 3.0
 
   =========================================================================*/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <assert.h>
+#include <sched.h>
 #include <freetype2/ft2build.h>
 #include <freetype/freetype.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
 #include "defs.h"
 #include "log.h"
 #include "framebuffer.h"
+#include "glyphcache.h"
+#include "wordcache.h"
+#include "layout.h"
+#include "runcache.h"
+#include "fontmetrics.h"
+#include "scheduler.h"
+#include "ringqueue.h"
+#include "blitter.h"
+#include "image.h"
+#include "scroller.h"
+#include "console.h"
+#include "terminal.h"
+#include "normalize.h"
+#include "utf8stream.h"
 
 #define FBDEV "/dev/fb0"
 
+// Bytes read from stdin at a time in stdin, log, and batch modes
+#define STDIN_READ_SIZE 4096
+// The largest position or size of a box in batch mode
+#define BATCH_MAX_COORD 32767
+// Bytes read from stdin at a time in console mode
+#define CONSOLE_READ_SIZE 65536
+// While more input is waiting, the console is redrawn no more often
+//  than this
+#define CONSOLE_UPDATE_MSEC 16
+// The console's cursor is shown and hidden this often while it waits
+//  for input
+#define CONSOLE_BLINK_MSEC 500
+
 /*===========================================================================
 
   init_ft 
@@ -120,10 +158,11 @@ int face_get_line_spacing (FT_Face face)
 
 /*===========================================================================
 
-  face_draw_char_on_fb
+  face_draw_word
 
-  Draw a specific character, at a specific location, direct to the 
-  framebuffer. The Y coordinate is the left-hand edge of the character.
+  Draw a word, at a specific location, on a surface -- usually the
+  framebuffer. 
+  The X coordinate is the left-hand edge of the first character.
   The Y coordinate is the top of the bounding box that contains all
   glyphs in the specific face. That is, (X,Y) are the top-left corner
   of where the largest glyph in the face would need to be drawn.
@@ -133,162 +172,26 @@ int face_get_line_spacing (FT_Face face)
   The X coordinate is expressed as a pointer so it can be incremented, 
   ready for the next draw on the same line.
 
-  =========================================================================*/
-void face_draw_char_on_fb (FT_Face face, FrameBuffer *fb, 
-      int c, int *x, int y)
-  {
-  // Note that TT fonts have no built-in padding. 
-  // That is, first,
-  //  the top row of the bitmap is the top row of pixels to 
-  //  draw. These rows usually won't be at the face bounding box. We need to
-  //  work out the overall height of the character cell, and
-  //  offset the drawing vertically by that amount. 
-  //
-  // Similar, there is no left padding. The first pixel in each row will not
-  //  be drawn at the left margin of the bounding box, but in the centre of
-  //  the screen width that will be occupied by the glyph.
-  //
-  //  We need to calculate the x and y offsets of the glyph, but we can't do
-  //  this until we've loaded the glyph, because metrics
-  //  won't be available.
-
-  // Note that, by default, TT metrics are in 64'ths of a pixel, hence
-  //  all the divide-by-64 operations below.
-
-  // Get a FreeType glyph index for the character. If there is no
-  //  glyph in the face for the character, this function returns
-  //  zero. We should really check for this, and substitute a default
-  //  glyph. Naturally, the TTF font chosen must contain glyphs for
-  //  all the characters to be displayed. 
-  FT_UInt gi = FT_Get_Char_Index (face, c);
-
-  // Loading the glyph makes metrics data available
-  FT_Load_Glyph (face, gi, FT_LOAD_DEFAULT);
-
-  // Now we have the metrics, let's work out the x and y offset
-  //  of the glyph from the specified x and y. Because there is
-  //  no padding, we can't just draw the bitmap so that it's
-  //  TL corner is at (x,y) -- we must insert the "missing" 
-  //  padding by aligning the bitmap in the space available.
-
-  // bbox.yMax is the height of a bounding box that will enclose
-  //  any glyph in the face, starting from the glyph baseline.
-  int bbox_ymax = face->bbox.yMax / 64;
-  // horiBearingX is the height of the top of the glyph from
-  //   the baseline. So we work out the y offset -- the distance
-  //   we must push down the glyph from the top of the bounding
-  //   box -- from the height and the Y bearing.
-  int y_off = bbox_ymax - face->glyph->metrics.horiBearingY / 64;
-
-  // glyph_width is the pixel width of this specific glyph
-  int glyph_width = face->glyph->metrics.width / 64;
-  // Advance is the amount of x spacing, in pixels, allocated
-  //   to this glyph
-  int advance = face->glyph->metrics.horiAdvance / 64;
-  // Work out where to draw the left-most row of pixels --
-  //   the x offset -- by halving the space between the 
-  //   glyph width and the advance
-  int x_off = (advance - glyph_width) / 2;
-
-  // So now we have (x_off,y_off), the location at which to
-  //   start drawing the glyph bitmap.
-
-  // Rendering a loaded glyph creates the bitmap
-  FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
-
-  // Write out the glyph row-by-row using framebuffer_set_pixel
-  // Note that the glyph can contain horizontal padding. We need
-  //  to take this into account when working out where the pixels
-  //  are in memory, but we don't actually need to "draw" these
-  //  empty pixels. bitmap.width is the number of pixels that actually
-  //  contain values; bitmap.pitch is the spacing between bitmap
-  //  rows in memory.
-  for (int i = 0; i < (int)face->glyph->bitmap.rows; i++)
-    {
-    // Row offset is the distance from the top of the framebuffer
-    //  of this particular row of pixels in the glyph.
-    int row_offset = y + i + y_off;
-    for (int j = 0; j < (int)face->glyph->bitmap.width; j++)
-      {
-      unsigned char p =
-        face->glyph->bitmap.buffer [i * face->glyph->bitmap.pitch + j];
-      
-      // Working out the Y position is a little fiddly. horiBearingY 
-      //  is how far the glyph extends about the baseline. We push
-      //  the bitmap down by the height of the bounding box, and then
-      //  back up by this "bearing" value. 
-      if (p)
-        framebuffer_set_pixel (fb, *x + j + x_off, row_offset, p, p, p);
-      }
-    }
-  // horiAdvance is the nominal X spacing between displayed glyphs. 
-  *x += advance;
-  }
-
-/*===========================================================================
-
-  face_draw_string_on_fb
-
-  draw a string of UTF32 characters (null-terminated), advancing each
-  character by enough to create reasonable horizontal spacing. The
-  X coordinate is expressed as a pointer so it can be incremented, 
-  ready for the next draw on the same line.
-
-  =========================================================================*/
-void face_draw_string_on_fb (FT_Face face, FrameBuffer *fb, const UTF32 *s, 
-       int *x, int y)
-  {
-  while (*s)
-    {
-    face_draw_char_on_fb (face, fb, *s, x, y);
-    s++;
-    }
-  }
-
-/*===========================================================================
-
-  face_get_char_extent
-
-  =========================================================================*/
-void face_get_char_extent (const FT_Face face, int c, int *x, int *y)
-  {
-  // Note that, by default, TT metrics are in 64'ths of a pixel, hence
-  //  all the divide-by-64 operations below.
-
-  // Get a FreeType glyph index for the character. If there is no
-  //  glyph in the face for the character, this function returns
-  //  zero. We should really check for this, and substitute a default
-  //  glyph. Naturally, the TTF font chosen must contain glyphs for
-  //  all the characters to be displayed. 
-  FT_UInt gi = FT_Get_Char_Index(face, c);
-
-  // Loading the glyph makes metrics data available
-  FT_Load_Glyph (face, gi, FT_LOAD_NO_BITMAP);
-
-  *y = face_get_line_spacing (face);
-  *x = face->glyph->metrics.horiAdvance / 64;
-  }
-
-/*===========================================================================
-
-  face_get_string_extent
-
-  UTF32 characters (null-terminated), 
+  The whole word is composed into a single coverage bitmap by the
+  word cache, from glyphs in the glyph cache, so a word that has been
+  drawn before is just one rectangular copy to the surface. If blend
+  is TRUE, the word is blended onto whatever is on the surface,
+  rather than replacing it.
 
   =========================================================================*/
-void face_get_string_extent (const FT_Face face, const UTF32 *s, 
-      int *x, int *y)
+void face_draw_word (const CachedWord *word, Surface *surface, 
+      BOOL blend, int *x, int y)
   {
-  *x = 0;
-  int y_extent = 0;
-  while (*s)
-    {
-    int x_extent;
-    face_get_char_extent (face, *s, &x_extent, &y_extent);
-    *x += x_extent;
-    s++;
-    }
-  *y = y_extent;
+  if (word->coverage && blend)
+    surface_blend_coverage (surface, *x + word->x_off, y + word->y_off,
+      word->coverage, word->width, word->rows, word->width, 
+      255, 255, 255);
+  else if (word->coverage)
+    surface_draw_coverage (surface, *x + word->x_off, y + word->y_off,
+      word->coverage, word->width, word->rows, word->width);
+  // The advance is the nominal X spacing to the next word, including
+  //  any kerning between the characters of this one. 
+  *x += word->advance;
   }
 
   /*===========================================================================
@@ -297,11 +200,14 @@ void face_get_string_extent (const FT_Face face, const UTF32 *s,
 
   Gets the length of next glyph in a UTF-8 sequence.
 
-  Returns -1 if the next glyph is not UTF-8.
+  Returns -1 if the next glyph is not UTF-8 -- if its first byte is not
+  a lead byte, or it is cut short by a byte that is not a continuation
+  byte, including the null at the end of the string.
 
   =========================================================================*/
 int next_utf8_glyph_length(const UTF8 *word) {
     assert(word != NULL);
+    int length;
 
     // 1-byte glyph (0xxxxxxx).
     if ((*word & 0x80) == 0) {
@@ -309,32 +215,38 @@ int next_utf8_glyph_length(const UTF8 *word) {
     }
     // 2-byte glyph (110xxxxx).
     else if ((*word & 0xE0) == 0xC0) {
-        return 2;
+        length = 2;
     }
     // 3-byte glyph (1110xxxx).
     else if ((*word & 0xF0) == 0xE0) {
-        return 3;
+        length = 3;
     }
     // 4-byte glyph (11110xxx).
     else if ((*word & 0xF8) == 0xF0) {
-        return 4;
+        length = 4;
+    }
+    else {
+        // Invalid UTF-8 glyph.
+        return -1;
     }
 
-    // Invalid UTF-8 glyph.
-    return -1;
+    // Every byte after the first must be a continuation (10xxxxxx).
+    for (int i = 1; i < length; i++) {
+        if ((word[i] & 0xC0) != 0x80) {
+            return -1;
+        }
+    }
+    return length;
 }
 
 /*===========================================================================
 
   utf8_to_utf32 
 
-  Convert an 8-bit character string to a 32-bit character string; both
-  are null-terminated.
-
-  If this weren't just a demo, we'd have a real character set 
-    conversion here. It's not that difficult, but it's not really what
-    this demonstration is for. For now, just pad the 8-bit characters
-    to 32-bit.
+  Convert a UTF-8 string to a 32-bit character string; both are 
+  null-terminated. Each byte that does not start a valid character, 
+  and each overlong form, surrogate, or value above U+10FFFF, becomes
+  U+FFFD.
 
   =========================================================================*/
 UTF32 *utf8_to_utf32(const UTF8 *utf8_word)
@@ -347,7 +259,7 @@ UTF32 *utf8_to_utf32(const UTF8 *utf8_word)
 
     while (*utf8_word_ptr) {
         int curr_glyph_length = next_utf8_glyph_length(utf8_word_ptr);
-        utf8_word_ptr += curr_glyph_length;
+        utf8_word_ptr += curr_glyph_length > 0 ? curr_glyph_length : 1;
         word_length++;
     }
 
@@ -377,6 +289,20 @@ UTF32 *utf8_to_utf32(const UTF8 *utf8_word)
             *utf32_word_ptr |= ((*(utf8_word_ptr + 2) & 0x3F) << 6);
             *utf32_word_ptr |= (*(utf8_word_ptr + 3) & 0x3F);
         }
+        else {
+            *utf32_word_ptr = 0xFFFD;
+            curr_glyph_length = 1;
+        }
+
+        // The shortest form must be used, and surrogates are not
+        //  characters.
+        UTF32 c = *utf32_word_ptr;
+        if ((curr_glyph_length == 2 && c < 0x80)
+            || (curr_glyph_length == 3 && (c < 0x800 
+                || (c >= 0xD800 && c < 0xE000)))
+            || (curr_glyph_length == 4 && (c < 0x10000 || c > 0x10FFFF))) {
+            *utf32_word_ptr = 0xFFFD;
+        }
         utf32_word_ptr++;
 
         // Prepare for processing the next glyph.
@@ -389,6 +315,1338 @@ UTF32 *utf8_to_utf32(const UTF8 *utf8_word)
     return utf32_word;
 }
 
+/*===========================================================================
+
+  DamageRect
+
+  A rectangle of the drawing surface that has changed since it was 
+  last copied to the screen.
+
+  =========================================================================*/
+typedef struct _DamageRect
+  {
+  int x;
+  int y;
+  int width;
+  int height;
+  } DamageRect;
+
+/*===========================================================================
+
+  TextContext
+
+  The caches and other objects needed to draw text. 
+
+  If there is a background image, the text is drawn on an off-screen 
+  surface, which starts as a copy of the background, and the 
+  rectangles that change are copied to the screen by
+  text_flush(). Otherwise, the text is drawn straight to the screen.
+
+  =========================================================================*/
+typedef struct _TextContext
+  {
+  Surface *surface; // Where the text is drawn
+  Surface *screen; // The framebuffer, if it is not the surface
+  Surface *background; // Shows where there is no text, or NULL for black
+  Blitter *flush; // Copies the surface to the screen
+  DamageRect *damage; // Rectangles not yet copied to the screen
+  int n_damage;
+  int damage_size;
+  GlyphCache *glyphs;
+  WordCache *words;
+  FontMetrics *metrics;
+  RunCache *runs;
+  Scheduler *scheduler; // For rendering and drawing on other threads
+  int style;
+  int align; // LAYOUT_ALIGN_XXX
+  const Hyphenator *hyphenator; // NULL if words are not hyphenated
+  } TextContext;
+
+/*===========================================================================
+
+  text_clear_rect
+
+  Remove the text from a rectangle of the drawing surface, by filling 
+  it with black or restoring the background. 
+
+  =========================================================================*/
+static void text_clear_rect (const TextContext *ctx, int x, int y, 
+      int width, int height)
+  {
+  if (ctx->background)
+    surface_blit (ctx->surface, x, y, ctx->background, x, y, width, 
+      height);
+  else
+    surface_fill_rect (ctx->surface, x, y, width, height, 0, 0, 0);
+  }
+
+/*===========================================================================
+
+  text_add_damage
+
+  Note that a rectangle of the drawing surface has changed, and must 
+  be copied to the screen. A rectangle that overlaps one already in
+  the list is merged with it, so no pixel is copied twice. This must
+  only be called on the main thread. 
+
+  =========================================================================*/
+static void text_add_damage (TextContext *ctx, int x, int y, 
+      int width, int height)
+  {
+  if (!ctx->screen || width <= 0 || height <= 0) return;
+  int i = 0;
+  while (i < ctx->n_damage)
+    {
+    DamageRect *r = &ctx->damage[i];
+    if (r->x < x + width && x < r->x + r->width 
+        && r->y < y + height && y < r->y + r->height)
+      {
+      // Take the rectangle out of the list, and start again with the 
+      //  union, which might now overlap others
+      int right = x + width;
+      int bottom = y + height;
+      if (r->x + r->width > right) right = r->x + r->width;
+      if (r->y + r->height > bottom) bottom = r->y + r->height;
+      if (r->x < x) x = r->x;
+      if (r->y < y) y = r->y;
+      width = right - x;
+      height = bottom - y;
+      *r = ctx->damage[--ctx->n_damage];
+      i = 0;
+      }
+    else
+      i++;
+    }
+  if (ctx->n_damage == ctx->damage_size)
+    {
+    ctx->damage_size = ctx->damage_size ? ctx->damage_size * 2 : 16;
+    ctx->damage = realloc (ctx->damage, 
+      ctx->damage_size * sizeof (DamageRect));
+    }
+  DamageRect *r = &ctx->damage[ctx->n_damage++];
+  r->x = x;
+  r->y = y;
+  r->width = width;
+  r->height = height;
+  }
+
+/*===========================================================================
+
+  text_flush
+
+  Copy the rectangles of the drawing surface that have changed to the
+  screen, converting them to the screen's format. 
+
+  =========================================================================*/
+static void text_flush (TextContext *ctx)
+  {
+  for (int i = 0; i < ctx->n_damage; i++)
+    {
+    const DamageRect *r = &ctx->damage[i];
+    blitter_blit (ctx->flush, ctx->screen, r->x, r->y, ctx->surface, 
+      r->x, r->y, r->width, r->height);
+    }
+  if (ctx->n_damage > 0)
+    log_debug ("Flushed %d rectangles to the screen", ctx->n_damage);
+  ctx->n_damage = 0;
+  }
+
+/*===========================================================================
+
+  text_set_background
+
+  Load an image to show behind the text, and switch to drawing 
+  off-screen. The image is decoded once, into a surface the size of 
+  the screen, with its top-left corner at the top-left of the screen; 
+  the parts of the screen it doesn't cover are black. The drawing 
+  surface starts as a copy of the background, and the whole of it is
+  shown. If dither is TRUE, an ordered dither is applied when the 
+  screen has fewer bits per pixel than the drawing surface.
+
+  Returns FALSE, and writes *error with a message that the caller 
+  should eventually free, if the image can't be loaded.
+
+  =========================================================================*/
+BOOL text_set_background (TextContext *ctx, const char *filename, 
+      BOOL dither, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  Surface *image = image_load (filename, error);
+  if (image)
+    {
+    Surface *screen = ctx->surface;
+    log_debug ("Loaded %dx%d background image", image->width, 
+      image->height);
+    // Text is composed in the framebuffer's most common format, which 
+    //  the blitter can convert to any other cheaply.
+    ctx->background = surface_create (screen->width, screen->height, 
+      SURFACE_FORMAT_BGRX8888);
+    Blitter *blitter = blitter_create (image->format, 
+      SURFACE_FORMAT_BGRX8888, 0);
+    blitter_blit (blitter, ctx->background, 0, 0, image, 0, 0, 
+      image->width, image->height);
+    blitter_destroy (blitter);
+    surface_destroy (image);
+
+    ctx->screen = screen;
+    ctx->surface = surface_create (screen->width, screen->height, 
+      SURFACE_FORMAT_BGRX8888);
+    surface_blit (ctx->surface, 0, 0, ctx->background, 0, 0, 
+      screen->width, screen->height);
+    ctx->flush = blitter_create (SURFACE_FORMAT_BGRX8888, screen->format,
+      dither ? BLITTER_DITHER_ORDERED : 0);
+    log_debug ("Flushing to the screen with %s", 
+      blitter_get_name (ctx->flush));
+    text_add_damage (ctx, 0, 0, screen->width, screen->height);
+    text_flush (ctx);
+    ret = TRUE;
+    }
+  LOG_OUT
+  return ret;
+  }
+
+/*===========================================================================
+
+  text_free_background
+
+  Free whatever text_set_background() created. The screen itself 
+  belongs to the framebuffer.
+
+  =========================================================================*/
+void text_free_background (TextContext *ctx)
+  {
+  if (ctx->screen)
+    {
+    surface_destroy (ctx->surface);
+    ctx->surface = ctx->screen;
+    ctx->screen = NULL;
+    }
+  if (ctx->background) surface_destroy (ctx->background);
+  if (ctx->flush) blitter_destroy (ctx->flush);
+  free (ctx->damage);
+  ctx->background = NULL;
+  ctx->flush = NULL;
+  ctx->damage = NULL;
+  ctx->n_damage = ctx->damage_size = 0;
+  }
+
+/*===========================================================================
+
+  PipelineWord
+
+  A word to be drawn by draw_words(), with the glyphs that have to be
+  rendered before it can be drawn. 
+
+  =========================================================================*/
+typedef struct _PipelineWord
+  {
+  const UTF32 *text;
+  int len;
+  int x; // Top-left corner of the word's first character cell
+  int y;
+  int index; // Position of the word in drawing order
+  CachedGlyph **glyphs; // Glyphs this word is the first to need
+  int n_glyphs;
+  struct _Pipeline *pipeline;
+  } PipelineWord;
+
+typedef struct _Pipeline
+  {
+  TextContext *ctx;
+  RingQueue *ready; // Words whose glyphs have been rendered
+  } Pipeline;
+
+/*===========================================================================
+
+  pipeline_render_task
+
+  A scheduler task that renders the glyphs needed by one word, and
+  then passes the word to the thread that is drawing. 
+
+  =========================================================================*/
+static void pipeline_render_task (void *arg)
+  {
+  PipelineWord *word = arg;
+  TextContext *ctx = word->pipeline->ctx;
+  for (int i = 0; i < word->n_glyphs; i++)
+    glyphcache_render_reserved (ctx->glyphs, word->glyphs[i]);
+  // The queue has room for every word, so this can't fail
+  ringqueue_push (word->pipeline->ready, word);
+  }
+
+/*===========================================================================
+
+  draw_words
+
+  Draw words, in order, as a two-stage pipeline. Glyphs that are not
+  yet in the glyph cache are rendered by scheduler tasks, one task per
+  word; each task pushes its word into a queue when the glyphs are
+  ready. Meanwhile this thread pops the words, composes them with
+  the word cache, and writes them to the framebuffer. So FreeType 
+  rasterizing on some CPUs overlaps the memory-bound work of drawing
+  on this one. 
+
+  The words are drawn in the order given, whatever order the tasks
+  finish in, so overlapping glyphs end up the same as if they were 
+  drawn one at a time. A glyph is rendered by the task for the first
+  word that needs it, so by the time any later word is drawn, all its
+  glyphs are ready.
+
+  =========================================================================*/
+void draw_words (TextContext *ctx, PipelineWord *words, int n)
+  {
+  Pipeline pipeline;
+  pipeline.ctx = ctx;
+  pipeline.ready = ringqueue_create (n);
+  BOOL *ready = malloc (n * sizeof (BOOL));
+  CachedGlyph **glyphs = NULL;
+  int n_glyphs = 0;
+  int glyphs_size = 0;
+
+  // Reserve the missing glyphs, noting which word needs each first.
+  //  The glyph lists are indices into one array until it stops
+  //  growing.
+  for (int i = 0; i < n; i++)
+    {
+    PipelineWord *word = &words[i];
+    word->index = i;
+    word->pipeline = &pipeline;
+    word->n_glyphs = 0;
+    for (int c = 0; c < word->len; c++)
+      {
+      CachedGlyph *g = glyphcache_reserve (ctx->glyphs, word->text[c],
+        ctx->style);
+      if (!g) continue;
+      if (n_glyphs == glyphs_size)
+        {
+        glyphs_size = glyphs_size ? glyphs_size * 2 : 64;
+        glyphs = realloc (glyphs, glyphs_size * sizeof (CachedGlyph *));
+        }
+      glyphs[n_glyphs++] = g;
+      word->n_glyphs++;
+      }
+    }
+
+  int first = 0;
+  int submitted = 0;
+  for (int i = 0; i < n; i++)
+    {
+    PipelineWord *word = &words[i];
+    word->glyphs = glyphs + first;
+    first += word->n_glyphs;
+    ready[i] = word->n_glyphs == 0;
+    if (!ready[i])
+      {
+      scheduler_submit (ctx->scheduler, pipeline_render_task, word);
+      submitted++;
+      }
+    }
+
+  int next = 0;
+  while (next < n)
+    {
+    PipelineWord *word = ringqueue_pop (pipeline.ready);
+    if (word)
+      ready[word->index] = TRUE;
+    else if (!ready[next] && !scheduler_help (ctx->scheduler))
+      {
+      // The next word is being rendered by another thread
+      sched_yield ();
+      continue;
+      }
+    while (next < n && ready[next])
+      {
+      const PipelineWord *w = &words[next];
+      const CachedWord *cw = wordcache_get (ctx->words, ctx->glyphs, 
+        w->text, w->len, ctx->style);
+      int x = w->x;
+      face_draw_word (cw, ctx->surface, ctx->background != NULL, 
+        &x, w->y);
+      next++;
+      }
+    }
+
+  // All the words are drawn, but the tasks might not quite have 
+  //  finished with them
+  scheduler_wait (ctx->scheduler);
+  log_debug ("Drew %d words, %d rendered in the pipeline", n, submitted);
+  free (glyphs);
+  free (ready);
+  ringqueue_destroy (pipeline.ready);
+  }
+
+/*===========================================================================
+
+  add_line_words
+
+  Add the words of one line of a layout, whose box has its top-left
+  corner at (x,y), to a list of words to draw. Returns the number of
+  words added.
+
+  =========================================================================*/
+static int add_line_words (const Layout *layout, int l, int x, int y, 
+      PipelineWord *words)
+  {
+  const LayoutLine *line = &layout->lines[l];
+  for (int i = 0; i < line->n_words; i++)
+    {
+    const LayoutWord *lw = &layout->words[line->first_word + i];
+    PipelineWord *word = &words[i];
+    word->text = layout->text + lw->first;
+    word->len = lw->len;
+    word->x = x + lw->x;
+    word->y = y + line->y;
+    }
+  return line->n_words;
+  }
+
+/*===========================================================================
+
+  draw_word_list
+
+  Draw a list of words, with the pipeline if there is a scheduler, or
+  one at a time if not.
+
+  =========================================================================*/
+static void draw_word_list (TextContext *ctx, PipelineWord *words, int n)
+  {
+  if (ctx->scheduler)
+    draw_words (ctx, words, n);
+  else
+    {
+    for (int i = 0; i < n; i++)
+      {
+      const CachedWord *word = wordcache_get (ctx->words, ctx->glyphs, 
+        words[i].text, words[i].len, ctx->style);
+      face_draw_word (word, ctx->surface, ctx->background != NULL, 
+        &words[i].x, words[i].y);
+      }
+    }
+  }
+
+/*===========================================================================
+
+  draw_layout
+
+  Draw a layout with the top-left corner of its box at (x,y). If 
+  previous is not NULL, it is the layout that is currently drawn in
+  the same box, and only the lines that differ from it are cleared to
+  black and redrawn -- the others are already on the screen. Glyphs 
+  can stray a little outside their own line, so we clear the whole
+  character cell of the line, and the lines either side
+  of a redrawn line are drawn again as well, to restore any of their 
+  pixels that were cleared. Redrawing unchanged pixels is harmless,
+  unless the text is blended onto a background -- then each redraw
+  would darken the edges of the glyphs, so the lines either side are
+  cleared to the background first.
+
+  If there is a scheduler, the words are drawn by draw_words(), which
+  renders missing glyphs on other threads while drawing.
+
+  =========================================================================*/
+void draw_layout (TextContext *ctx, const Layout *layout, 
+      const Layout *previous, int x, int y)
+  {
+  int n_lines = layout->n_lines;
+  if (previous && previous->n_lines > n_lines) n_lines = previous->n_lines;
+  BOOL *dirty = malloc ((n_lines + 1) * sizeof (BOOL));
+  int width = layout->width;
+  if (previous && previous->width > width) width = previous->width;
+  // Glyphs can stray outside the box, so the damage extends beyond it
+  int margin = layout->cell_height / 2;
+
+  for (int l = 0; l < n_lines; l++)
+    dirty[l] = !previous || l >= layout->n_lines || l >= previous->n_lines
+      || !layout_line_equal (layout, l, previous, l);
+
+  for (int l = 0; l < n_lines; l++)
+    {
+    BOOL redraw = dirty[l] || (l > 0 && dirty[l - 1]) 
+        || (l + 1 < n_lines && dirty[l + 1]);
+    if (!redraw) continue;
+    // The line is at its position in whichever layout has it
+    const Layout *owner = previous && l < previous->n_lines 
+      ? previous : layout;
+    int line_y = y + owner->lines[l].y;
+    if (previous && (dirty[l] || ctx->background))
+      text_clear_rect (ctx, x, line_y, owner->width, owner->cell_height);
+    text_add_damage (ctx, x - margin, line_y - margin, 
+      width + 2 * margin, owner->cell_height + 2 * margin);
+    // With vertical alignment, a line can move to where no line of the
+    //  previous layout was
+    if (owner != layout && l < layout->n_lines 
+        && layout->lines[l].y != owner->lines[l].y)
+      text_add_damage (ctx, x - margin, y + layout->lines[l].y - margin, 
+        width + 2 * margin, layout->cell_height + 2 * margin);
+    }
+
+  PipelineWord *words = malloc ((layout->n_words + 1) 
+    * sizeof (PipelineWord));
+  int n_words = 0;
+  int redrawn = 0;
+  for (int l = 0; l < layout->n_lines; l++)
+    {
+    if (!dirty[l] && !(l > 0 && dirty[l - 1]) 
+        && !(l + 1 < n_lines && dirty[l + 1]))
+      continue;
+    n_words += add_line_words (layout, l, x, y, words + n_words);
+    redrawn++;
+    }
+
+  draw_word_list (ctx, words, n_words);
+
+  free (words);
+  free (dirty);
+  log_debug ("Redrew %d of %d lines", redrawn, layout->n_lines);
+  }
+
+/*===========================================================================
+
+  show_text32
+
+  Lay out len characters of text in the bounding box at (x,y), and draw
+  them. The text must have been allocated with malloc(), and this 
+  function frees it. The layout is taken from the run cache if
+  possible. previous is the layout currently shown in the box, or NULL
+  if the box is empty; if the new text is exactly the same as the old,
+  nothing is drawn at all. The new layout is returned, and the caller
+  should eventually layout_unref() it; this function drops the 
+  caller's reference to previous.
+
+  =========================================================================*/
+Layout *show_text32 (TextContext *ctx, UTF32 *text32, int len, 
+      Layout *previous, int x, int y, int width, int height)
+  {
+  text32 = normalize_nfc (text32, &len);
+
+  Layout *layout = layout_ref (runcache_get (ctx->runs, ctx->metrics, 
+    text32, len, width, height, ctx->style, ctx->align, ctx->hyphenator));
+  if (layout != previous)
+    {
+    draw_layout (ctx, layout, previous, x, y);
+    text_flush (ctx);
+    }
+  else
+    log_debug ("Text is unchanged -- nothing to draw");
+
+  if (previous) layout_unref (previous);
+  free (text32);
+  return layout;
+  }
+
+/*===========================================================================
+
+  show_text
+
+  Lay out a UTF-8 string in the bounding box at (x,y), and draw it,
+  as show_text32() does.
+
+  =========================================================================*/
+Layout *show_text (TextContext *ctx, const char *text, Layout *previous, 
+      int x, int y, int width, int height)
+  {
+  // The face_xxx and layout_xxx text handling functions take UTF32 
+  //  character strings as input.
+  UTF32 *text32 = utf8_to_utf32 ((const UTF8 *)text);
+  int len = 0;
+  while (text32[len]) len++;
+  return show_text32 (ctx, text32, len, previous, x, y, width, height);
+  }
+
+/*===========================================================================
+
+  read_stdin_line
+
+  Get the next line of standard input, decoded from UTF-8 by the stream,
+  which is fed as much input as is available at each read, until it 
+  has a complete line. The line, which the caller must free, is 
+  returned without its newline, and *len is set to its length; at the
+  end of the input, NULL is returned.
+
+  =========================================================================*/
+UTF32 *read_stdin_line (Utf8Stream *stream, int *len)
+  {
+  BYTE buff[STDIN_READ_SIZE];
+  UTF32 *line;
+  while (!(line = utf8stream_get_line (stream, len)))
+    {
+    ssize_t n = read (STDIN_FILENO, buff, sizeof (buff));
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) log_warning ("Can't read stdin: %s", strerror (errno));
+    if (n <= 0)
+      {
+      utf8stream_end (stream);
+      return utf8stream_get_line (stream, len);
+      }
+    utf8stream_write (stream, buff, n);
+    }
+  return line;
+  }
+
+/*===========================================================================
+
+  show_log_text
+
+  Lay out len characters of text, which this function frees, across 
+  the width of the screen, with a 
+  margin of x pixels each side, and add its lines to the bottom of 
+  the screen, scrolling the screen up. Each line is drawn on the 
+  scroller's line surface before it is shown, so it appears all at 
+  once.
+
+  The lines are packed at the face's nominal line spacing, which is
+  less than the height of a character cell, because the cell has room
+  for the tallest and deepest glyphs in the face. So each line is 
+  moved up, to put its baseline where the face's ascender says it 
+  should be; only the rare glyphs that reach above that are clipped.
+
+  =========================================================================*/
+void show_log_text (TextContext *ctx, Scroller *scroller, UTF32 *text32,
+      int len, int x)
+  {
+  text32 = normalize_nfc (text32, &len);
+
+  Surface *screen = ctx->surface;
+  int width = screen->width - 2 * x;
+  // The layout can have as many lines as it likes
+  Layout *layout = runcache_get (ctx->runs, ctx->metrics, text32, len, 
+    width, INT_MAX / 2, ctx->style, ctx->align & LAYOUT_ALIGN_HORIZONTAL,
+    ctx->hyphenator);
+  PipelineWord *words = malloc ((layout->n_words + 1) 
+    * sizeof (PipelineWord));
+  FT_Face face = glyphcache_get_face (ctx->glyphs);
+  int shift = glyphcache_get_ascent (ctx->glyphs) 
+    - face->size->metrics.ascender / 64;
+
+  // An empty line still takes up a line on the screen
+  for (int l = 0; l < (layout->n_lines ? layout->n_lines : 1); l++)
+    {
+    ctx->surface = scroller_next_line (scroller);
+    if (l < layout->n_lines)
+      {
+      int n = add_line_words (layout, l, x, -layout->lines[l].y - shift,
+        words);
+      draw_word_list (ctx, words, n);
+      }
+    scroller_show (scroller);
+    }
+
+  ctx->surface = screen;
+  free (words);
+  free (text32);
+  }
+
+/*===========================================================================
+
+  run_log
+
+  Read lines from stdin, and scroll them up the screen, with a margin
+  of x pixels at each side.
+
+  =========================================================================*/
+void run_log (TextContext *ctx, FrameBuffer *fb, int x)
+  {
+  Scroller *scroller = scroller_create (fb, 
+    fontmetrics_get_line_spacing (ctx->metrics));
+  Utf8Stream *stream = utf8stream_create (STDIN_READ_SIZE);
+  UTF32 *line;
+  int len;
+  while ((line = read_stdin_line (stream, &len)))
+    show_log_text (ctx, scroller, line, len, x);
+  utf8stream_destroy (stream);
+  scroller_destroy (scroller);
+  }
+
+/*===========================================================================
+
+  run_console
+
+  Read stdin, and show it on a console that fills the screen, as a
+  terminal would, with its escape sequences interpreted. Input is read
+  as it arrives, not a line at a time, so prompts and progress output
+  that don't end in a newline appear immediately. When the input 
+  pauses, or at most every CONSOLE_UPDATE_MSEC while it is still 
+  pouring in, the cells that have changed are redrawn -- redrawing
+  after every read would spend most of the time drawing text that is
+  scrolled away before anyone could see it. While there is no input,
+  the cursor blinks.
+
+  =========================================================================*/
+void run_console (TextContext *ctx)
+  {
+  Console *console = console_create (ctx->surface, ctx->glyphs);
+  Terminal *terminal = terminal_create (console);
+  console_update (console);
+  BYTE *buff = malloc (CONSOLE_READ_SIZE);
+  struct timespec last;
+  clock_gettime (CLOCK_MONOTONIC, &last);
+  while (TRUE)
+    {
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    int ready = poll (&pfd, 1, CONSOLE_BLINK_MSEC);
+    if (ready == 0)
+      {
+      console_blink (console);
+      continue;
+      }
+    ssize_t n = ready < 0 ? -1 : read (STDIN_FILENO, buff, 
+      CONSOLE_READ_SIZE);
+    if (n < 0)
+      {
+      if (errno == EINTR) continue;
+      log_warning ("Can't read stdin: %s", strerror (errno));
+      break;
+      }
+    if (n == 0) break;
+    terminal_feed (terminal, buff, n);
+
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    long msec = (now.tv_sec - last.tv_sec) * 1000 
+      + (now.tv_nsec - last.tv_nsec) / 1000000;
+    if (msec < CONSOLE_UPDATE_MSEC && poll (&pfd, 1, 0) > 0) continue;
+    int drawn = console_update (console);
+    log_debug ("Console drew %d cells", drawn);
+    last = now;
+    }
+  // The cursor would just be in the way of whatever runs next
+  console_set_cursor_visible (console, FALSE);
+  console_update (console);
+  free (buff);
+  terminal_destroy (terminal);
+  console_destroy (console);
+  }
+
+/*===========================================================================
+
+  Box
+
+  A bounding box and its text, for batch mode. 
+
+  =========================================================================*/
+typedef struct _Box
+  {
+  int x;
+  int y;
+  int width;
+  int height;
+  UTF32 *text;
+  int len;
+  const FontMetrics *metrics; // Metrics to lay out with, on any thread
+  int style;
+  int align;
+  const Hyphenator *hyphenator;
+  Layout *layout; // The layout of the text, once known
+  BOOL cached; // TRUE if the layout came from the run cache
+  } Box;
+
+/*===========================================================================
+
+  parse_box
+
+  Parse len characters of a line of batch input, in the form
+
+    x y width height text...
+
+  into the box. The line must have been allocated with malloc(), and
+  on success the box's text is made from it, in place. Numbers larger
+  than any screen are clamped to BATCH_MAX_COORD, so that arithmetic
+  on them can't overflow. Returns FALSE if the line is badly formed.
+
+  =========================================================================*/
+static BOOL parse_box (UTF32 *line, int len, Box *box)
+  {
+  int *fields[4] = { &box->x, &box->y, &box->width, &box->height };
+  int i = 0;
+  for (int f = 0; f < 4; f++)
+    {
+    while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+    BOOL negative = i < len && line[i] == '-';
+    if (negative || (i < len && line[i] == '+')) i++;
+    if (i == len || line[i] < '0' || line[i] > '9') return FALSE;
+    long v = 0;
+    for (; i < len && line[i] >= '0' && line[i] <= '9'; i++)
+      {
+      v = v * 10 + (line[i] - '0');
+      if (v > BATCH_MAX_COORD) v = BATCH_MAX_COORD;
+      }
+    *fields[f] = negative ? -v : v;
+    }
+  while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+
+  box->len = len - i;
+  memmove (line, line + i, box->len * sizeof (UTF32));
+  line[box->len] = 0;
+  box->text = line;
+  return TRUE;
+  }
+
+/*===========================================================================
+
+  box_layout_task
+
+  A scheduler task that lays out the text of one box.
+
+  =========================================================================*/
+static void box_layout_task (void *arg)
+  {
+  Box *box = arg;
+  box->layout = layout_create (box->metrics, box->text, box->len, 
+    box->width, box->height, box->style, box->align, box->hyphenator);
+  }
+
+/*===========================================================================
+
+  free_boxes
+
+  =========================================================================*/
+void free_boxes (Box *boxes, int n)
+  {
+  for (int i = 0; i < n; i++)
+    {
+    free (boxes[i].text);
+    layout_unref (boxes[i].layout);
+    }
+  free (boxes);
+  }
+
+/*===========================================================================
+
+  Band
+
+  A horizontal band of the screen, for parallel drawing in batch mode. 
+  Each band is drawn by one scheduler task, which draws only the 
+  parts of the boxes that fall inside it. Since bands don't overlap,
+  the tasks never write to the same memory. 
+
+  =========================================================================*/
+typedef struct _Band
+  {
+  TextContext *ctx;
+  int top; // First row of the band
+  int bottom; // Row after the last row of the band
+  const DamageRect *clear; // The areas to clear
+  int n_clear;
+  Box **boxes; // The boxes to draw
+  int n_boxes;
+  } Band;
+
+/*===========================================================================
+
+  box_extent
+
+  The area that a box's text can draw on: the box itself, with a 
+  margin of half a character cell all round, for glyphs that overhang
+  it, like italics and descenders.
+
+  =========================================================================*/
+static DamageRect box_extent (const Box *box)
+  {
+  int margin = box->layout->cell_height / 2;
+  DamageRect r = { box->x - margin, box->y - margin, 
+    box->width + 2 * margin, box->height + 2 * margin };
+  return r;
+  }
+
+/*===========================================================================
+
+  fill_rect_in_band
+
+  =========================================================================*/
+static void fill_rect_in_band (const TextContext *ctx, const Band *band, 
+      int x, int y, int width, int height)
+  {
+  int top = y > band->top ? y : band->top;
+  int bottom = y + height < band->bottom ? y + height : band->bottom;
+  if (top < bottom)
+    text_clear_rect (ctx, x, top, width, bottom - top);
+  }
+
+/*===========================================================================
+
+  draw_glyph_in_band
+
+  Draw a glyph whose character cell has its top-left corner at (x,y), 
+  clipped to the band. Only the span of each row that has any coverage
+  is drawn, so the empty pixels around and inside thin glyphs, and 
+  the empty rows inside glyphs like ':', cost nothing.
+
+  =========================================================================*/
+static void draw_glyph_in_band (const TextContext *ctx, const Band *band, 
+      const CachedGlyph *g, int x, int y)
+  {
+  if (!g || !g->buffer) return;
+  int gy = y + g->y_off;
+  int top = gy > band->top ? gy : band->top;
+  int bottom = gy + g->rows < band->bottom ? gy + g->rows : band->bottom;
+  for (int row = top; row < bottom; row++)
+    {
+    const GlyphSpan *span = &g->spans[row - gy];
+    if (span->start == span->end) continue;
+    const BYTE *coverage = g->buffer + (row - gy) * g->pitch + span->start;
+    int gx = x + g->x_off + span->start;
+    if (ctx->background)
+      surface_blend_coverage (ctx->surface, gx, row, coverage, 
+        span->end - span->start, 1, g->pitch, 255, 255, 255);
+    else
+      surface_draw_coverage (ctx->surface, gx, row, coverage, 
+        span->end - span->start, 1, g->pitch);
+    }
+  }
+
+/*===========================================================================
+
+  band_draw_task
+
+  A scheduler task that clears and redraws the changed boxes within
+  one band. The glyphs are drawn individually, from the glyph cache, 
+  rather than as whole words from the word cache, because the 
+  word cache changes as it is used, and so can't be shared between 
+  threads. The glyph cache can be, and all the glyphs were rendered
+  before the layout stage anyway, so every lookup is a lock-free hit.
+
+  =========================================================================*/
+static void band_draw_task (void *arg)
+  {
+  Band *band = arg;
+  TextContext *ctx = band->ctx;
+
+  for (int i = 0; i < band->n_clear; i++)
+    {
+    const DamageRect *r = &band->clear[i];
+    fill_rect_in_band (ctx, band, r->x, r->y, r->width, r->height);
+    }
+
+  for (int i = 0; i < band->n_boxes; i++)
+    {
+    const Box *box = band->boxes[i];
+    const Layout *layout = box->layout;
+    for (int l = 0; l < layout->n_lines; l++)
+      {
+      const LayoutLine *line = &layout->lines[l];
+      int line_y = box->y + line->y;
+      if (line_y >= band->bottom || line_y + layout->cell_height <= band->top)
+        continue;
+      for (int w = 0; w < line->n_words; w++)
+        {
+        const LayoutWord *word = &layout->words[line->first_word + w];
+        for (int c = word->first; c < word->first + word->len; c++)
+          {
+          const CachedGlyph *g = glyphcache_get (ctx->glyphs, 
+            layout->text[c], layout->style);
+          draw_glyph_in_band (ctx, band, g, 
+            box->x + layout->glyph_x[c], line_y);
+          }
+        }
+      }
+    }
+  }
+
+/*===========================================================================
+
+  show_frame
+
+  Lay out and draw all the boxes in a frame. This is done in stages, 
+  each of which is spread across the CPUs by the scheduler:
+
+  1. Glyphs that aren't in the glyph cache are rendered in parallel,
+     each thread using its own copy of the face.
+  2. The metrics tables are updated with the new glyphs. This is done 
+     on this thread, but is cheap because the glyphs are all cached.
+  3. Boxes that aren't in the run cache are laid out in parallel, 
+     reading the (now unchanging) metrics tables.
+  4. The screen is divided into horizontal bands, and the boxes that
+     have changed are cleared and redrawn, one band per task.
+
+  previous is the frame currently on the screen, if any. A box that 
+  has the same position and layout as the corresponding box in that 
+  frame is not redrawn, unless it overlaps the area of a box that is
+  -- the old and new areas of a changed box are cleared, and so are 
+  those of the boxes in the previous frame that have no successor.
+
+  =========================================================================*/
+void show_frame (TextContext *ctx, Box *boxes, int n, 
+      const Box *previous, int n_previous)
+  {
+  // Stage 1
+  int misses = 0;
+  for (int i = 0; i < n; i++)
+    {
+    Box *box = &boxes[i];
+    box->metrics = ctx->metrics;
+    box->style = ctx->style;
+    box->align = ctx->align;
+    box->hyphenator = ctx->hyphenator;
+    box->layout = runcache_lookup (ctx->runs, ctx->metrics, box->text, 
+      box->len, box->width, box->height, box->style, box->align,
+      box->hyphenator);
+    if (box->layout)
+      {
+      layout_ref (box->layout);
+      box->cached = TRUE;
+      }
+    else
+      {
+      glyphcache_request (ctx->glyphs, box->text, box->len, box->style);
+      misses++;
+      }
+    }
+  // Any box that is laid out may need a hyphen
+  static const UTF32 hyphen = LAYOUT_HYPHEN;
+  if (misses > 0 && ctx->hyphenator)
+    glyphcache_request (ctx->glyphs, &hyphen, 1, ctx->style);
+  glyphcache_render_pending (ctx->glyphs, ctx->scheduler);
+
+  // Stage 2
+  for (int i = 0; i < n; i++)
+    if (!boxes[i].cached)
+      fontmetrics_prepare (ctx->metrics, boxes[i].text, boxes[i].len, 
+        boxes[i].style);
+  if (misses > 0 && ctx->hyphenator)
+    fontmetrics_prepare (ctx->metrics, &hyphen, 1, ctx->style);
+
+  // Stage 3
+  for (int i = 0; i < n; i++)
+    if (!boxes[i].cached) 
+      scheduler_submit (ctx->scheduler, box_layout_task, &boxes[i]);
+  scheduler_wait (ctx->scheduler);
+  log_debug ("Laid out %d of %d boxes", misses, n);
+
+  // Stage 4 -- first, find the changed boxes, and the areas that
+  //  must be cleared
+  BOOL *redraw = calloc (n > 0 ? n : 1, sizeof (BOOL));
+  DamageRect *clear = malloc ((3 * n + n_previous + 1) 
+    * sizeof (DamageRect));
+  int n_clear = 0;
+  for (int i = 0; i < n; i++)
+    {
+    Box *box = &boxes[i];
+    if (!box->cached)
+      runcache_insert (ctx->runs, ctx->metrics, box->layout);
+    const Box *old = i < n_previous ? &previous[i] : NULL;
+    if (old && old->layout == box->layout && old->x == box->x 
+        && old->y == box->y)
+      continue;
+    redraw[i] = TRUE;
+    clear[n_clear++] = box_extent (box);
+    if (old) clear[n_clear++] = box_extent (old);
+    }
+  for (int i = n; i < n_previous; i++)
+    clear[n_clear++] = box_extent (&previous[i]);
+
+  // An unchanged box that overlaps a cleared area must be redrawn,
+  //  and so cleared itself, which may take others with it
+  BOOL more = TRUE;
+  while (more)
+    {
+    more = FALSE;
+    for (int i = 0; i < n; i++)
+      {
+      if (redraw[i]) continue;
+      DamageRect r = box_extent (&boxes[i]);
+      for (int k = 0; k < n_clear; k++)
+        {
+        const DamageRect *c = &clear[k];
+        if (r.x < c->x + c->width && c->x < r.x + r.width 
+            && r.y < c->y + c->height && c->y < r.y + r.height)
+          {
+          redraw[i] = TRUE;
+          clear[n_clear++] = r;
+          more = TRUE;
+          break;
+          }
+        }
+      }
+    }
+
+  Box **changed = malloc ((n > 0 ? n : 1) * sizeof (Box *));
+  int n_changed = 0;
+  for (int i = 0; i < n; i++)
+    if (redraw[i]) changed[n_changed++] = &boxes[i];
+
+  int top = ctx->surface->height;
+  int bottom = 0;
+  for (int k = 0; k < n_clear; k++)
+    {
+    const DamageRect *c = &clear[k];
+    text_add_damage (ctx, c->x, c->y, c->width, c->height);
+    if (c->y < top) top = c->y;
+    if (c->y + c->height > bottom) bottom = c->y + c->height;
+    }
+  if (top < 0) top = 0;
+  if (bottom > ctx->surface->height) bottom = ctx->surface->height;
+
+  if (n_clear > 0 && bottom > top)
+    {
+    // Two bands per thread gives the scheduler some room to balance
+    //  bands that have more text than others
+    int n_bands = 2 * (scheduler_get_threads (ctx->scheduler) + 1);
+    int band_height = (bottom - top + n_bands - 1) / n_bands;
+    if (band_height < 1) band_height = 1;
+    Band *bands = malloc (n_bands * sizeof (Band));
+    for (int i = 0; i < n_bands; i++)
+      {
+      Band *band = &bands[i];
+      band->ctx = ctx;
+      band->top = top + i * band_height;
+      band->bottom = band->top + band_height;
+      band->clear = clear;
+      band->n_clear = n_clear;
+      band->boxes = changed;
+      band->n_boxes = n_changed;
+      if (band->top < bottom)
+        scheduler_submit (ctx->scheduler, band_draw_task, band);
+      }
+    scheduler_wait (ctx->scheduler);
+    free (bands);
+    }
+  text_flush (ctx);
+  log_debug ("Redrew %d of %d boxes", n_changed, n);
+  free (changed);
+  free (clear);
+  free (redraw);
+  }
+
+/*===========================================================================
+
+  run_batch
+
+  Read frames of boxes from stdin, and show them. Each line describes
+  one box, as "x y width height text...". A blank line, or the end
+  of the input, ends a frame.
+
+  =========================================================================*/
+void run_batch (TextContext *ctx)
+  {
+  Box *frame = NULL;
+  int n_frame = 0;
+  Box *previous = NULL;
+  int n_previous = 0;
+  int frame_size = 0;
+
+  Utf8Stream *stream = utf8stream_create (STDIN_READ_SIZE);
+  int line_number = 0;
+  BOOL more;
+  do
+    {
+    int len;
+    UTF32 *line = read_stdin_line (stream, &len);
+    more = line != NULL;
+    line_number++;
+
+    if (more && len > 0)
+      {
+      Box box;
+      memset (&box, 0, sizeof (Box));
+      if (parse_box (line, len, &box))
+        {
+        line = NULL; // The box has it now
+        box.text = normalize_nfc (box.text, &box.len);
+        if (n_frame == frame_size)
+          {
+          frame_size = frame_size ? frame_size * 2 : 64;
+          frame = realloc (frame, frame_size * sizeof (Box));
+          }
+        frame[n_frame++] = box;
+        }
+      else
+        log_warning ("Ignoring badly-formed box on line %d", line_number);
+      }
+    else if (n_frame > 0)
+      {
+      // End of frame
+      show_frame (ctx, frame, n_frame, previous, n_previous);
+      if (previous) free_boxes (previous, n_previous);
+      previous = frame;
+      n_previous = n_frame;
+      frame = NULL;
+      n_frame = 0;
+      frame_size = 0;
+      }
+    free (line);
+    } while (more);
+
+  if (previous) free_boxes (previous, n_previous);
+  utf8stream_destroy (stream);
+  }
+
+/*===========================================================================
+
+  parse_cpu_list
+
+  Parse a list of CPU numbers, like "0,2-4,7", into an array that the
+  caller must free. Returns NULL if the list is badly formed, or has 
+  a number too large for a cpu_set_t.
+
+  =========================================================================*/
+int *parse_cpu_list (const char *list, int *n_cpus)
+  {
+  int *cpus = NULL;
+  int n = 0;
+  const char *p = list;
+  while (*p)
+    {
+    char *end;
+    long first = strtol (p, &end, 10);
+    long last = first;
+    if (end == p || first < 0 || first >= CPU_SETSIZE) break;
+    p = end;
+    if (*p == '-')
+      {
+      last = strtol (p + 1, &end, 10);
+      if (end == p + 1 || last < first || last >= CPU_SETSIZE) break;
+      p = end;
+      }
+    cpus = realloc (cpus, (n + last - first + 1) * sizeof (int));
+    for (long c = first; c <= last; c++) cpus[n++] = c;
+    if (*p == ',') p++;
+    else if (*p) break;
+    }
+  if (*p || n == 0)
+    {
+    free (cpus);
+    return NULL;
+    }
+  *n_cpus = n;
+  return cpus;
+  }
+
+/*===========================================================================
+
+  join_args
+
+  Join command-line arguments into a single string, separated by 
+  spaces. The caller must free the result.
+
+  =========================================================================*/
+char *join_args (int count, char **args)
+  {
+  size_t size = 1;
+  for (int i = 0; i < count; i++) size += strlen (args[i]) + 1;
+  char *s = malloc (size);
+  s[0] = 0;
+  for (int i = 0; i < count; i++)
+    {
+    if (i > 0) strcat (s, " ");
+    strcat (s, args[i]);
+    }
+  return s;
+  }
+
+/*===========================================================================
+
+  text_fits
+
+  Returns TRUE if all of the text fits the box, when laid out with
+  the metrics, which must be prepared for it, and for the hyphen if
+  hyphenator is not NULL.
+
+  =========================================================================*/
+static BOOL text_fits (const FontMetrics *metrics, const UTF32 *text, 
+      int len, int width, int height, int style, 
+      const Hyphenator *hyphenator)
+  {
+  Layout *layout = layout_create (metrics, text, len, width, height,
+    style, LAYOUT_ALIGN_LEFT, hyphenator);
+  BOOL ret = layout_fits (layout);
+  layout_unref (layout);
+  return ret;
+  }
+
+/*===========================================================================
+
+  fit_text_size
+
+  Find the largest font size, in pixels, at which all of a UTF-8 string
+  fits a box, and set the face to that size, which is returned. If the
+  text doesn't fit at any size, the size is 1. If hyphenator is not
+  NULL, the text may be hyphenated to fit.
+
+  The size is found by a binary search between 1 pixel and the height
+  of the box. At each size tried, the text is laid out with metrics in 
+  font units, scaled to the size, so the metrics are read from the 
+  face only once, and no glyphs are rendered at all. Hinting can round
+  the real advances slightly differently from the scaled ones, so the
+  size found is checked with the real advances -- still without 
+  rendering anything -- and reduced, if the text doesn't quite fit 
+  after all.
+
+  =========================================================================*/
+int fit_text_size (FT_Face face, const char *text, int width, int height,
+      int style, const Hyphenator *hyphenator)
+  {
+  static const UTF32 hyphen = LAYOUT_HYPHEN;
+  UTF32 *text32 = utf8_to_utf32 ((const UTF8 *)text);
+  int len = 0;
+  while (text32[len]) len++;
+  text32 = normalize_nfc (text32, &len);
+
+  FontMetrics *scalable = fontmetrics_create_scalable (face);
+  fontmetrics_prepare (scalable, text32, len, style);
+  if (hyphenator) fontmetrics_prepare (scalable, &hyphen, 1, style);
+  int fits = 0; // The largest size known to fit
+  int too_big = height + 1; // The smallest size known not to
+  int tries = 0;
+  while (too_big - fits > 1)
+    {
+    int size = (fits + too_big) / 2;
+    fontmetrics_set_size (scalable, size);
+    if (text_fits (scalable, text32, len, width, height, style, 
+        hyphenator))
+      fits = size;
+    else
+      too_big = size;
+    tries++;
+    }
+  fontmetrics_destroy (scalable);
+
+  int size = fits > 1 ? fits : 1;
+  while (TRUE)
+    {
+    FT_Set_Pixel_Sizes (face, 0, size);
+    if (size == 1) break;
+    FontMetrics *real = fontmetrics_create_for_face (face);
+    fontmetrics_prepare (real, text32, len, style);
+    if (hyphenator) fontmetrics_prepare (real, &hyphen, 1, style);
+    BOOL ok = text_fits (real, text32, len, width, height, style, 
+      hyphenator);
+    fontmetrics_destroy (real);
+    if (ok) break;
+    size--;
+    }
+  log_debug ("Text fits at %d px, estimated %d px in %d tries", size, 
+    fits, tries);
+  free (text32);
+  return size;
+  }
+
+/*===========================================================================
+
+  dump_screen
+
+  Write the contents of the framebuffer to a file as a PPM image, or 
+  to stdout if the filename is "-". Returns FALSE, and writes *error 
+  with a message that the caller should eventually free, on failure.
+
+  =========================================================================*/
+BOOL dump_screen (FrameBuffer *fb, const char *filename, char **error)
+  {
+  LOG_IN
+  BOOL ret = FALSE;
+  int fd = strcmp (filename, "-") == 0 ? STDOUT_FILENO 
+    : open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0)
+    {
+    ret = image_save_ppm (framebuffer_get_surface (fb), fd, error);
+    if (fd != STDOUT_FILENO) close (fd);
+    }
+  else
+    asprintf (error, "Can't open %s: %s", filename, strerror (errno));
+  LOG_OUT
+  return ret;
+  }
+
 /*===========================================================================
 
   usage
@@ -398,15 +1656,31 @@ UTF32 *utf8_to_utf32(const UTF8 *utf8_word)
   =========================================================================*/
 void usage (const char *argv0)
   {
-  fprintf (stderr, "Usage %s [options] font_file word1 word2....\n", argv0);
+  fprintf (stderr, "Usage %s [options] font_file [word1 word2....]\n", argv0);
+  fprintf (stderr, "      %s --dump=FILE [options]\n", argv0);
   fprintf (stderr, "font_file is any TTF font file.\n");
   fprintf (stderr, "All positions and sizes are in screen pixels.\n");
+  fprintf (stderr, "  -a,--align=ALIGN       left, right, centre, or justify\n");
+  fprintf (stderr, "  -B,--batch             read boxes of text from stdin\n");
+  fprintf (stderr, "  -A,--affinity=LIST     bind threads to CPUs, e.g. 0-3\n");
+  fprintf (stderr, "  -b,--bold              synthetic bold text\n");
   fprintf (stderr, "  -c,--clear             clear screen before writing\n");
+  fprintf (stderr, "  -C,--console           show stdin on a console of cells\n");
   fprintf (stderr, "  -d,--dev=device        framebuffer device (/dev/fb0)\n");
+  fprintf (stderr, "  -D,--dither            dither background to 16bpp screen\n");
+  fprintf (stderr, "  -o,--dump=FILE         save the screen as PPM (- for stdout)\n");
+  fprintf (stderr, "  -g,--background=FILE   PPM or PNG background image\n");
   fprintf (stderr, "  -f,--font-size=N       font height in pixels (20)\n");
+  fprintf (stderr, "  -F,--fit               largest font size that fits the box\n");
+  fprintf (stderr, "  -H,--hyphenate=FILE    hyphenate with patterns from FILE\n");
   fprintf (stderr, "  -l,--log-level=[0..4]  log verbosity (0) \n");
+  fprintf (stderr, "  -L,--log               scroll lines from stdin up the screen\n");
   fprintf (stderr, "  -h,--height=N          height of bounding box (500)\n");
+  fprintf (stderr, "  -i,--italic            synthetic italic text\n");
+  fprintf (stderr, "  -s,--stdin             replace text with lines from stdin\n");
+  fprintf (stderr, "  -t,--threads=N         worker threads (one per CPU)\n");
   fprintf (stderr, "  -v,--version           show version\n");
+  fprintf (stderr, "  -V,--valign=VALIGN     top, middle, or bottom of the box\n");
   fprintf (stderr, "  -w,--width=N           width of bounding box (500)\n");
   fprintf (stderr, "  -x=N                   initial X coordinate (5)\n");
   fprintf (stderr, "  -y=N                   initial Y coordinate (5)\n");
@@ -419,9 +1693,6 @@ void usage (const char *argv0)
   =========================================================================*/
 int main (int argc, char **argv)
   {
-  // A string representating a single space in UTF32 format
-  static const UTF32 utf32_space[2] = {' ', 0};
-
   // Variables set from the command line
 
   int init_x = 5;
@@ -432,7 +1703,22 @@ int main (int argc, char **argv)
   BOOL show_usage = FALSE;
   BOOL show_version = FALSE;
   BOOL clear = FALSE;
+  BOOL from_stdin = FALSE;
+  BOOL batch = FALSE;
+  BOOL log_mode = FALSE;
+  BOOL console_mode = FALSE;
+  BOOL fit = FALSE;
+  int threads = 0;
+  int *cpus = NULL;
+  int n_cpus = 0;
+  int style = GLYPH_STYLE_REGULAR;
+  int align = LAYOUT_ALIGN_LEFT;
+  int valign = LAYOUT_ALIGN_TOP;
   char *fbdev = strdup (FBDEV);
+  char *background = NULL;
+  char *dump = NULL;
+  char *patterns = NULL;
+  BOOL dither = FALSE;
   int log_level = LOG_ERROR;
 
   // Command line option table
@@ -441,9 +1727,24 @@ int main (int argc, char **argv)
     {
       {"help", no_argument, NULL, '?'},
       {"clear", no_argument, NULL, 'c'},
+      {"bold", no_argument, NULL, 'b'},
+      {"italic", no_argument, NULL, 'i'},
       {"version", no_argument, NULL, 'v'},
+      {"stdin", no_argument, NULL, 's'},
+      {"batch", no_argument, NULL, 'B'},
+      {"log", no_argument, NULL, 'L'},
+      {"console", no_argument, NULL, 'C'},
+      {"threads", required_argument, NULL, 't'},
+      {"affinity", required_argument, NULL, 'A'},
+      {"align", required_argument, NULL, 'a'},
+      {"valign", required_argument, NULL, 'V'},
+      {"fit", no_argument, NULL, 'F'},
+      {"hyphenate", required_argument, NULL, 'H'},
       {"log-level", required_argument, NULL, 'l'},
       {"dev", required_argument, NULL, 'd'},
+      {"dither", no_argument, NULL, 'D'},
+      {"background", required_argument, NULL, 'g'},
+      {"dump", required_argument, NULL, 'o'},
       {"font-size", required_argument, NULL, 'f'},
       {"x", required_argument, NULL, 'x'},
       {"y", required_argument, NULL, 'y'},
@@ -462,7 +1763,7 @@ int main (int argc, char **argv)
    while (ret)
      {
      int option_index = 0;
-     opt = getopt_long (argc, argv, "c?vl:f:x:y:w:h:d:",
+     opt = getopt_long (argc, argv, "BbcCDFiLs?va:l:f:x:y:w:h:d:g:o:t:A:V:H:",
      long_options, &option_index);
 
      if (opt == -1) break;
@@ -476,6 +1777,18 @@ int main (int argc, char **argv)
            show_version = TRUE; 
          else if (strcmp (long_options[option_index].name, "clear") == 0)
            clear = TRUE; 
+         else if (strcmp (long_options[option_index].name, "stdin") == 0)
+           from_stdin = TRUE; 
+         else if (strcmp (long_options[option_index].name, "batch") == 0)
+           batch = TRUE; 
+         else if (strcmp (long_options[option_index].name, "log") == 0)
+           log_mode = TRUE; 
+         else if (strcmp (long_options[option_index].name, "console") == 0)
+           console_mode = TRUE; 
+         else if (strcmp (long_options[option_index].name, "bold") == 0)
+           style |= GLYPH_STYLE_BOLD; 
+         else if (strcmp (long_options[option_index].name, "italic") == 0)
+           style |= GLYPH_STYLE_ITALIC; 
          else if (strcmp (long_options[option_index].name, "log-level") == 0)
            log_level = atoi (optarg);
          else if (strcmp (long_options[option_index].name, "width") == 0)
@@ -488,8 +1801,27 @@ int main (int argc, char **argv)
            init_y = atoi (optarg); 
          else if (strcmp (long_options[option_index].name, "font-size") == 0)
            init_y = atoi (optarg); 
+         else if (strcmp (long_options[option_index].name, "threads") == 0)
+           threads = atoi (optarg); 
+         else if (strcmp (long_options[option_index].name, "affinity") == 0)
+           { free (cpus); cpus = parse_cpu_list (optarg, &n_cpus); } 
+         else if (strcmp (long_options[option_index].name, "align") == 0)
+           align = layout_parse_align (optarg); 
+         else if (strcmp (long_options[option_index].name, "valign") == 0)
+           valign = layout_parse_valign (optarg); 
+         else if (strcmp (long_options[option_index].name, "fit") == 0)
+           fit = TRUE; 
+         else if (strcmp (long_options[option_index].name, "hyphenate") == 0)
+           { free (patterns); patterns = strdup (optarg); } 
          else if (strcmp (long_options[option_index].name, "dev") == 0)
            { free (fbdev); fbdev = strdup (optarg); } 
+         else if (strcmp (long_options[option_index].name, "dither") == 0)
+           dither = TRUE; 
+         else if (strcmp (long_options[option_index].name, 
+             "background") == 0)
+           { free (background); background = strdup (optarg); } 
+         else if (strcmp (long_options[option_index].name, "dump") == 0)
+           { free (dump); dump = strdup (optarg); } 
          else
            exit (-1);
          break;
@@ -499,6 +1831,18 @@ int main (int argc, char **argv)
          show_version = TRUE; break; 
        case 'c': 
          clear = TRUE; break; 
+       case 's': 
+         from_stdin = TRUE; break; 
+       case 'B': 
+         batch = TRUE; break; 
+       case 'L': 
+         log_mode = TRUE; break; 
+       case 'C': 
+         console_mode = TRUE; break; 
+       case 'b': 
+         style |= GLYPH_STYLE_BOLD; break; 
+       case 'i': 
+         style |= GLYPH_STYLE_ITALIC; break; 
        case 'l':
            log_level = atoi (optarg); break;
        case 'w': 
@@ -511,8 +1855,46 @@ int main (int argc, char **argv)
            init_x = atoi (optarg); break; 
        case 'y': 
            init_y = atoi (optarg); break;
+       case 't': 
+           threads = atoi (optarg); break;
+       case 'A': 
+           free (cpus); 
+           cpus = parse_cpu_list (optarg, &n_cpus); 
+           if (!cpus) 
+             {
+             fprintf (stderr, "%s: bad CPU list: %s\n", argv[0], optarg);
+             ret = FALSE;
+             }
+           break;
+       case 'a': 
+           align = layout_parse_align (optarg);
+           if (align < 0) 
+             {
+             fprintf (stderr, "%s: bad alignment: %s\n", argv[0], optarg);
+             ret = FALSE;
+             }
+           break;
+       case 'V': 
+           valign = layout_parse_valign (optarg);
+           if (valign < 0) 
+             {
+             fprintf (stderr, "%s: bad vertical alignment: %s\n", argv[0], 
+               optarg);
+             ret = FALSE;
+             }
+           break;
+       case 'F': 
+           fit = TRUE; break; 
+       case 'H': 
+           free (patterns); patterns = strdup (optarg); break;
        case 'd': 
            free (fbdev); fbdev = strdup (optarg); break;
+       case 'D': 
+           dither = TRUE; break; 
+       case 'g': 
+           free (background); background = strdup (optarg); break;
+       case 'o': 
+           free (dump); dump = strdup (optarg); break;
        default:
          ret = FALSE; 
        }
@@ -534,16 +1916,53 @@ int main (int argc, char **argv)
 
   log_set_level (log_level);
 
-  if (ret)
+  // The hyphenation patterns are read once, and shared by all the 
+  //  layouts, on all threads
+  Hyphenator *hyphenator = NULL;
+  if (ret && patterns)
+    {
+    char *error = NULL;
+    hyphenator = hyphenator_create (patterns, &error);
+    if (!hyphenator)
+      {
+      fprintf (stderr, "%s\n", error);
+      free (error);
+      ret = FALSE;
+      }
+    }
+
+  if (ret && dump && argc - optind == 0)
+    {
+    // Just save what is on the screen
+    char *error = NULL;
+    FrameBuffer *fb = framebuffer_create (fbdev);
+    if (framebuffer_init (fb, &error))
+      {
+      if (!dump_screen (fb, dump, &error))
+        {
+        fprintf (stderr, "%s\n", error);
+        free (error);
+        }
+      framebuffer_deinit (fb);
+      }
+    else
+      {
+      fprintf (stderr, "Can't initialize framebuffer: %s\n", error);
+      free (error);
+      }
+    framebuffer_destroy (fb);
+    }
+  else if (ret)
     {
     // If we get here, we have some work to do.
-    if (argc - optind >= 2)
+    if (argc - optind >= (from_stdin || batch || log_mode || console_mode 
+        ? 1 : 2))
       {
       char *ttf_file = argv[optind];
     
       char *error = NULL;
 
-      FrameBuffer *fb = framebuffer_create (FBDEV);
+      FrameBuffer *fb = framebuffer_create (fbdev);
 
       // Initializing the framebuffer may fail, particularly if the user
       //   doesn't have permissions.
@@ -558,61 +1977,129 @@ int main (int argc, char **argv)
 	if (init_ft (ttf_file, &face, &ft, font_size, &error))
 	  {
           log_debug ("Font face initialized OK");
+	  // To fit the text to the box, the face is set to the largest
+	  //  size at which it fits before any glyphs are rendered, so
+	  //  only glyphs of that size ever are.
+	  if (fit && argc - optind >= 2 && !batch && !log_mode 
+	      && !console_mode)
+	    {
+	    char *text = join_args (argc - optind - 1, argv + optind + 1);
+	    fit_text_size (face, text, width, height, style, hyphenator);
+	    free (text);
+	    }
+	  else if (fit)
+	    log_warning ("Only text on the command line can be fitted");
+	  // All the glyphs we draw come from the cache, so each distinct
+	  //  character is only rasterized once in each style.
+	  GlyphCache *cache = glyphcache_create (face);
+	  // Composed words are cached as well, so repeated words are 
+	  //  drawn in one operation.
+	  WordCache *words = wordcache_create (WORDCACHE_DEFAULT_CAPACITY);
 	  if (clear)
 	    framebuffer_clear (fb);
 
-	  // Let's work out how wide a single space is in the current face, so we
-	  //  don't have to keep recalculating it.
-	  int space_y;
-	  int space_x; // Pixel width of a space
-	  face_get_string_extent (face, utf32_space, &space_x, &space_y); 
-
-          log_debug ("Obtained a face whose space has height %d px", space_y);
 	  log_debug ("Line spacing is %d px", face_get_line_spacing (face));
+          log_debug ("Drawing in box at %d,%d", init_x, init_y);
+
+	  // Layouts of whole runs of text are cached too, so text that is
+	  //  shown again needs no measuring or line-breaking.
+	  TextContext ctx;
+	  memset (&ctx, 0, sizeof (TextContext));
+	  ctx.surface = framebuffer_get_surface (fb);
+	  ctx.glyphs = cache;
+	  ctx.words = words;
+	  ctx.metrics = fontmetrics_create (cache);
+	  ctx.runs = runcache_create (RUNCACHE_DEFAULT_CAPACITY);
+	  ctx.style = style;
+	  ctx.align = align | valign;
+	  ctx.hyphenator = hyphenator;
+
+	  // The layout of the text that is currently in the box, if any
+	  Layout *shown = NULL;
+
+	  // Glyphs are rendered on worker threads, while text is 
+	  //  drawn on this one. Worker threads open their own copies of
+	  //  the face, to render glyphs in parallel.
+	  ctx.scheduler = scheduler_create (threads);
+	  if (cpus) scheduler_set_affinity (ctx.scheduler, cpus, n_cpus);
+	  glyphcache_set_font_file (cache, ft, ttf_file);
+	  glyphcache_set_scheduler (cache, ctx.scheduler);
+
+	  // In log mode, lines from stdin scroll up the whole screen, 
+	  //  like a console. They are drawn straight to the framebuffer,
+	  //  so that scrolling can pan it.
+	  if (log_mode)
+	    {
+	    if (background) 
+	      log_warning ("Background image is not used in log mode");
+	    run_log (&ctx, fb, init_x);
+	    }
+
+	  // In console mode, stdin is shown on a grid of character cells
+	  //  that fills the screen
+	  else if (console_mode)
+	    {
+	    if (background) 
+	      log_warning ("Background image is not used in console mode");
+	    run_console (&ctx);
+	    }
 
-	  // x and y are the current coordinates of the top-left corner of
-	  //  the bounding box of the text being written, relative to the
-	  //  TL corner of the screen.
-	  int x = init_x;
-	  int y = init_y;
+	  // A background image is decoded once, and the text is drawn 
+	  //  over it off-screen.
+	  else if (background 
+	      && !text_set_background (&ctx, background, dither, &error))
+	    {
+	    fprintf (stderr, "%s\n", error);
+	    free (error);
+	    }
 
-          log_debug ("Starting drawing at %d,%d", x, y);
-	  int line_spacing = face_get_line_spacing (face);
+	  // In batch mode, the boxes and their text all come from stdin,
+	  //  and are laid out on all available CPUs.
+	  else if (batch)
+	    {
+	    run_batch (&ctx);
+	    }
 
-	  // Loop around the remaining arguments to the program, printing
-	  //  each word, followed by a space.
-	  for (int i = optind + 1; i < argc; i++)
+	  // The remaining arguments to the program, if any, are the words
+	  //  of the initial text.
+	  else if (argc - optind >= 2)
 	    {
-	    const char *word = argv[i];
-            log_debug ("Next word is %s", word);
-
-	    // The face_xxx text handling functions take UTF32 character strings
-	    //  as input.
-	    UTF32 *word32 = utf8_to_utf32 ((UTF8 *)word);
-	    
-	    // Get the extent of the bounding box of this word, to see 
-	    //  if it will fit in the specified width.
-	    int x_extent, y_extent;
-	    face_get_string_extent (face, word32, &x_extent, &y_extent); 
-	    int x_advance = x_extent + space_x;
-            log_debug ("Word width is %d px; would advance X position by %d", x_extent, x_advance);
-
-	    // If the text won't fit, move down to the next line
-	    if (x + x_advance > width) 
-	      {
-              log_debug ("Text too large for bonuds -- move to next line");
-	      x = init_x; 
-	      y += line_spacing;
-	      }
-	    // If we're already below the specified height, don't write anything
-	    if (y + line_spacing < init_y + height)
-	      {
-	      face_draw_string_on_fb (face, fb, word32, &x, y);
-	      face_draw_string_on_fb (face, fb, utf32_space, &x, y);
-	      }
-	    free (word32);
+	    char *text = join_args (argc - optind - 1, argv + optind + 1);
+            log_debug ("Text is %s", text);
+	    shown = show_text (&ctx, text, shown, init_x, init_y, 
+	      width, height);
+	    free (text);
 	    }
 
+	  // In stdin mode, each line of input replaces the text in the 
+	  //  box. Only the lines that actually change are redrawn.
+	  if (from_stdin && !batch && !log_mode && !console_mode
+	      && (!background || ctx.background))
+	    {
+	    Utf8Stream *stream = utf8stream_create (STDIN_READ_SIZE);
+	    UTF32 *line;
+	    int len;
+	    while ((line = read_stdin_line (stream, &len)))
+	      shown = show_text32 (&ctx, line, len, shown, init_x, init_y, 
+	        width, height);
+	    utf8stream_destroy (stream);
+	    }
+
+	  // The screen can be saved after drawing, to check the result
+	  if (dump && !dump_screen (fb, dump, &error))
+	    {
+	    fprintf (stderr, "%s\n", error);
+	    free (error);
+	    }
+
+	  if (shown) layout_unref (shown);
+	  scheduler_destroy (ctx.scheduler);
+	  text_free_background (&ctx);
+	  runcache_destroy (ctx.runs);
+	  fontmetrics_destroy (ctx.metrics);
+
+	  wordcache_destroy (words);
+	  glyphcache_destroy (cache);
 	  done_ft (ft);
 	  }
 	else
@@ -636,7 +2123,12 @@ int main (int argc, char **argv)
       }
     }
 
+  hyphenator_destroy (hyphenator);
+  free (cpus);
   free (fbdev);
+  free (background);
+  free (dump);
+  free (patterns);
   return 0;
   }
 
@@ -0,0 +1,242 @@
+/*============================================================================
+
+  normalize.c
+
+  Implementation of the functions defined in normalize.h.
+
+  Text that fails the quick check is converted in the usual three 
+  steps: each character is replaced by its full canonical 
+  decomposition; each run of combining marks is sorted into the order
+  of their combining classes; and then each mark is composed with the
+  starter before it, unless another mark of the same or a higher class
+  is between them. Hangul syllables are decomposed and composed by
+  arithmetic, as the standard describes, rather than from tables.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "defs.h"
+#include "log.h"
+#include "normalize.h"
+#include "normalize_table.h"
+
+// Every character below this is in NFC, and is a starter
+#define NORMALIZE_FIRST_MARK 0x300
+
+#define HANGUL_S_BASE  0xAC00
+#define HANGUL_L_BASE  0x1100
+#define HANGUL_V_BASE  0x1161
+#define HANGUL_T_BASE  0x11A7
+#define HANGUL_L_COUNT 19
+#define HANGUL_V_COUNT 21
+#define HANGUL_T_COUNT 28
+#define HANGUL_N_COUNT (HANGUL_V_COUNT * HANGUL_T_COUNT)
+#define HANGUL_S_COUNT (HANGUL_L_COUNT * HANGUL_N_COUNT)
+
+
+/*==========================================================================
+  normalize_check
+
+  Returns the index of the character from which the text must be
+  converted, or len if it is already in NFC. The character at that 
+  index is a starter that is not changed by normalization, and can't
+  be combined with the character before it, so the text before it
+  is not changed either.
+*==========================================================================*/
+static int normalize_check (const UTF32 *text, int len)
+  {
+  int i = 0;
+  while (i + 4 <= len && (text[i] | text[i + 1] | text[i + 2] 
+       | text[i + 3]) < NORMALIZE_FIRST_MARK)
+    i += 4;
+
+  int stable = i > 0 ? i - 1 : 0;
+  int last_class = 0;
+  for (; i < len; i++)
+    {
+    UTF32 c = text[i];
+    if (c < NORMALIZE_FIRST_MARK)
+      {
+      stable = i;
+      last_class = 0;
+      continue;
+      }
+    int class = combining_class (c);
+    if ((class != 0 && last_class > class) 
+         || nfc_quick_check (c) != NFC_YES)
+      return stable;
+    if (class == 0) stable = i;
+    last_class = class;
+    }
+  return len;
+  }
+
+
+/*==========================================================================
+  normalize_decompose
+
+  Write the full canonical decomposition of c to out, and return the
+  number of characters written, which is at most DECOMPOSITION_MAX.
+*==========================================================================*/
+static int normalize_decompose (UTF32 c, UTF32 *out)
+  {
+  if (c >= HANGUL_S_BASE && c < HANGUL_S_BASE + HANGUL_S_COUNT)
+    {
+    int s = c - HANGUL_S_BASE;
+    out[0] = HANGUL_L_BASE + s / HANGUL_N_COUNT;
+    out[1] = HANGUL_V_BASE + (s % HANGUL_N_COUNT) / HANGUL_T_COUNT;
+    if (s % HANGUL_T_COUNT == 0) return 2;
+    out[2] = HANGUL_T_BASE + s % HANGUL_T_COUNT;
+    return 3;
+    }
+
+  int lo = 0, hi = sizeof (decomposed) / sizeof (decomposed[0]);
+  while (lo < hi)
+    {
+    int mid = (lo + hi) / 2;
+    if (decomposed[mid] < c) 
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  if (lo < (int)(sizeof (decomposed) / sizeof (decomposed[0])) 
+       && decomposed[lo] == c)
+    {
+    int n = decomposition_start[lo + 1] - decomposition_start[lo];
+    memcpy (out, decomposition + decomposition_start[lo], 
+      n * sizeof (UTF32));
+    return n;
+    }
+
+  out[0] = c;
+  return 1;
+  }
+
+
+/*==========================================================================
+  normalize_compose
+*==========================================================================*/
+UTF32 normalize_compose (UTF32 a, UTF32 b)
+  {
+  if (a >= HANGUL_L_BASE && a < HANGUL_L_BASE + HANGUL_L_COUNT
+       && b >= HANGUL_V_BASE && b < HANGUL_V_BASE + HANGUL_V_COUNT)
+    return HANGUL_S_BASE + ((a - HANGUL_L_BASE) * HANGUL_V_COUNT 
+      + b - HANGUL_V_BASE) * HANGUL_T_COUNT;
+  if (a >= HANGUL_S_BASE && a < HANGUL_S_BASE + HANGUL_S_COUNT
+       && (a - HANGUL_S_BASE) % HANGUL_T_COUNT == 0
+       && b > HANGUL_T_BASE && b < HANGUL_T_BASE + HANGUL_T_COUNT)
+    return a + b - HANGUL_T_BASE;
+
+  uint64_t key = ((uint64_t)a << 21) | b;
+  int lo = 0, hi = sizeof (composition_pair) / sizeof (composition_pair[0]);
+  while (lo < hi)
+    {
+    int mid = (lo + hi) / 2;
+    if (composition_pair[mid] < key) 
+      lo = mid + 1;
+    else
+      hi = mid;
+    }
+  if (lo < (int)(sizeof (composition_pair) / sizeof (composition_pair[0]))
+       && composition_pair[lo] == key)
+    return composite[lo];
+  return 0;
+  }
+
+
+/*==========================================================================
+  normalize_reorder
+
+  Sort each run of characters with non-zero combining classes into
+  the order of their classes, keeping characters of the same class in
+  the order they were. The runs are nearly always one or two 
+  characters long, so an insertion sort is fine.
+*==========================================================================*/
+static void normalize_reorder (UTF32 *text, int len)
+  {
+  for (int i = 1; i < len; i++)
+    {
+    UTF32 c = text[i];
+    int class = combining_class (c);
+    if (class == 0) continue;
+    int j = i;
+    while (j > 0 && combining_class (text[j - 1]) > class)
+      {
+      text[j] = text[j - 1];
+      j--;
+      }
+    text[j] = c;
+    }
+  }
+
+
+/*==========================================================================
+  normalize_recompose
+
+  Compose the decomposed, reordered text in place, and return its new
+  length.
+*==========================================================================*/
+static int normalize_recompose (UTF32 *text, int len)
+  {
+  if (len == 0) return 0;
+  int starter = 0;
+  // A mark at the very start of the text has no starter to combine
+  //  with; a class higher than any real one stops it being tried
+  int last_class = combining_class (text[0]) ? 256 : 0;
+  int out = 1;
+  for (int i = 1; i < len; i++)
+    {
+    UTF32 c = text[i];
+    int class = combining_class (c);
+    // The character is blocked from the starter if there is a 
+    //  character between them of the same or a higher class, or if
+    //  it is itself a starter, and they are not next to each other
+    if (last_class < class || last_class == 0)
+      {
+      UTF32 composed = normalize_compose (text[starter], c);
+      if (composed)
+        {
+        text[starter] = composed;
+        continue;
+        }
+      }
+    if (class == 0) starter = out;
+    last_class = class;
+    text[out++] = c;
+    }
+  return out;
+  }
+
+
+/*==========================================================================
+  normalize_nfc
+*==========================================================================*/
+UTF32 *normalize_nfc (UTF32 *text, int *len)
+  {
+  int start = normalize_check (text, *len);
+  if (start == *len) return text;
+
+  int n = *len - start;
+  UTF32 *result = malloc ((start + n * DECOMPOSITION_MAX + 1) 
+    * sizeof (UTF32));
+  memcpy (result, text, start * sizeof (UTF32));
+  UTF32 *out = result + start;
+  int out_len = 0;
+  for (int i = start; i < *len; i++)
+    out_len += normalize_decompose (text[i], out + out_len);
+  normalize_reorder (out, out_len);
+  out_len = normalize_recompose (out, out_len);
+
+  log_debug ("Normalized %d characters from index %d to %d", n, start,
+    out_len);
+  free (text);
+  *len = start + out_len;
+  result[*len] = 0;
+  return result;
+  }
+
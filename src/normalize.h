@@ -0,0 +1,47 @@
+/*============================================================================
+
+  normalize.h
+
+  Functions for converting text to Unicode Normalization Form C (UAX
+  #15), in which an accented letter is, wherever possible, one
+  precomposed character, rather than a letter followed by a combining
+  accent. Fonts usually have a properly-designed glyph for the 
+  precomposed character, which looks better than a letter with an 
+  accent drawn over it, so text is normalized before it is laid out.
+
+  Almost all text is already in NFC, and converting it would be wasted
+  effort, so the text is checked first, using the quick check property
+  of each character. Text in which every character is below U+0300 --
+  that is, all Latin-1 text, and much more -- is always in NFC, and
+  that is checked for first, four characters at a time. Only if the
+  check fails is anything converted, and then only from the last 
+  character before the failure that normalization can't change.
+
+  The properties of each character are found in tables that are 
+  generated, when fbtextdemo is built, from the Unicode Character
+  Database.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+BEGIN_DECLS
+
+/** Convert the *len characters of text, which must have been allocated
+    with malloc() and be zero-terminated, to NFC. If the text is 
+    already in NFC -- as it almost always is -- it is returned 
+    unchanged. Otherwise, it is freed, like the memory passed to 
+    realloc(), and a new, zero-terminated string is returned, which
+    the caller must free, and *len is set to its length. */
+UTF32           *normalize_nfc (UTF32 *text, int *len);
+
+/** Returns the precomposed character that is the NFC form of 
+    character a followed by b, or 0 if there isn't one. */
+UTF32            normalize_compose (UTF32 a, UTF32 b);
+
+END_DECLS
+
@@ -0,0 +1,151 @@
+/*============================================================================
+
+  ringqueue.c
+
+  Implementation of the "methods" defined in ringqueue.h.
+
+  This is the well-known bounded queue of Dmitry Vyukov. Each slot in
+  the ring buffer has a sequence number, which says whether the slot
+  is ready to be written or read in the current lap of the ring. 
+  A pusher claims a slot by advancing the tail with a compare-and-swap,
+  writes the item, and then publishes it by updating the sequence
+  number; a popper does the same at the head. So producers only 
+  contend with each other over the tail, consumers over the head, 
+  and a producer and consumer never touch the same counter. 
+
+  The head and tail are kept in separate cache lines, so that 
+  producers and consumers don't slow each other down by fighting over
+  the line.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include "defs.h"
+#include "log.h"
+#include "ringqueue.h"
+
+// Size of a cache line on every CPU we're likely to run on
+#define RINGQUEUE_LINE 64
+
+typedef struct _RingSlot
+  {
+  size_t seq; // Sequence number, which says who may use the slot next
+  void *item;
+  } RingSlot;
+
+struct _RingQueue
+  {
+  RingSlot *slots;
+  size_t mask; // Number of slots, minus one -- the number is a power of two
+  char pad1 [RINGQUEUE_LINE];
+  size_t tail; // Position of the next push
+  char pad2 [RINGQUEUE_LINE];
+  size_t head; // Position of the next pop
+  char pad3 [RINGQUEUE_LINE];
+  };
+
+
+/*==========================================================================
+  ringqueue_create
+*==========================================================================*/
+RingQueue *ringqueue_create (int capacity)
+  {
+  LOG_IN
+  RingQueue *self = malloc (sizeof (RingQueue));
+  memset (self, 0, sizeof (RingQueue));
+  size_t size = 2;
+  while (size < (size_t)capacity) size *= 2;
+  self->slots = malloc (size * sizeof (RingSlot));
+  for (size_t i = 0; i < size; i++)
+    {
+    self->slots[i].seq = i;
+    self->slots[i].item = NULL;
+    }
+  self->mask = size - 1;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  ringqueue_destroy
+*==========================================================================*/
+void ringqueue_destroy (RingQueue *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    free (self->slots);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  ringqueue_push
+*==========================================================================*/
+BOOL ringqueue_push (RingQueue *self, void *item)
+  {
+  size_t pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+  for (;;)
+    {
+    RingSlot *slot = &self->slots[pos & self->mask];
+    size_t seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0)
+      {
+      // The slot is free in this lap -- try to claim it
+      if (__atomic_compare_exchange_n (&self->tail, &pos, pos + 1, TRUE,
+           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+        slot->item = item;
+        __atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return TRUE;
+        }
+      // Another thread got there first; pos now holds the new tail
+      }
+    else if (diff < 0)
+      return FALSE; // The slot still holds an item from the last lap
+    else
+      pos = __atomic_load_n (&self->tail, __ATOMIC_RELAXED);
+    }
+  }
+
+
+/*==========================================================================
+  ringqueue_pop
+*==========================================================================*/
+void *ringqueue_pop (RingQueue *self)
+  {
+  size_t pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+  for (;;)
+    {
+    RingSlot *slot = &self->slots[pos & self->mask];
+    size_t seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0)
+      {
+      if (__atomic_compare_exchange_n (&self->head, &pos, pos + 1, TRUE,
+           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+        void *item = slot->item;
+        // Free the slot for the next lap of the ring
+        __atomic_store_n (&slot->seq, pos + self->mask + 1, 
+          __ATOMIC_RELEASE);
+        return item;
+        }
+      }
+    else if (diff < 0)
+      return NULL; // Nothing has been pushed into this slot yet
+    else
+      pos = __atomic_load_n (&self->head, __ATOMIC_RELAXED);
+    }
+  }
+
@@ -0,0 +1,50 @@
+/*============================================================================
+
+  ringqueue.h
+
+  A "class" that passes pointers from one set of threads to another,
+  in first-in, first-out order, without locks. Any number of threads
+  can push and pop at the same time. The queue has a fixed capacity,
+  set when it is created; pushing to a full queue fails, rather than
+  blocking, as does popping from an empty one. Neither operation ever
+  sleeps, so the queue suits stages of work that run alongside each 
+  other, with the consumer doing something useful when there is 
+  nothing to pop.
+
+  The usual sequence of operations is
+  ringqueue_create
+  ringqueue_push and ringqueue_pop (probably many times, on many threads)
+  ringqueue_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _RingQueue;
+typedef struct _RingQueue RingQueue;
+
+BEGIN_DECLS
+
+/** Create an empty queue that can hold at least capacity items. This
+    method always succeeds, and must eventually be followed by a 
+    call to ringqueue_destroy(). */
+RingQueue       *ringqueue_create (int capacity);
+
+/** Free the queue. Any items still in it are not freed. */
+void             ringqueue_destroy (RingQueue *self);
+
+/** Add an item, which must not be NULL, to the tail of the queue. 
+    Returns FALSE if the queue is full. Everything the pushing thread
+    wrote before the push is visible to the thread that pops the item. */
+BOOL             ringqueue_push (RingQueue *self, void *item);
+
+/** Remove the item at the head of the queue, returning NULL if 
+    the queue is empty. */
+void            *ringqueue_pop (RingQueue *self);
+
+END_DECLS
+
@@ -0,0 +1,250 @@
+/*============================================================================
+
+  runcache.c
+
+  Implementation of the "methods" defined in runcache.h.
+
+  This is organized in the same way as the word cache: a hash table
+  for lookup, and a doubly-linked list in order of use for eviction.
+  The key is the text together with the box size, the style, and the
+  face and its pixel size.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include "defs.h"
+#include "log.h"
+#include "runcache.h"
+
+typedef struct _RunCacheEntry
+  {
+  Layout *layout; // The layout, which holds the text, box and style
+  FT_Face face; // The face the text was laid out with
+  int size; // The pixel size of the face
+  unsigned int hash;
+  struct _RunCacheEntry *hash_next;
+  struct _RunCacheEntry *lru_prev;
+  struct _RunCacheEntry *lru_next;
+  } RunCacheEntry;
+
+struct _RunCache
+  {
+  int capacity;
+  int count;
+  int n_buckets; // Size of the hash table -- a power of two
+  RunCacheEntry **buckets;
+  RunCacheEntry *lru_head;
+  RunCacheEntry *lru_tail;
+  int hits;
+  int misses;
+  };
+
+
+/*==========================================================================
+  runcache_hash
+
+  FNV-1a hash of the text and its layout parameters
+
+*==========================================================================*/
+static unsigned int runcache_hash (const UTF32 *s, int len, FT_Face face,
+      int size, int width, int height, int style, int align)
+  {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < len; i++)
+    {
+    h ^= (uint32_t)s[i];
+    h *= 16777619u;
+    }
+  uint32_t params[6] = { (uint32_t)(uintptr_t)face, size, width,
+    height, style, align };
+  for (int i = 0; i < 6; i++)
+    {
+    h ^= params[i];
+    h *= 16777619u;
+    }
+  return h;
+  }
+
+
+/*==========================================================================
+  runcache_create
+*==========================================================================*/
+RunCache *runcache_create (int capacity)
+  {
+  LOG_IN
+  RunCache *self = malloc (sizeof (RunCache));
+  memset (self, 0, sizeof (RunCache));
+  self->capacity = capacity > 0 ? capacity : RUNCACHE_DEFAULT_CAPACITY;
+  self->n_buckets = 16;
+  while (self->n_buckets < self->capacity * 2) self->n_buckets *= 2;
+  self->buckets = calloc (self->n_buckets, sizeof (RunCacheEntry *));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  runcache_destroy
+*==========================================================================*/
+void runcache_destroy (RunCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    log_debug ("Run cache: %d hits, %d misses", self->hits, self->misses);
+    RunCacheEntry *e = self->lru_head;
+    while (e)
+      {
+      RunCacheEntry *next = e->lru_next;
+      layout_unref (e->layout);
+      free (e);
+      e = next;
+      }
+    free (self->buckets);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  runcache_unlink_lru
+*==========================================================================*/
+static void runcache_unlink_lru (RunCache *self, RunCacheEntry *e)
+  {
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    self->lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    self->lru_tail = e->lru_prev;
+  e->lru_prev = NULL;
+  e->lru_next = NULL;
+  }
+
+
+/*==========================================================================
+  runcache_push_lru
+*==========================================================================*/
+static void runcache_push_lru (RunCache *self, RunCacheEntry *e)
+  {
+  e->lru_prev = NULL;
+  e->lru_next = self->lru_head;
+  if (self->lru_head) self->lru_head->lru_prev = e;
+  self->lru_head = e;
+  if (!self->lru_tail) self->lru_tail = e;
+  }
+
+
+/*==========================================================================
+  runcache_evict
+*==========================================================================*/
+static void runcache_evict (RunCache *self)
+  {
+  RunCacheEntry *e = self->lru_tail;
+  if (!e) return;
+  runcache_unlink_lru (self, e);
+  RunCacheEntry **p = &self->buckets[e->hash & (self->n_buckets - 1)];
+  while (*p != e) p = &(*p)->hash_next;
+  *p = e->hash_next;
+  layout_unref (e->layout);
+  free (e);
+  self->count--;
+  }
+
+
+/*==========================================================================
+  runcache_lookup
+*==========================================================================*/
+Layout *runcache_lookup (RunCache *self, const FontMetrics *metrics,
+      const UTF32 *text, int len, int width, int height, int style,
+      int align, const Hyphenator *hyphenator)
+  {
+  FT_Face face = glyphcache_get_face (fontmetrics_get_glyphcache (metrics));
+  int size = face->size->metrics.y_ppem;
+  unsigned int h = runcache_hash (text, len, face, size, width,
+    height, style, align);
+
+  for (RunCacheEntry *e = self->buckets[h & (self->n_buckets - 1)]; e; 
+       e = e->hash_next)
+    {
+    Layout *l = e->layout;
+    if (e->hash == h && l->len == len && e->face == face
+        && e->size == size && l->width == width && l->height == height
+        && l->style == style && l->align == align
+        && l->hyphenator == hyphenator
+        && memcmp (l->text, text, len * sizeof (UTF32)) == 0)
+      {
+      self->hits++;
+      if (e != self->lru_head)
+        {
+        runcache_unlink_lru (self, e);
+        runcache_push_lru (self, e);
+        }
+      return l;
+      }
+    }
+
+  self->misses++;
+  return NULL;
+  }
+
+
+/*==========================================================================
+  runcache_insert
+*==========================================================================*/
+void runcache_insert (RunCache *self, const FontMetrics *metrics,
+      Layout *layout)
+  {
+  if (self->count >= self->capacity) runcache_evict (self);
+
+  FT_Face face = glyphcache_get_face (fontmetrics_get_glyphcache (metrics));
+  RunCacheEntry *e = malloc (sizeof (RunCacheEntry));
+  memset (e, 0, sizeof (RunCacheEntry));
+  e->layout = layout_ref (layout);
+  e->face = face;
+  e->size = face->size->metrics.y_ppem;
+  e->hash = runcache_hash (layout->text, layout->len, face, e->size, 
+    layout->width, layout->height, layout->style, layout->align);
+  RunCacheEntry **bucket = &self->buckets[e->hash & (self->n_buckets - 1)];
+  e->hash_next = *bucket;
+  *bucket = e;
+  runcache_push_lru (self, e);
+  self->count++;
+  }
+
+
+/*==========================================================================
+  runcache_get
+*==========================================================================*/
+Layout *runcache_get (RunCache *self, FontMetrics *metrics,
+      const UTF32 *text, int len, int width, int height, int style,
+      int align, const Hyphenator *hyphenator)
+  {
+  Layout *layout = runcache_lookup (self, metrics, text, len, width, 
+    height, style, align, hyphenator);
+  if (!layout)
+    {
+    fontmetrics_prepare (metrics, text, len, style);
+    if (hyphenator)
+      {
+      static const UTF32 hyphen = LAYOUT_HYPHEN;
+      fontmetrics_prepare (metrics, &hyphen, 1, style);
+      }
+    layout = layout_create (metrics, text, len, width, height, style,
+      align, hyphenator);
+    runcache_insert (self, metrics, layout);
+    // The cache now holds the only reference we need
+    layout_unref (layout);
+    }
+  return layout;
+  }
+
@@ -0,0 +1,72 @@
+/*============================================================================
+
+  runcache.h
+
+  A "class" that keeps the layouts of whole runs of text, so that text
+  that is displayed repeatedly -- as it often is on a dashboard -- does
+  not have to be measured and broken into lines every time.
+
+  The cache holds a fixed maximum number of layouts; when it is full,
+  the least-recently-used layout is discarded.
+
+  The usual sequence of operations is
+  runcache_create
+  runcache_get (probably many times)
+  runcache_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "fontmetrics.h"
+#include "layout.h"
+
+// The number of layouts to keep, if the caller doesn't care
+#define RUNCACHE_DEFAULT_CAPACITY 1024
+
+struct _RunCache;
+typedef struct _RunCache RunCache;
+
+BEGIN_DECLS
+
+/** Create a new, empty cache that will hold at most capacity layouts.
+    This method always succeeds, and must eventually be followed by a
+    call to runcache_destroy(). */
+RunCache        *runcache_create (int capacity);
+
+/** Free the cache, and drop its references to the cached layouts. */
+void             runcache_destroy (RunCache *self);
+
+/** Get the layout of len characters of text, in a box of the specified
+    size, style, and alignment, hyphenated with hyphenator, which may be
+    NULL. If there is no matching layout in the cache,
+    the metrics are prepared for the text, and a new layout is 
+    created with layout_create(). The layout remains owned
+    by the cache, and may be freed by the next call to runcache_get()
+    or runcache_insert(); a caller that needs to keep it for longer 
+    should use layout_ref(). */
+Layout          *runcache_get (RunCache *self, FontMetrics *metrics,
+                    const UTF32 *text, int len, int width, int height,
+                    int style, int align, const Hyphenator *hyphenator);
+
+/** Look for a matching layout in the cache, returning NULL if there
+    isn't one. This is for callers that want to create layouts 
+    themselves -- perhaps on other threads -- and then add them with
+    runcache_insert(). The same lifetime rules as runcache_get() 
+    apply to the result. */
+Layout          *runcache_lookup (RunCache *self, const FontMetrics *metrics,
+                    const UTF32 *text, int len, int width, int height,
+                    int style, int align, const Hyphenator *hyphenator);
+
+/** Add a layout, which must have been created with the same metrics, 
+    to the cache. The cache takes its own reference to the layout. The 
+    caller should already have established that no matching layout is
+    in the cache. */
+void             runcache_insert (RunCache *self, const FontMetrics *metrics,
+                    Layout *layout);
+
+END_DECLS
+
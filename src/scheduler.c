@@ -0,0 +1,383 @@
+/*============================================================================
+
+  scheduler.c
+
+  Implementation of the "methods" defined in scheduler.h.
+
+  There is one work queue for each worker thread, and one more for
+  threads that are not workers (usually the main thread). Each queue
+  is a double-ended ring buffer, protected by its own mutex. The owner
+  of a queue pushes and pops tasks at the tail, so it works on its
+  most recent, and probably cache-hot, task first; other threads steal
+  from the head, taking the oldest task, which is likely to be the
+  largest piece of outstanding work. Because each queue has its own
+  lock, and owners rarely meet thieves, contention is low.
+
+  Idle workers sleep on a condition variable, rather than spinning,
+  so an idle scheduler costs nothing.
+
+  All the parallel stages of the program -- rasterizing glyphs, laying
+  out text, and blitting bands of the screen -- share one scheduler,
+  so they never compete with one another for CPUs.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "defs.h"
+#include "log.h"
+#include "scheduler.h"
+
+// Initial size of each queue -- must be a power of two
+#define SCHEDULER_QUEUE_SIZE 64
+
+typedef struct _SchedulerJob
+  {
+  SchedulerTask task;
+  void *arg;
+  } SchedulerJob;
+
+typedef struct _WorkQueue
+  {
+  pthread_mutex_t lock;
+  SchedulerJob *jobs; // Ring buffer of jobs
+  int size; // Size of the ring buffer -- a power of two
+  int head; // Index of the oldest job
+  int count; // Number of jobs in the queue
+  } WorkQueue;
+
+typedef struct _Worker
+  {
+  Scheduler *scheduler;
+  int index; // Index of this worker's queue
+  pthread_t thread;
+  } Worker;
+
+struct _Scheduler
+  {
+  int n_threads; // Number of worker threads actually running
+  Worker *workers;
+  WorkQueue *queues; // n_threads + 1 queues
+  int n_queues;
+  pthread_mutex_t lock; // Protects sleeping and waking
+  pthread_cond_t work_cond; // Signalled when a job is submitted
+  pthread_cond_t done_cond; // Signalled when all jobs have finished
+  int queued; // Jobs in all queues -- updated atomically
+  int pending; // Jobs submitted but not finished -- updated atomically
+  BOOL quit;
+  };
+
+// The worker the current thread is, if it is a worker
+static __thread Worker *scheduler_self = NULL;
+
+
+/*==========================================================================
+  workqueue_init
+*==========================================================================*/
+static void workqueue_init (WorkQueue *q)
+  {
+  pthread_mutex_init (&q->lock, NULL);
+  q->size = SCHEDULER_QUEUE_SIZE;
+  q->jobs = malloc (q->size * sizeof (SchedulerJob));
+  q->head = 0;
+  q->count = 0;
+  }
+
+
+/*==========================================================================
+  workqueue_push
+
+  Add a job at the tail of the queue, growing it if necessary
+
+*==========================================================================*/
+static void workqueue_push (WorkQueue *q, SchedulerTask task, void *arg)
+  {
+  pthread_mutex_lock (&q->lock);
+  if (q->count == q->size)
+    {
+    SchedulerJob *jobs = malloc (q->size * 2 * sizeof (SchedulerJob));
+    for (int i = 0; i < q->count; i++)
+      jobs[i] = q->jobs[(q->head + i) & (q->size - 1)];
+    free (q->jobs);
+    q->jobs = jobs;
+    q->head = 0;
+    q->size *= 2;
+    }
+  SchedulerJob *job = &q->jobs[(q->head + q->count) & (q->size - 1)];
+  job->task = task;
+  job->arg = arg;
+  q->count++;
+  pthread_mutex_unlock (&q->lock);
+  }
+
+
+/*==========================================================================
+  workqueue_take
+
+  Take a job from the tail of the queue (if we own it) or the head
+  (if we're stealing). Returns FALSE if the queue is empty.
+
+*==========================================================================*/
+static BOOL workqueue_take (WorkQueue *q, BOOL steal, SchedulerJob *job)
+  {
+  BOOL ret = FALSE;
+  pthread_mutex_lock (&q->lock);
+  if (q->count > 0)
+    {
+    if (steal)
+      {
+      *job = q->jobs[q->head];
+      q->head = (q->head + 1) & (q->size - 1);
+      }
+    else
+      *job = q->jobs[(q->head + q->count - 1) & (q->size - 1)];
+    q->count--;
+    ret = TRUE;
+    }
+  pthread_mutex_unlock (&q->lock);
+  return ret;
+  }
+
+
+/*==========================================================================
+  scheduler_my_queue
+
+  Get the index of the queue that the current thread owns
+
+*==========================================================================*/
+static int scheduler_my_queue (const Scheduler *self)
+  {
+  if (scheduler_self && scheduler_self->scheduler == self)
+    return scheduler_self->index;
+  return self->n_queues - 1;
+  }
+
+
+/*==========================================================================
+  scheduler_run_one
+
+  Run one job, from our own queue if possible, or stolen from another
+  queue if not. Returns FALSE if there was nothing to run. If oldest
+  is TRUE, we take the oldest job from our own queue, rather than the
+  newest.
+
+*==========================================================================*/
+static BOOL scheduler_run_one (Scheduler *self, int me, BOOL oldest)
+  {
+  SchedulerJob job;
+  BOOL found = workqueue_take (&self->queues[me], oldest, &job);
+  for (int i = 1; !found && i < self->n_queues; i++)
+    found = workqueue_take (&self->queues[(me + i) % self->n_queues],
+      TRUE, &job);
+  if (!found) return FALSE;
+
+  __atomic_sub_fetch (&self->queued, 1, __ATOMIC_SEQ_CST);
+  job.task (job.arg);
+  if (__atomic_sub_fetch (&self->pending, 1, __ATOMIC_SEQ_CST) == 0)
+    {
+    pthread_mutex_lock (&self->lock);
+    pthread_cond_broadcast (&self->done_cond);
+    pthread_mutex_unlock (&self->lock);
+    }
+  return TRUE;
+  }
+
+
+/*==========================================================================
+  scheduler_worker_main
+*==========================================================================*/
+static void *scheduler_worker_main (void *arg)
+  {
+  Worker *worker = arg;
+  Scheduler *self = worker->scheduler;
+  scheduler_self = worker;
+  for (;;)
+    {
+    if (scheduler_run_one (self, worker->index, FALSE)) continue;
+    pthread_mutex_lock (&self->lock);
+    while (__atomic_load_n (&self->queued, __ATOMIC_SEQ_CST) == 0
+        && !self->quit)
+      pthread_cond_wait (&self->work_cond, &self->lock);
+    BOOL quit = self->quit
+      && __atomic_load_n (&self->queued, __ATOMIC_SEQ_CST) == 0;
+    pthread_mutex_unlock (&self->lock);
+    if (quit) break;
+    }
+  return NULL;
+  }
+
+
+/*==========================================================================
+  scheduler_create
+*==========================================================================*/
+Scheduler *scheduler_create (int n_threads)
+  {
+  LOG_IN
+  if (n_threads <= 0) n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n_threads <= 0) n_threads = 1;
+
+  Scheduler *self = malloc (sizeof (Scheduler));
+  memset (self, 0, sizeof (Scheduler));
+  pthread_mutex_init (&self->lock, NULL);
+  pthread_cond_init (&self->work_cond, NULL);
+  pthread_cond_init (&self->done_cond, NULL);
+  self->n_queues = n_threads + 1;
+  self->queues = malloc (self->n_queues * sizeof (WorkQueue));
+  for (int i = 0; i < self->n_queues; i++)
+    workqueue_init (&self->queues[i]);
+
+  // If we can't start all the workers, the queues of the missing ones
+  //  will still be emptied by stealing.
+  self->workers = malloc (n_threads * sizeof (Worker));
+  for (int i = 0; i < n_threads; i++)
+    {
+    Worker *w = &self->workers[i];
+    w->scheduler = self;
+    w->index = i;
+    if (pthread_create (&w->thread, NULL, scheduler_worker_main, w) != 0)
+      {
+      log_warning ("Can't start worker thread %d", i);
+      break;
+      }
+    self->n_threads++;
+    }
+  log_debug ("Scheduler started %d threads", self->n_threads);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  scheduler_destroy
+*==========================================================================*/
+void scheduler_destroy (Scheduler *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    scheduler_wait (self);
+    pthread_mutex_lock (&self->lock);
+    self->quit = TRUE;
+    pthread_cond_broadcast (&self->work_cond);
+    pthread_mutex_unlock (&self->lock);
+    for (int i = 0; i < self->n_threads; i++)
+      pthread_join (self->workers[i].thread, NULL);
+    for (int i = 0; i < self->n_queues; i++)
+      {
+      pthread_mutex_destroy (&self->queues[i].lock);
+      free (self->queues[i].jobs);
+      }
+    pthread_cond_destroy (&self->work_cond);
+    pthread_cond_destroy (&self->done_cond);
+    pthread_mutex_destroy (&self->lock);
+    free (self->queues);
+    free (self->workers);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  scheduler_submit
+*==========================================================================*/
+void scheduler_submit (Scheduler *self, SchedulerTask task, void *arg)
+  {
+  __atomic_add_fetch (&self->pending, 1, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch (&self->queued, 1, __ATOMIC_SEQ_CST);
+  workqueue_push (&self->queues[scheduler_my_queue (self)], task, arg);
+  // Workers check 'queued' while holding the lock, so taking it here
+  //  ensures that a worker that is just going to sleep sees the signal
+  pthread_mutex_lock (&self->lock);
+  pthread_cond_signal (&self->work_cond);
+  pthread_mutex_unlock (&self->lock);
+  }
+
+
+/*==========================================================================
+  scheduler_wait
+*==========================================================================*/
+void scheduler_wait (Scheduler *self)
+  {
+  int me = scheduler_my_queue (self);
+  while (__atomic_load_n (&self->pending, __ATOMIC_SEQ_CST) > 0)
+    {
+    if (scheduler_run_one (self, me, FALSE)) continue;
+    // Nothing left to steal, but some jobs are still running
+    pthread_mutex_lock (&self->lock);
+    while (__atomic_load_n (&self->pending, __ATOMIC_SEQ_CST) > 0
+        && __atomic_load_n (&self->queued, __ATOMIC_SEQ_CST) == 0)
+      pthread_cond_wait (&self->done_cond, &self->lock);
+    pthread_mutex_unlock (&self->lock);
+    }
+  }
+
+
+/*==========================================================================
+  scheduler_help
+
+  A thread that calls this is usually waiting for the results of the
+  tasks it submitted, in the order it submitted them, so it takes the
+  oldest task first.
+
+*==========================================================================*/
+BOOL scheduler_help (Scheduler *self)
+  {
+  return scheduler_run_one (self, scheduler_my_queue (self), TRUE);
+  }
+
+
+/*==========================================================================
+  scheduler_get_threads
+*==========================================================================*/
+int scheduler_get_threads (const Scheduler *self)
+  {
+  return self->n_threads;
+  }
+
+
+
+/*==========================================================================
+  scheduler_current_worker
+*==========================================================================*/
+int scheduler_current_worker (const Scheduler *self)
+  {
+  if (scheduler_self && scheduler_self->scheduler == self)
+    return scheduler_self->index;
+  return -1;
+  }
+
+
+/*==========================================================================
+  scheduler_set_affinity
+*==========================================================================*/
+BOOL scheduler_set_affinity (Scheduler *self, const int *cpus, int n_cpus)
+  {
+  BOOL ret = TRUE;
+  if (n_cpus <= 0) return ret;
+  for (int i = 0; i < self->n_threads; i++)
+    {
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    CPU_SET (cpus[i % n_cpus], &set);
+    int err = pthread_setaffinity_np (self->workers[i].thread, 
+      sizeof (cpu_set_t), &set);
+    if (err != 0)
+      {
+      log_warning ("Can't bind thread %d to CPU %d: %s", i, 
+        cpus[i % n_cpus], strerror (err));
+      ret = FALSE;
+      }
+    else
+      log_debug ("Bound thread %d to CPU %d", i, cpus[i % n_cpus]);
+    }
+  return ret;
+  }
+
@@ -0,0 +1,83 @@
+/*============================================================================
+
+  scheduler.h
+
+  A "class" that runs tasks on a pool of worker threads. Each worker
+  has its own queue of tasks; a worker that runs out of tasks steals
+  them from the other workers' queues, so the load balances itself
+  even when tasks take very different amounts of time.
+
+  The thread that submits tasks also runs them while it is waiting
+  for them to finish, so a scheduler with no worker threads at all
+  is valid, and simply runs everything in scheduler_wait().
+
+  The usual sequence of operations is
+  scheduler_create
+  scheduler_submit (probably many times)
+  scheduler_wait
+  (more submits and waits)
+  scheduler_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+struct _Scheduler;
+typedef struct _Scheduler Scheduler;
+
+/** A task function. It is called once, on some thread, with the
+    argument given to scheduler_submit(). */
+typedef void (*SchedulerTask)(void *arg);
+
+BEGIN_DECLS
+
+/** Create a scheduler with the specified number of worker threads.
+    If n_threads is zero or negative, one thread is created for each
+    online CPU. The threads are started immediately, and wait for
+    work. This method always succeeds, although it might create fewer
+    threads than requested if the system is short of resources. */
+Scheduler       *scheduler_create (int n_threads);
+
+/** Stop the worker threads and free the scheduler. Any tasks that
+    have been submitted, but not waited for, are run first. */
+void             scheduler_destroy (Scheduler *self);
+
+/** Submit a task to be run on some thread. This method can be called
+    from any thread, including from a task that is running. */
+void             scheduler_submit (Scheduler *self, SchedulerTask task,
+                    void *arg);
+
+/** Wait until all the tasks that have been submitted have finished,
+    helping to run them in the meantime. This must not be called 
+    from a task, because the task itself would never finish. */
+void             scheduler_wait (Scheduler *self);
+
+/** Run one task that has been submitted but not started, if there is
+    one, on the calling thread. Returns FALSE if there was no such task.
+    This is for a thread that is waiting for something other than 
+    scheduler_wait() -- results to arrive in a queue, for example -- and
+    would otherwise be idle. Like scheduler_wait(), it must not be 
+    called from a task. */
+BOOL             scheduler_help (Scheduler *self);
+
+/** Get the number of worker threads. */
+int              scheduler_get_threads (const Scheduler *self);
+
+/** Get the index, from zero, of the worker thread that is calling this
+    method, or -1 if the caller is not one of this scheduler's workers.
+    This is useful for tasks that need per-thread resources. */
+int              scheduler_current_worker (const Scheduler *self);
+
+/** Bind the worker threads to specific CPUs. Worker i is bound to 
+    cpus[i % n_cpus], so there can be more workers than CPUs. Returns
+    FALSE, with a warning logged, if any thread could not be bound --
+    usually because a CPU number is out of range. */
+BOOL             scheduler_set_affinity (Scheduler *self, const int *cpus,
+                    int n_cpus);
+
+END_DECLS
+
@@ -0,0 +1,201 @@
+/*============================================================================
+
+  scroller.c
+
+  Implementation of the "methods" defined in scroller.h.
+
+  When panning, the framebuffer's memory is used as a ring of lines.
+  The screen shows the rows from 'top' to 'top + height'. A new line
+  is drawn in the memory just below the screen, and the display is 
+  panned down by one line to show it, so scrolling costs as much as 
+  drawing one line, whatever the size of the screen. When there is no
+  more memory below the screen, the lines that will stay on the 
+  screen are copied to the top of the memory, the new line is drawn
+  below them, and the display is panned back to the top. That one copy
+  of a screenful is spread over all the lines that fit in the memory 
+  below the screen -- about a screenful of them, even if the driver 
+  only provides two pages.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "scroller.h"
+
+struct _Scroller
+  {
+  FrameBuffer *fb;
+  Surface *line; // The surface returned by scroller_next_line()
+  int line_height;
+  int rows; // Number of whole lines that fit on the screen
+  int used; // Number of lines drawn on the screen so far
+  int x; // Left edge of the screen in the framebuffer's memory
+  int top; // Top of the screen in the framebuffer's memory
+  int next_top; // Where the top will be when the new line is shown
+  BOOL pan; // TRUE if scrolling is done by panning
+  int lines; // Number of lines scrolled, for logging
+  int copies; // Number of times the screen was copied, for logging
+  };
+
+
+/*==========================================================================
+  scroller_move_rows
+
+  Copy n rows of the screen's width, within the framebuffer's memory, 
+  in whichever order is safe if the source and destination overlap
+
+*==========================================================================*/
+static void scroller_move_rows (Scroller *self, int dest_y, int src_y, 
+      int n)
+  {
+  Surface *memory = framebuffer_get_virtual_surface (self->fb);
+  int width = framebuffer_get_width (self->fb);
+  if (dest_y < src_y)
+    {
+    for (int i = 0; i < n; i++)
+      surface_blit (memory, self->x, dest_y + i, memory, self->x, 
+        src_y + i, width, 1);
+    }
+  else if (dest_y > src_y)
+    {
+    for (int i = n - 1; i >= 0; i--)
+      surface_blit (memory, self->x, dest_y + i, memory, self->x, 
+        src_y + i, width, 1);
+    }
+  self->copies++;
+  }
+
+
+/*==========================================================================
+  scroller_create
+*==========================================================================*/
+Scroller *scroller_create (FrameBuffer *fb, int line_height)
+  {
+  LOG_IN
+  Scroller *self = malloc (sizeof (Scroller));
+  memset (self, 0, sizeof (Scroller));
+  self->fb = fb;
+  Surface *screen = framebuffer_get_surface (fb);
+  Surface *memory = framebuffer_get_virtual_surface (fb);
+  self->line_height = line_height > 0 ? line_height : 1;
+  self->rows = screen->height / self->line_height;
+  if (self->rows < 1) self->rows = 1;
+  framebuffer_get_offset (fb, &self->x, &self->top);
+  self->next_top = self->top;
+
+  // Panning to where the display already is tells us whether the
+  //  driver can pan at all
+  self->pan = memory->height >= screen->height + self->line_height
+    && framebuffer_pan (fb, self->x, self->top);
+  log_debug ("Scrolling %d lines of %d px by %s", self->rows, 
+    self->line_height, self->pan ? "panning" : "copying");
+
+  self->line = surface_create_for_data (memory->data, screen->width, 
+    self->line_height, memory->stride, memory->format);
+  surface_clear (screen);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  scroller_destroy
+*==========================================================================*/
+void scroller_destroy (Scroller *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    log_debug ("Scrolled %d lines, with %d copies", self->lines, 
+      self->copies);
+    surface_destroy (self->line);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  scroller_next_line
+*==========================================================================*/
+Surface *scroller_next_line (Scroller *self)
+  {
+  Surface *memory = framebuffer_get_virtual_surface (self->fb);
+  int height = framebuffer_get_height (self->fb);
+  int h = self->line_height;
+  int y;
+
+  if (self->used < self->rows)
+    {
+    // The screen isn't full yet
+    y = self->top + self->used * h;
+    self->used++;
+    self->next_top = self->top;
+    }
+  else if (self->pan)
+    {
+    self->next_top = self->top + h;
+    if (self->next_top + height > memory->height)
+      {
+      // Wrap round to the top of the memory
+      scroller_move_rows (self, 0, self->top + h, (self->rows - 1) * h);
+      self->next_top = 0;
+      }
+    y = self->next_top + (self->rows - 1) * h;
+    }
+  else
+    {
+    scroller_move_rows (self, self->top, self->top + h, 
+      (self->rows - 1) * h);
+    y = self->top + (self->rows - 1) * h;
+    }
+
+  // Clear the new line and, once the screen is scrolling, anything 
+  //  below it that will be on the screen -- there is usually a part of
+  //  a line left over at the bottom
+  int bottom = y + h;
+  if (self->used == self->rows)
+    bottom = self->next_top + height;
+  surface_fill_rect (memory, self->x, y, self->line->width, bottom - y, 
+    0, 0, 0);
+  self->line->data = memory->data + y * memory->stride 
+    + self->x * memory->bytes_per_pixel;
+  return self->line;
+  }
+
+
+/*==========================================================================
+  scroller_show
+*==========================================================================*/
+void scroller_show (Scroller *self)
+  {
+  self->lines++;
+  if (self->next_top == self->top) return;
+  if (framebuffer_pan (self->fb, self->x, self->next_top))
+    self->top = self->next_top;
+  else
+    {
+    // Carry on by copying, starting with what should be on the screen
+    log_warning ("Can't pan the display -- scrolling by copying");
+    scroller_move_rows (self, self->top, self->next_top, 
+      framebuffer_get_height (self->fb));
+    self->pan = FALSE;
+    self->next_top = self->top;
+    }
+  }
+
+
+/*==========================================================================
+  scroller_get_rows
+*==========================================================================*/
+int scroller_get_rows (const Scroller *self)
+  {
+  return self->rows;
+  }
+
@@ -0,0 +1,58 @@
+/*============================================================================
+
+  scroller.h
+
+  A "class" that scrolls lines of text up the whole screen, like a 
+  console. If the framebuffer's memory is taller than the screen, 
+  scrolling is done by panning the display down through the memory, 
+  which copies no pixels at all: each new line is drawn just below
+  the visible part, and then the display moves down to show it. Only
+  when the bottom of the memory is reached are the lines on the 
+  screen copied back to the top, once. If the driver can't pan, the
+  screen is scrolled by copying instead.
+
+  The usual sequence of operations is
+  scroller_create
+  scroller_next_line, draw the line, scroller_show (probably many times)
+  scroller_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "framebuffer.h"
+
+struct _Scroller;
+typedef struct _Scroller Scroller;
+
+BEGIN_DECLS
+
+/** Create a scroller for the framebuffer, which must be initialized, 
+    with lines of the specified height in pixels. The screen is
+    cleared. This method always succeeds, and must eventually be 
+    followed by a call to scroller_destroy(). */
+Scroller        *scroller_create (FrameBuffer *fb, int line_height);
+
+/** Free the scroller. What is on the screen stays there. */
+void             scroller_destroy (Scroller *self);
+
+/** Make room for a new line at the bottom of the screen, and get a 
+    surface, the width of the screen and the height of a line, to 
+    draw it on. The surface is cleared to black. It may not be on the 
+    screen until scroller_show() is called, so the line never 
+    appears half-drawn. The surface belongs to the scroller, and is 
+    only valid until the next call to scroller_next_line(). */
+Surface         *scroller_next_line (Scroller *self);
+
+/** Show the line most recently returned by scroller_next_line(), 
+    scrolling the screen up if necessary. */
+void             scroller_show (Scroller *self);
+
+/** Get the number of lines that fit on the screen. */
+int              scroller_get_rows (const Scroller *self);
+
+END_DECLS
+
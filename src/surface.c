@@ -0,0 +1,394 @@
+/*============================================================================
+
+  surface.c
+
+  Implementation of the "methods" defined in surface.h.
+
+  All the drawing methods clip their rectangles first, and then work a
+  row at a time, so the address of a pixel is only worked out once per
+  row.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <limits.h>
+#include "defs.h"
+#include "log.h"
+#include "surface.h"
+
+
+/*==========================================================================
+  surface_create_for_data
+*==========================================================================*/
+Surface *surface_create_for_data (BYTE *data, int width, int height, 
+      int stride, SurfaceFormat format)
+  {
+  LOG_IN
+  Surface *self = malloc (sizeof (Surface));
+  memset (self, 0, sizeof (Surface));
+  self->data = data;
+  self->width = width;
+  self->height = height;
+  self->stride = stride;
+  self->format = format;
+  self->bytes_per_pixel = surface_format_bytes (format);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  surface_create
+*==========================================================================*/
+Surface *surface_create (int width, int height, SurfaceFormat format)
+  {
+  LOG_IN
+  Surface *self = NULL;
+  int bytes = surface_format_bytes (format);
+  if (width >= 0 && height >= 0 && width <= (INT_MAX - 15) / bytes)
+    {
+    // Round rows up to a multiple of 16 bytes, so that every row starts
+    //  on the same alignment 
+    int stride = (width * bytes + 15) & ~15;
+    BYTE *data = calloc (height > 0 ? height : 1, 
+      stride > 0 ? stride : 16);
+    if (data)
+      {
+      self = surface_create_for_data (data, width, height, stride, 
+        format);
+      self->owns_data = TRUE;
+      }
+    }
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  surface_destroy
+*==========================================================================*/
+void surface_destroy (Surface *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    if (self->owns_data) free (self->data);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  surface_format_bytes
+*==========================================================================*/
+int surface_format_bytes (SurfaceFormat format)
+  {
+  switch (format)
+    {
+    case SURFACE_FORMAT_BGRX8888: return 4;
+    case SURFACE_FORMAT_BGRA8888: return 4;
+    case SURFACE_FORMAT_BGR888: return 3;
+    case SURFACE_FORMAT_RGB888: return 3;
+    case SURFACE_FORMAT_RGB565: return 2;
+    }
+  return 4;
+  }
+
+
+/*==========================================================================
+  surface_pack
+
+  Write one pixel of the specified colour and alpha, in the surface's
+  format, at dest. The alpha is ignored by formats that don't have it.
+
+*==========================================================================*/
+static inline void surface_pack (const Surface *self, BYTE *dest,
+      BYTE r, BYTE g, BYTE b, BYTE a)
+  {
+  switch (self->format)
+    {
+    case SURFACE_FORMAT_BGRA8888:
+      dest[3] = a;
+      dest[0] = b;
+      dest[1] = g;
+      dest[2] = r;
+      break;
+    case SURFACE_FORMAT_BGRX8888:
+      dest[3] = 0;
+      // Fall through
+    case SURFACE_FORMAT_BGR888:
+      dest[0] = b;
+      dest[1] = g;
+      dest[2] = r;
+      break;
+    case SURFACE_FORMAT_RGB888:
+      dest[0] = r;
+      dest[1] = g;
+      dest[2] = b;
+      break;
+    case SURFACE_FORMAT_RGB565:
+      *(uint16_t *)dest = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+      break;
+    }
+  }
+
+
+/*==========================================================================
+  surface_unpack
+
+  Get the colour and alpha of the pixel at src. Formats without alpha 
+  are opaque.
+
+*==========================================================================*/
+static inline void surface_unpack (const Surface *self, const BYTE *src,
+      int *r, int *g, int *b, int *a)
+  {
+  switch (self->format)
+    {
+    case SURFACE_FORMAT_BGRA8888:
+    case SURFACE_FORMAT_BGRX8888:
+    case SURFACE_FORMAT_BGR888:
+      *b = src[0];
+      *g = src[1];
+      *r = src[2];
+      *a = self->format == SURFACE_FORMAT_BGRA8888 ? src[3] : 255;
+      break;
+    case SURFACE_FORMAT_RGB888:
+      *r = src[0];
+      *g = src[1];
+      *b = src[2];
+      *a = 255;
+      break;
+    case SURFACE_FORMAT_RGB565:
+      {
+      int v = *(const uint16_t *)src;
+      *r = ((v >> 11) << 3) | (v >> 13);
+      *g = (((v >> 5) & 0x3f) << 2) | ((v >> 9) & 0x03);
+      *b = ((v & 0x1f) << 3) | ((v >> 2) & 0x07);
+      *a = 255;
+      }
+      break;
+    default: // Every surface has one of the formats above
+      *r = *g = *b = 0;
+      *a = 255;
+    }
+  }
+
+
+/*==========================================================================
+  surface_div255
+
+  Divide a sum of products of 8-bit values by 255, rounding
+
+*==========================================================================*/
+static inline int surface_div255 (int v)
+  {
+  v += 128;
+  return (v + (v >> 8)) >> 8;
+  }
+
+
+/*==========================================================================
+  surface_clip
+
+  Clip a rectangle to the surface. Returns FALSE if nothing is left.
+
+*==========================================================================*/
+static BOOL surface_clip (const Surface *self, int *x, int *y, 
+      int *width, int *height)
+  {
+  if (*x < 0) { *width += *x; *x = 0; }
+  if (*y < 0) { *height += *y; *y = 0; }
+  if (*x + *width > self->width) *width = self->width - *x;
+  if (*y + *height > self->height) *height = self->height - *y;
+  return *width > 0 && *height > 0;
+  }
+
+
+/*==========================================================================
+  surface_clear
+*==========================================================================*/
+void surface_clear (Surface *self)
+  {
+  if (self->stride == self->width * self->bytes_per_pixel)
+    memset (self->data, 0, self->stride * self->height);
+  else
+    {
+    for (int i = 0; i < self->height; i++)
+      memset (self->data + i * self->stride, 0, 
+        self->width * self->bytes_per_pixel);
+    }
+  }
+
+
+/*==========================================================================
+  surface_fill_rect
+*==========================================================================*/
+void surface_fill_rect (Surface *self, int x, int y, int width, 
+      int height, BYTE r, BYTE g, BYTE b)
+  {
+  if (!surface_clip (self, &x, &y, &width, &height)) return;
+
+  // Fill the first row pixel by pixel, then copy it to the others
+  int bpp = self->bytes_per_pixel;
+  BYTE *first = self->data + y * self->stride + x * bpp;
+  BYTE *dest = first;
+  for (int j = 0; j < width; j++)
+    {
+    surface_pack (self, dest, r, g, b, 255);
+    dest += bpp;
+    }
+  for (int i = 1; i < height; i++)
+    memcpy (first + i * self->stride, first, width * bpp);
+  }
+
+
+/*==========================================================================
+  surface_draw_coverage
+*==========================================================================*/
+void surface_draw_coverage (Surface *self, int x, int y, 
+      const BYTE *coverage, int width, int rows, int pitch)
+  {
+  // Work out which part of the bitmap is actually on the surface
+  int first_col = x < 0 ? -x : 0;
+  int last_col = x + width > self->width ? self->width - x : width;
+  int first_row = y < 0 ? -y : 0;
+  int last_row = y + rows > self->height ? self->height - y : rows;
+  int bpp = self->bytes_per_pixel;
+
+  for (int i = first_row; i < last_row; i++)
+    {
+    const BYTE *src = coverage + i * pitch;
+    BYTE *dest = self->data + (y + i) * self->stride 
+      + (x + first_col) * bpp;
+    for (int j = first_col; j < last_col; j++)
+      {
+      BYTE p = src[j];
+      if (p) surface_pack (self, dest, p, p, p, p);
+      dest += bpp;
+      }
+    }
+  }
+
+
+/*==========================================================================
+  surface_blend_coverage
+*==========================================================================*/
+void surface_blend_coverage (Surface *self, int x, int y, 
+      const BYTE *coverage, int width, int rows, int pitch, 
+      BYTE r, BYTE g, BYTE b)
+  {
+  int first_col = x < 0 ? -x : 0;
+  int last_col = x + width > self->width ? self->width - x : width;
+  int first_row = y < 0 ? -y : 0;
+  int last_row = y + rows > self->height ? self->height - y : rows;
+  int bpp = self->bytes_per_pixel;
+
+  for (int i = first_row; i < last_row; i++)
+    {
+    const BYTE *src = coverage + i * pitch;
+    BYTE *dest = self->data + (y + i) * self->stride 
+      + (x + first_col) * bpp;
+    for (int j = first_col; j < last_col; j++)
+      {
+      int p = src[j];
+      if (p == 255)
+        surface_pack (self, dest, r, g, b, 255);
+      else if (p)
+        {
+        int dr, dg, db, da;
+        surface_unpack (self, dest, &dr, &dg, &db, &da);
+        int ip = 255 - p;
+        surface_pack (self, dest, 
+          surface_div255 (r * p + dr * ip), 
+          surface_div255 (g * p + dg * ip), 
+          surface_div255 (b * p + db * ip), 
+          p + surface_div255 (da * ip));
+        }
+      dest += bpp;
+      }
+    }
+  }
+
+
+/*==========================================================================
+  surface_mix_coverage
+*==========================================================================*/
+void surface_mix_coverage (Surface *self, int x, int y, 
+      const BYTE *coverage, int width, int rows, int pitch, 
+      BYTE r, BYTE g, BYTE b, BYTE bg_r, BYTE bg_g, BYTE bg_b)
+  {
+  int first_col = x < 0 ? -x : 0;
+  int last_col = x + width > self->width ? self->width - x : width;
+  int first_row = y < 0 ? -y : 0;
+  int last_row = y + rows > self->height ? self->height - y : rows;
+  int bpp = self->bytes_per_pixel;
+
+  for (int i = first_row; i < last_row; i++)
+    {
+    const BYTE *src = coverage + i * pitch;
+    BYTE *dest = self->data + (y + i) * self->stride 
+      + (x + first_col) * bpp;
+    for (int j = first_col; j < last_col; j++)
+      {
+      int p = src[j];
+      int ip = 255 - p;
+      surface_pack (self, dest, 
+        surface_div255 (r * p + bg_r * ip), 
+        surface_div255 (g * p + bg_g * ip), 
+        surface_div255 (b * p + bg_b * ip), 255);
+      dest += bpp;
+      }
+    }
+  }
+
+
+/*==========================================================================
+  surface_blit
+*==========================================================================*/
+void surface_blit (Surface *self, int x, int y, const Surface *src, 
+      int src_x, int src_y, int width, int height)
+  {
+  if (src->format != self->format)
+    {
+    log_warning ("Can't blit between surfaces of different formats");
+    return;
+    }
+  if (!surface_clip_copy (self, &x, &y, src, &src_x, &src_y, 
+       &width, &height)) return;
+
+  int bpp = self->bytes_per_pixel;
+  for (int i = 0; i < height; i++)
+    memcpy (self->data + (y + i) * self->stride + x * bpp,
+      src->data + (src_y + i) * src->stride + src_x * bpp, width * bpp);
+  }
+
+
+/*==========================================================================
+  surface_clip_copy
+*==========================================================================*/
+BOOL surface_clip_copy (const Surface *self, int *x, int *y, 
+      const Surface *src, int *src_x, int *src_y, int *width, int *height)
+  {
+  // Clip to the source, moving the destination to match, and then
+  //  the other way round
+  int sx = *src_x, sy = *src_y;
+  if (!surface_clip (src, &sx, &sy, width, height)) return FALSE;
+  *x += sx - *src_x;
+  *y += sy - *src_y;
+  int dx = *x, dy = *y;
+  if (!surface_clip (self, &dx, &dy, width, height)) return FALSE;
+  *src_x = sx + dx - *x;
+  *src_y = sy + dy - *y;
+  *x = dx;
+  *y = dy;
+  return TRUE;
+  }
+
@@ -0,0 +1,133 @@
+/*============================================================================
+
+  surface.h
+
+  A "class" that describes a rectangle of pixels in memory -- either
+  the framebuffer's mapped memory, or an off-screen buffer -- and
+  draws on it. Text can be drawn on any surface in the same way, so it
+  can be rendered off-screen and then copied to the framebuffer with
+  surface_blit(), or drawn directly.
+
+  Unlike most of the "classes" in this program, the structure is 
+  public, because the whole point of a surface is to say where its
+  pixels are and how they are laid out. Callers may read the fields,
+  and write the pixels, but should not change the fields.
+
+  The usual sequence of operations is
+  surface_create or surface_create_for_data
+  surface_draw_coverage, surface_blit, etc (probably many times)
+  surface_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+
+/** Pixel formats. The names give the order of the components in 
+    memory, from the lowest address; RGB565 pixels are 16-bit 
+    little-endian values, with red in the top five bits. BGRA8888
+    colours are premultiplied by alpha, so a pixel is never brighter
+    than its alpha value. */
+typedef enum _SurfaceFormat
+  {
+  SURFACE_FORMAT_BGRX8888 = 0, // Blue, green, red, unused byte
+  SURFACE_FORMAT_BGR888, // Blue, green, red
+  SURFACE_FORMAT_RGB565, // Five bits red, six green, five blue
+  SURFACE_FORMAT_BGRA8888, // Blue, green, red, alpha
+  SURFACE_FORMAT_RGB888 // Red, green, blue -- as in PPM files
+  } SurfaceFormat;
+
+// Number of formats
+#define SURFACE_FORMATS 5
+
+typedef struct _Surface
+  {
+  BYTE *data; // The top-left pixel
+  int stride; // Bytes between vertically-adjacent pixels
+  SurfaceFormat format;
+  int width; // Width in pixels
+  int height; // Height in pixels
+  int bytes_per_pixel;
+  BOOL owns_data; // TRUE if data is freed with the surface
+  } Surface;
+
+BEGIN_DECLS
+
+/** Create an off-screen surface of the specified size and format, 
+    initially black. Returns NULL if the size is negative, or too 
+    large to allocate; otherwise the surface must eventually be 
+    destroyed by calling surface_destroy(). */
+Surface         *surface_create (int width, int height, 
+                   SurfaceFormat format);
+
+/** Create a surface that describes pixels in memory that belong to
+    somebody else -- a mapped framebuffer, for example. The memory
+    must outlive the surface, and is not freed by surface_destroy(). */
+Surface         *surface_create_for_data (BYTE *data, int width, 
+                   int height, int stride, SurfaceFormat format);
+
+/** Free the surface, and its pixels if it owns them. */
+void             surface_destroy (Surface *self);
+
+/** Get the number of bytes in one pixel of the specified format. */
+int              surface_format_bytes (SurfaceFormat format);
+
+/** Set the whole surface to black. */
+void             surface_clear (Surface *self);
+
+/** Fill a rectangle with the specified RGB colour values. The 
+    rectangle is clipped to the surface. Pixels in a surface with 
+    alpha are made opaque. */
+void             surface_fill_rect (Surface *self, int x, int y, 
+                   int width, int height, BYTE r, BYTE g, BYTE b);
+
+/** Draw a rectangular 8-bit coverage bitmap, such as a rendered
+    glyph or word, with its top-left corner at (x,y). Each non-zero
+    coverage value is written as a grey level; zero values leave the
+    surface untouched. In a surface with alpha, the coverage is also
+    written as the alpha value, so the text can later be blended onto
+    another surface. The bitmap is clipped to the surface. */
+void             surface_draw_coverage (Surface *self, int x, int y,
+                   const BYTE *coverage, int width, int rows, int pitch);
+
+/** Draw a coverage bitmap, like surface_draw_coverage(), but blend
+    the specified colour onto what is already on the surface, using
+    the coverage values as alpha. This is slower, because every pixel
+    has to be read, but it makes anti-aliased text look right on any
+    background, not just black. */
+void             surface_blend_coverage (Surface *self, int x, int y,
+                   const BYTE *coverage, int width, int rows, int pitch,
+                   BYTE r, BYTE g, BYTE b);
+
+/** Draw a coverage bitmap as a two-colour image: every pixel of the
+    bitmap's rectangle is written, with a mixture of the foreground 
+    colour (r,g,b) and the background colour (bg_r,bg_g,bg_b) in
+    proportion to its coverage value. Nothing on the surface is read,
+    so this is as fast as surface_draw_coverage(), and suits text
+    drawn in character cells, each of which covers what was there. */
+void             surface_mix_coverage (Surface *self, int x, int y,
+                   const BYTE *coverage, int width, int rows, int pitch,
+                   BYTE r, BYTE g, BYTE b, BYTE bg_r, BYTE bg_g, BYTE bg_b);
+
+/** Copy a width x height rectangle, with its top-left corner at
+    (src_x,src_y) in src, to (x,y) in this surface. The rectangle is 
+    clipped to both surfaces. The surfaces must have the same format,
+    and must not overlap in memory; pixels are copied exactly, without
+    blending. To copy between formats, use a Blitter. */
+void             surface_blit (Surface *self, int x, int y, 
+                   const Surface *src, int src_x, int src_y, 
+                   int width, int height);
+
+/** Clip a copy of a width x height rectangle from (src_x,src_y) in src
+    to (x,y) in this surface, so that it lies within both. All the 
+    values are adjusted in place. Returns FALSE if nothing is left to
+    copy. */
+BOOL             surface_clip_copy (const Surface *self, int *x, int *y,
+                   const Surface *src, int *src_x, int *src_y, 
+                   int *width, int *height);
+
+END_DECLS
+
@@ -0,0 +1,368 @@
+/*============================================================================
+
+  terminal.c
+
+  Implementation of the "methods" defined in terminal.h.
+
+  The VtParser does the parsing, and calls the functions here for
+  each character and sequence it finds. The terminal keeps its own
+  copy of the colours and attributes that SGR (ESC [ ... m) sequences
+  set, and passes them to the console when they change.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "vtparser.h"
+#include "terminal.h"
+
+struct _Terminal
+  {
+  Console *console;
+  VtParser *parser;
+  int fg;
+  int bg;
+  int attrs;
+  int saved_col; // The cursor position saved by ESC 7 or ESC [ s
+  int saved_row;
+  };
+
+
+/*==========================================================================
+  terminal_set_pen
+
+  Pass the current colours and attributes to the console
+
+*==========================================================================*/
+static void terminal_set_pen (Terminal *self)
+  {
+  console_set_colours (self->console, self->fg, self->bg);
+  console_set_attributes (self->console, self->attrs);
+  }
+
+
+/*==========================================================================
+  terminal_reset
+*==========================================================================*/
+static void terminal_reset (Terminal *self)
+  {
+  self->fg = CONSOLE_DEFAULT_FG;
+  self->bg = CONSOLE_DEFAULT_BG;
+  self->attrs = 0;
+  self->saved_col = 0;
+  self->saved_row = 0;
+  terminal_set_pen (self);
+  }
+
+
+/*==========================================================================
+  terminal_cube_level
+
+  Find the nearest of the six levels of the palette's colour cube
+  (0, 95, 135, 175, 215, 255) to an 8-bit colour component
+
+*==========================================================================*/
+static int terminal_cube_level (int v)
+  {
+  if (v < 48) return 0;
+  if (v < 115) return 1;
+  return (v - 35) / 40;
+  }
+
+
+/*==========================================================================
+  terminal_extended_colour
+
+  Read the colour from a 38 or 48 SGR parameter -- either 5;n for a
+  palette index, or 2;r;g;b. Returns the palette index, or -1 if the
+  parameters are not valid, and moves *i past the parameters used
+
+*==========================================================================*/
+static int terminal_extended_colour (const int *params, int n_params,
+      int *i)
+  {
+  int j = *i + 1;
+  if (j < n_params && params[j] == 5 && j + 1 < n_params)
+    {
+    *i = j + 1;
+    return params[j + 1] & 0xff;
+    }
+  if (j < n_params && params[j] == 2 && j + 3 < n_params)
+    {
+    *i = j + 3;
+    return 16 + 36 * terminal_cube_level (params[j + 1] & 0xff)
+      + 6 * terminal_cube_level (params[j + 2] & 0xff)
+      + terminal_cube_level (params[j + 3] & 0xff);
+    }
+  *i = n_params;
+  return -1;
+  }
+
+
+/*==========================================================================
+  terminal_sgr
+
+  Set colours and attributes
+
+*==========================================================================*/
+static void terminal_sgr (Terminal *self, const int *params, int n_params)
+  {
+  static const int params_reset [1] = { 0 };
+  if (n_params == 0)
+    {
+    params = params_reset;
+    n_params = 1;
+    }
+  for (int i = 0; i < n_params; i++)
+    {
+    int p = params[i];
+    if (p == 0)
+      {
+      self->fg = CONSOLE_DEFAULT_FG;
+      self->bg = CONSOLE_DEFAULT_BG;
+      self->attrs = 0;
+      }
+    else if (p == 1) self->attrs |= CONSOLE_ATTR_BOLD;
+    else if (p == 3) self->attrs |= CONSOLE_ATTR_ITALIC;
+    else if (p == 4) self->attrs |= CONSOLE_ATTR_UNDERLINE;
+    else if (p == 7) self->attrs |= CONSOLE_ATTR_REVERSE;
+    else if (p == 22) self->attrs &= ~CONSOLE_ATTR_BOLD;
+    else if (p == 23) self->attrs &= ~CONSOLE_ATTR_ITALIC;
+    else if (p == 24) self->attrs &= ~CONSOLE_ATTR_UNDERLINE;
+    else if (p == 27) self->attrs &= ~CONSOLE_ATTR_REVERSE;
+    else if (p >= 30 && p <= 37) self->fg = p - 30;
+    else if (p >= 40 && p <= 47) self->bg = p - 40;
+    else if (p >= 90 && p <= 97) self->fg = p - 90 + 8;
+    else if (p >= 100 && p <= 107) self->bg = p - 100 + 8;
+    else if (p == 39) self->fg = CONSOLE_DEFAULT_FG;
+    else if (p == 49) self->bg = CONSOLE_DEFAULT_BG;
+    else if (p == 38 || p == 48)
+      {
+      int colour = terminal_extended_colour (params, n_params, &i);
+      if (colour >= 0)
+        {
+        if (p == 38)
+          self->fg = colour;
+        else
+          self->bg = colour;
+        }
+      }
+    }
+  terminal_set_pen (self);
+  }
+
+
+/*==========================================================================
+  terminal_erase_display
+*==========================================================================*/
+static void terminal_erase_display (Terminal *self, int mode)
+  {
+  int cols, rows, col, row;
+  console_get_size (self->console, &cols, &rows);
+  console_get_cursor (self->console, &col, &row);
+  int cursor = row * cols + (col < cols ? col : cols - 1);
+  if (mode == 0)
+    console_erase (self->console, col, row, cols * rows - cursor);
+  else if (mode == 1)
+    console_erase (self->console, 0, 0, cursor + 1);
+  else if (mode == 2 || mode == 3)
+    console_erase (self->console, 0, 0, cols * rows);
+  }
+
+
+/*==========================================================================
+  terminal_erase_line
+*==========================================================================*/
+static void terminal_erase_line (Terminal *self, int mode)
+  {
+  int cols, rows, col, row;
+  console_get_size (self->console, &cols, &rows);
+  console_get_cursor (self->console, &col, &row);
+  if (col >= cols) col = cols - 1;
+  if (mode == 0)
+    console_erase (self->console, col, row, cols - col);
+  else if (mode == 1)
+    console_erase (self->console, 0, row, col + 1);
+  else if (mode == 2)
+    console_erase (self->console, 0, row, cols);
+  }
+
+
+/*==========================================================================
+  terminal_print
+*==========================================================================*/
+static void terminal_print (void *user, UTF32 c)
+  {
+  Terminal *self = user;
+  console_put (self->console, c);
+  }
+
+
+/*==========================================================================
+  terminal_execute
+*==========================================================================*/
+static void terminal_execute (void *user, BYTE c)
+  {
+  Terminal *self = user;
+  // Line feed, vertical tab, and form feed all move down a line
+  if (c == '\v' || c == '\f') c = '\n';
+  if (c == '\n' || c == '\r' || c == '\b' || c == '\t')
+    console_put (self->console, c);
+  }
+
+
+/*==========================================================================
+  terminal_esc_dispatch
+*==========================================================================*/
+static void terminal_esc_dispatch (void *user, BYTE final,
+      const BYTE *intermediates, int n_intermediates)
+  {
+  (void)intermediates;
+  Terminal *self = user;
+  if (n_intermediates) return; // Character set selection, etc.
+  switch (final)
+    {
+    case '7':
+      console_get_cursor (self->console, &self->saved_col,
+        &self->saved_row);
+      break;
+    case '8':
+      console_move_to (self->console, self->saved_col, self->saved_row);
+      break;
+    case 'E':
+      console_put (self->console, '\n');
+      break;
+    case 'c':
+      terminal_reset (self);
+      console_clear (self->console);
+      break;
+    }
+  }
+
+
+/*==========================================================================
+  terminal_csi_dispatch
+*==========================================================================*/
+static void terminal_csi_dispatch (void *user, BYTE final,
+      const int *params, int n_params, const BYTE *intermediates,
+      int n_intermediates)
+  {
+  Terminal *self = user;
+  if (n_intermediates)
+    {
+    // Of the private sequences, only showing and hiding the cursor
+    //  (ESC [ ? 25 h and ESC [ ? 25 l) are supported
+    if (n_intermediates == 1 && intermediates[0] == '?'
+        && (final == 'h' || final == 'l'))
+      {
+      for (int i = 0; i < n_params; i++)
+        if (params[i] == 25)
+          console_set_cursor_visible (self->console, final == 'h');
+      }
+    return;
+    }
+
+  // Most sequences take a count or position, where 0 means 1
+  int p0 = n_params > 0 ? params[0] : 0;
+  int p1 = n_params > 1 ? params[1] : 0;
+  int n = p0 > 0 ? p0 : 1;
+  int col, row;
+  console_get_cursor (self->console, &col, &row);
+  switch (final)
+    {
+    case 'm':
+      terminal_sgr (self, params, n_params);
+      break;
+    case 'A':
+      console_move_to (self->console, col, row - n);
+      break;
+    case 'B':
+      console_move_to (self->console, col, row + n);
+      break;
+    case 'C':
+      console_move_to (self->console, col + n, row);
+      break;
+    case 'D':
+      console_move_to (self->console, col - n, row);
+      break;
+    case 'G':
+      console_move_to (self->console, n - 1, row);
+      break;
+    case 'd':
+      console_move_to (self->console, col, n - 1);
+      break;
+    case 'H':
+    case 'f':
+      console_move_to (self->console, (p1 > 0 ? p1 : 1) - 1, n - 1);
+      break;
+    case 'J':
+      terminal_erase_display (self, p0);
+      break;
+    case 'K':
+      terminal_erase_line (self, p0);
+      break;
+    case 's':
+      self->saved_col = col;
+      self->saved_row = row;
+      break;
+    case 'u':
+      console_move_to (self->console, self->saved_col, self->saved_row);
+      break;
+    default:
+      log_debug ("Ignoring CSI sequence ending '%c'", final);
+    }
+  }
+
+
+/*==========================================================================
+  terminal_create
+*==========================================================================*/
+Terminal *terminal_create (Console *console)
+  {
+  LOG_IN
+  static const VtParserHandler handler =
+    {
+    terminal_print,
+    terminal_execute,
+    terminal_esc_dispatch,
+    terminal_csi_dispatch
+    };
+  Terminal *self = malloc (sizeof (Terminal));
+  memset (self, 0, sizeof (Terminal));
+  self->console = console;
+  self->parser = vtparser_create (&handler, self);
+  terminal_reset (self);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  terminal_destroy
+*==========================================================================*/
+void terminal_destroy (Terminal *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    vtparser_destroy (self->parser);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  terminal_feed
+*==========================================================================*/
+void terminal_feed (Terminal *self, const BYTE *data, size_t len)
+  {
+  vtparser_feed (self->parser, data, len);
+  }
+
@@ -0,0 +1,53 @@
+/*============================================================================
+
+  terminal.h
+
+  A "class" that makes a Console behave like a simple VT100-style
+  terminal: the bytes written to it are parsed for escape sequences,
+  which set colours and attributes, move the cursor, and erase parts
+  of the screen, as programs like ls and grep expect when they
+  produce coloured output. Everything else is written to the console
+  as text.
+
+  The usual escape sequences for colours are supported -- the 8
+  standard and 8 bright colours, the 256-colour palette, and 24-bit
+  colours, which are shown in the nearest colour in the palette -- and
+  the common cursor movement and erasing sequences. Sequences that
+  are not understood are ignored.
+
+  The usual sequence of operations is
+  terminal_create
+  terminal_feed (probably many times), console_update
+  terminal_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include "defs.h"
+#include "console.h"
+
+struct _Terminal;
+typedef struct _Terminal Terminal;
+
+BEGIN_DECLS
+
+/** Create a terminal that writes to the console. The console's colours
+    are set to the defaults. This method always succeeds, and must
+    eventually be followed by a call to terminal_destroy(). */
+Terminal        *terminal_create (Console *console);
+
+/** Free the terminal. The console is not freed. */
+void             terminal_destroy (Terminal *self);
+
+/** Write len bytes of UTF-8 text, which can contain escape sequences,
+    to the console. Sequences and characters can be split between calls.
+    Nothing is drawn until console_update() is called. */
+void             terminal_feed (Terminal *self, const BYTE *data,
+                   size_t len);
+
+END_DECLS
+
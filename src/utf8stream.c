@@ -0,0 +1,246 @@
+/*============================================================================
+
+  utf8stream.c
+
+  Implementation of the "methods" defined in utf8stream.h.
+
+  The ring buffer's size is a power of two, so positions in it are
+  just counters, masked to find the slot. Before a piece of text is
+  decoded, the ring is made big enough for every byte of it to become
+  a character -- that can't be exceeded, apart from the one U+FFFD for
+  a character that was carried over and then cut short -- so the 
+  decoding loop never has to check for room. Runs of ASCII, which is
+  most text, are copied without going through the decoder at all.
+
+  The position of each newline is recorded as it is decoded, in a
+  second ring of the same size -- there can't be more newlines than 
+  characters -- so a line is copied out without being searched for.
+  Positions are never reset, even when the rings grow, so the
+  recorded positions stay valid.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "utf8stream.h"
+
+// The character that replaces invalid UTF-8
+#define UTF8STREAM_REPLACEMENT 0xFFFD
+
+struct _Utf8Stream
+  {
+  UTF32 *ring;
+  size_t mask; // Size of the ring, minus one -- the size is a power of two
+  size_t head; // Position of the first character not yet read
+  size_t tail; // Position of the next character to be decoded
+  size_t *newlines; // Positions of the newlines in the ring
+  size_t newline_head; // Position in newlines of the first not yet read
+  size_t newline_tail; // Position in newlines of the next to be recorded
+  BOOL ended; // TRUE after utf8stream_end()
+  UTF32 c; // The character being decoded
+  int needed; // Continuation bytes still to come
+  UTF32 min; // The smallest character its number of bytes can encode
+  };
+
+
+/*==========================================================================
+  utf8stream_create
+*==========================================================================*/
+Utf8Stream *utf8stream_create (int capacity)
+  {
+  LOG_IN
+  Utf8Stream *self = malloc (sizeof (Utf8Stream));
+  memset (self, 0, sizeof (Utf8Stream));
+  size_t size = 16;
+  while (size < (size_t)capacity) size *= 2;
+  self->ring = malloc (size * sizeof (UTF32));
+  self->newlines = malloc (size * sizeof (size_t));
+  self->mask = size - 1;
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  utf8stream_destroy
+*==========================================================================*/
+void utf8stream_destroy (Utf8Stream *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    free (self->ring);
+    free (self->newlines);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  utf8stream_reserve
+
+  Make sure that the rings have room for n more characters, growing 
+  them if necessary. Everything in the rings keeps its position.
+*==========================================================================*/
+static void utf8stream_reserve (Utf8Stream *self, size_t n)
+  {
+  size_t used = self->tail - self->head;
+  size_t size = self->mask + 1;
+  if (used + n <= size) return;
+
+  while (used + n > size) size *= 2;
+  log_debug ("Growing UTF-8 stream ring to %d characters", (int)size);
+  UTF32 *ring = malloc (size * sizeof (UTF32));
+  for (size_t i = self->head; i != self->tail; i++)
+    ring[i & (size - 1)] = self->ring[i & self->mask];
+  size_t *newlines = malloc (size * sizeof (size_t));
+  for (size_t i = self->newline_head; i != self->newline_tail; i++)
+    newlines[i & (size - 1)] = self->newlines[i & self->mask];
+  free (self->ring);
+  free (self->newlines);
+  self->ring = ring;
+  self->newlines = newlines;
+  self->mask = size - 1;
+  }
+
+
+/*==========================================================================
+  utf8stream_put
+*==========================================================================*/
+static inline void utf8stream_put (Utf8Stream *self, UTF32 c)
+  {
+  if (c == '\n') 
+    self->newlines[self->newline_tail++ & self->mask] = self->tail;
+  self->ring[self->tail++ & self->mask] = c;
+  }
+
+
+/*==========================================================================
+  utf8stream_start
+
+  Start decoding a character with lead byte b, which is not ASCII
+
+*==========================================================================*/
+static void utf8stream_start (Utf8Stream *self, BYTE b)
+  {
+  if (b >= 0xc0 && b < 0xe0)
+    {
+    self->c = b & 0x1f;
+    self->needed = 1;
+    self->min = 0x80;
+    }
+  else if (b >= 0xe0 && b < 0xf0)
+    {
+    self->c = b & 0x0f;
+    self->needed = 2;
+    self->min = 0x800;
+    }
+  else if (b >= 0xf0 && b < 0xf5)
+    {
+    self->c = b & 0x07;
+    self->needed = 3;
+    self->min = 0x10000;
+    }
+  else
+    utf8stream_put (self, UTF8STREAM_REPLACEMENT);
+  }
+
+
+/*==========================================================================
+  utf8stream_write
+*==========================================================================*/
+void utf8stream_write (Utf8Stream *self, const BYTE *data, size_t len)
+  {
+  utf8stream_reserve (self, len + 1);
+  size_t i = 0;
+  while (i < len)
+    {
+    if (self->needed == 0)
+      {
+      // The fast path, for ASCII text
+      while (i < len && data[i] < 0x80)
+        utf8stream_put (self, data[i++]);
+      if (i == len) break;
+      }
+
+    BYTE b = data[i++];
+    if (b >= 0x80 && b < 0xc0)
+      {
+      if (self->needed == 0)
+        utf8stream_put (self, UTF8STREAM_REPLACEMENT);
+      else
+        {
+        self->c = (self->c << 6) | (b & 0x3f);
+        if (--self->needed == 0)
+          {
+          UTF32 c = self->c;
+          if (c < self->min || c > 0x10ffff 
+               || (c >= 0xd800 && c < 0xe000))
+            c = UTF8STREAM_REPLACEMENT;
+          utf8stream_put (self, c);
+          }
+        }
+      continue;
+      }
+
+    // A character that ends before it is complete is invalid
+    if (self->needed)
+      {
+      self->needed = 0;
+      utf8stream_put (self, UTF8STREAM_REPLACEMENT);
+      }
+    if (b < 0x80)
+      utf8stream_put (self, b);
+    else
+      utf8stream_start (self, b);
+    }
+  }
+
+
+/*==========================================================================
+  utf8stream_end
+*==========================================================================*/
+void utf8stream_end (Utf8Stream *self)
+  {
+  if (self->needed)
+    {
+    utf8stream_reserve (self, 1);
+    self->needed = 0;
+    utf8stream_put (self, UTF8STREAM_REPLACEMENT);
+    }
+  self->ended = TRUE;
+  }
+
+
+/*==========================================================================
+  utf8stream_get_line
+*==========================================================================*/
+UTF32 *utf8stream_get_line (Utf8Stream *self, int *len)
+  {
+  size_t end;
+  if (self->newline_head != self->newline_tail)
+    end = self->newlines[self->newline_head++ & self->mask];
+  else if (self->ended && self->tail != self->head)
+    end = self->tail;
+  else
+    return NULL;
+
+  int n = end - self->head;
+  UTF32 *line = malloc ((n + 1) * sizeof (UTF32));
+  for (int i = 0; i < n; i++)
+    line[i] = self->ring[(self->head + i) & self->mask];
+  line[n] = 0;
+
+  // Skip the newline, if there is one
+  self->head = end < self->tail ? end + 1 : end;
+  *len = n;
+  return line;
+  }
+
@@ -0,0 +1,65 @@
+/*============================================================================
+
+  utf8stream.h
+
+  A "class" that decodes UTF-8 text as it arrives, in pieces of any
+  size -- as read() returns it from a pipe or a socket -- and hands it
+  back a line at a time, as Unicode characters. A character that is
+  split between two pieces is carried over to the next, so the caller
+  never has to find the ends of characters, or keep bytes back.
+
+  Each byte is decoded only once, as it is written, into a ring buffer
+  of characters, which grows if a line is longer than it can hold. The
+  stream records where each newline is as it decodes it, so a complete
+  line is copied out without being searched for. Invalid UTF-8 -- 
+  including overlong forms, surrogates, and sequences that end too 
+  soon -- is decoded as U+FFFD.
+
+  The usual sequence of operations is
+  utf8stream_create
+  utf8stream_write and utf8stream_get_line (probably many times)
+  utf8stream_end
+  utf8stream_get_line (until it returns NULL)
+  utf8stream_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include "defs.h"
+
+struct _Utf8Stream;
+typedef struct _Utf8Stream Utf8Stream;
+
+BEGIN_DECLS
+
+/** Create an empty stream, whose ring buffer initially holds at least
+    capacity characters. This method always succeeds, and must
+    eventually be followed by a call to utf8stream_destroy(). */
+Utf8Stream      *utf8stream_create (int capacity);
+
+/** Free the stream, and any text that has not been read. */
+void             utf8stream_destroy (Utf8Stream *self);
+
+/** Decode len bytes of UTF-8. They need not end at the end of a
+    character; decoding carries on where it left off with the next
+    call. */
+void             utf8stream_write (Utf8Stream *self, const BYTE *data,
+                   size_t len);
+
+/** Say that there is no more text to come. A character that is not
+    complete is decoded as U+FFFD, and the text after the last newline,
+    if there is any, becomes a line of its own. */
+void             utf8stream_end (Utf8Stream *self);
+
+/** Take the next complete line from the stream. The line is returned 
+    without its newline, as a zero-terminated string that the caller 
+    must free, and *len is set to its length. If there is no complete
+    line yet, this returns NULL. */
+UTF32           *utf8stream_get_line (Utf8Stream *self, int *len);
+
+END_DECLS
+
@@ -0,0 +1,371 @@
+/*============================================================================
+
+  vtparser.c
+
+  Implementation of the "methods" defined in vtparser.h.
+
+  The transition table has one byte for each state and input byte:
+  the action to take in the low four bits, and the next state in the
+  high four. It is filled in from a few rules when the parser is
+  created, so that parsing is just a table lookup and a switch on the
+  action for each byte.
+
+  The C1 control characters, 0x80 to 0x9f, are not recognized, because
+  in UTF-8 text those bytes are parts of multi-byte characters. The
+  device control, OSC, and privacy message strings are skipped
+  without being interpreted.
+
+  Most terminal output is plain text, so the ground state has a fast
+  path that passes runs of printable ASCII straight to the handler,
+  without consulting the table at all.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include "defs.h"
+#include "log.h"
+#include "vtparser.h"
+
+// Parser states
+#define VT_GROUND              0
+#define VT_ESCAPE              1
+#define VT_ESCAPE_INTERMEDIATE 2
+#define VT_CSI_ENTRY           3
+#define VT_CSI_PARAM           4
+#define VT_CSI_INTERMEDIATE    5
+#define VT_CSI_IGNORE          6
+#define VT_OSC_STRING          7 // Ended by BEL or ST
+#define VT_STRING              8 // DCS, SOS, PM, APC -- ended by ST
+#define VT_STATES              9
+
+// Actions
+#define VT_NONE         0
+#define VT_PRINT        1
+#define VT_EXECUTE      2
+#define VT_COLLECT      3
+#define VT_PARAM        4
+#define VT_ESC_DISPATCH 5
+#define VT_CSI_DISPATCH 6
+
+// The largest value a parameter can have -- larger values are clamped
+#define VT_MAX_PARAM 65535
+
+// The character that replaces invalid UTF-8
+#define VT_REPLACEMENT 0xFFFD
+
+struct _VtParser
+  {
+  VtParserHandler handler;
+  void *user;
+  int state;
+  int params [VTPARSER_MAX_PARAMS];
+  int n_params;
+  BYTE intermediates [VTPARSER_MAX_INTERMEDIATES];
+  int n_intermediates;
+  UTF32 utf8_char; // The UTF-8 character being decoded
+  int utf8_needed; // Continuation bytes still to come
+  UTF32 utf8_min; // The smallest character its number of bytes can encode
+  BYTE table [VT_STATES][256];
+  };
+
+
+/*==========================================================================
+  vtparser_set
+
+  Set the action and next state for a range of bytes in one state
+
+*==========================================================================*/
+static void vtparser_set (VtParser *self, int state, int first, int last,
+      int action, int next)
+  {
+  for (int b = first; b <= last; b++)
+    self->table[state][b] = action | (next << 4);
+  }
+
+
+/*==========================================================================
+  vtparser_set_c0
+
+  In most states, C0 controls are executed without changing state
+
+*==========================================================================*/
+static void vtparser_set_c0 (VtParser *self, int state)
+  {
+  vtparser_set (self, state, 0x00, 0x17, VT_EXECUTE, state);
+  vtparser_set (self, state, 0x19, 0x19, VT_EXECUTE, state);
+  vtparser_set (self, state, 0x1c, 0x1f, VT_EXECUTE, state);
+  }
+
+
+/*==========================================================================
+  vtparser_make_table
+*==========================================================================*/
+static void vtparser_make_table (VtParser *self)
+  {
+  // By default, bytes are ignored
+  for (int s = 0; s < VT_STATES; s++)
+    vtparser_set (self, s, 0x00, 0xff, VT_NONE, s);
+
+  vtparser_set_c0 (self, VT_GROUND);
+  vtparser_set (self, VT_GROUND, 0x20, 0x7e, VT_PRINT, VT_GROUND);
+  vtparser_set (self, VT_GROUND, 0x80, 0xff, VT_PRINT, VT_GROUND);
+
+  vtparser_set_c0 (self, VT_ESCAPE);
+  vtparser_set (self, VT_ESCAPE, 0x20, 0x2f, VT_COLLECT,
+    VT_ESCAPE_INTERMEDIATE);
+  vtparser_set (self, VT_ESCAPE, 0x30, 0x7e, VT_ESC_DISPATCH, VT_GROUND);
+  vtparser_set (self, VT_ESCAPE, '[', '[', VT_NONE, VT_CSI_ENTRY);
+  vtparser_set (self, VT_ESCAPE, ']', ']', VT_NONE, VT_OSC_STRING);
+  vtparser_set (self, VT_ESCAPE, 'P', 'P', VT_NONE, VT_STRING);
+  vtparser_set (self, VT_ESCAPE, 'X', 'X', VT_NONE, VT_STRING);
+  vtparser_set (self, VT_ESCAPE, '^', '_', VT_NONE, VT_STRING);
+
+  vtparser_set_c0 (self, VT_ESCAPE_INTERMEDIATE);
+  vtparser_set (self, VT_ESCAPE_INTERMEDIATE, 0x20, 0x2f, VT_COLLECT,
+    VT_ESCAPE_INTERMEDIATE);
+  vtparser_set (self, VT_ESCAPE_INTERMEDIATE, 0x30, 0x7e,
+    VT_ESC_DISPATCH, VT_GROUND);
+
+  vtparser_set_c0 (self, VT_CSI_ENTRY);
+  vtparser_set (self, VT_CSI_ENTRY, 0x20, 0x2f, VT_COLLECT,
+    VT_CSI_INTERMEDIATE);
+  vtparser_set (self, VT_CSI_ENTRY, 0x30, 0x39, VT_PARAM, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_ENTRY, ':', ':', VT_NONE, VT_CSI_IGNORE);
+  vtparser_set (self, VT_CSI_ENTRY, ';', ';', VT_PARAM, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_ENTRY, 0x3c, 0x3f, VT_COLLECT, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_ENTRY, 0x40, 0x7e, VT_CSI_DISPATCH,
+    VT_GROUND);
+
+  vtparser_set_c0 (self, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_PARAM, 0x20, 0x2f, VT_COLLECT,
+    VT_CSI_INTERMEDIATE);
+  vtparser_set (self, VT_CSI_PARAM, 0x30, 0x39, VT_PARAM, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_PARAM, ':', ':', VT_NONE, VT_CSI_IGNORE);
+  vtparser_set (self, VT_CSI_PARAM, ';', ';', VT_PARAM, VT_CSI_PARAM);
+  vtparser_set (self, VT_CSI_PARAM, 0x3c, 0x3f, VT_NONE, VT_CSI_IGNORE);
+  vtparser_set (self, VT_CSI_PARAM, 0x40, 0x7e, VT_CSI_DISPATCH,
+    VT_GROUND);
+
+  vtparser_set_c0 (self, VT_CSI_INTERMEDIATE);
+  vtparser_set (self, VT_CSI_INTERMEDIATE, 0x20, 0x2f, VT_COLLECT,
+    VT_CSI_INTERMEDIATE);
+  vtparser_set (self, VT_CSI_INTERMEDIATE, 0x30, 0x3f, VT_NONE,
+    VT_CSI_IGNORE);
+  vtparser_set (self, VT_CSI_INTERMEDIATE, 0x40, 0x7e, VT_CSI_DISPATCH,
+    VT_GROUND);
+
+  vtparser_set_c0 (self, VT_CSI_IGNORE);
+  vtparser_set (self, VT_CSI_IGNORE, 0x40, 0x7e, VT_NONE, VT_GROUND);
+
+  vtparser_set (self, VT_OSC_STRING, 0x07, 0x07, VT_NONE, VT_GROUND);
+
+  // Transitions from any state: CAN and SUB abort a sequence, and ESC
+  //  starts a new one -- which is also how ST (ESC \) ends a string
+  for (int s = 0; s < VT_STATES; s++)
+    {
+    vtparser_set (self, s, 0x18, 0x18, VT_EXECUTE, VT_GROUND);
+    vtparser_set (self, s, 0x1a, 0x1a, VT_EXECUTE, VT_GROUND);
+    vtparser_set (self, s, 0x1b, 0x1b, VT_NONE, VT_ESCAPE);
+    }
+  }
+
+
+/*==========================================================================
+  vtparser_create
+*==========================================================================*/
+VtParser *vtparser_create (const VtParserHandler *handler, void *user)
+  {
+  LOG_IN
+  VtParser *self = malloc (sizeof (VtParser));
+  memset (self, 0, sizeof (VtParser));
+  self->handler = *handler;
+  self->user = user;
+  self->state = VT_GROUND;
+  vtparser_make_table (self);
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  vtparser_destroy
+*==========================================================================*/
+void vtparser_destroy (VtParser *self)
+  {
+  LOG_IN
+  free (self);
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  vtparser_print
+
+  Pass a character to the handler, if it wants it
+
+*==========================================================================*/
+static inline void vtparser_print (VtParser *self, UTF32 c)
+  {
+  if (self->handler.print) self->handler.print (self->user, c);
+  }
+
+
+/*==========================================================================
+  vtparser_utf8
+
+  Decode one byte of UTF-8 text. Overlong forms, surrogates, and 
+  values above U+10FFFF are invalid, and are passed to the handler as
+  U+FFFD, so that, for example, an overlong encoding of ESC is never
+  printed as one.
+
+*==========================================================================*/
+static void vtparser_utf8 (VtParser *self, BYTE b)
+  {
+  if (b >= 0x80 && b < 0xc0)
+    {
+    if (self->utf8_needed == 0)
+      vtparser_print (self, VT_REPLACEMENT);
+    else
+      {
+      self->utf8_char = (self->utf8_char << 6) | (b & 0x3f);
+      if (--self->utf8_needed == 0)
+        {
+        UTF32 c = self->utf8_char;
+        if (c < self->utf8_min || c > 0x10ffff 
+             || (c >= 0xd800 && c < 0xe000))
+          c = VT_REPLACEMENT;
+        vtparser_print (self, c);
+        }
+      }
+    return;
+    }
+
+  // A character that ends before it is complete is invalid
+  if (self->utf8_needed)
+    {
+    self->utf8_needed = 0;
+    vtparser_print (self, VT_REPLACEMENT);
+    }
+  if (b < 0x80)
+    vtparser_print (self, b);
+  else if (b >= 0xc2 && b < 0xe0)
+    {
+    self->utf8_char = b & 0x1f;
+    self->utf8_needed = 1;
+    self->utf8_min = 0x80;
+    }
+  else if (b >= 0xe0 && b < 0xf0)
+    {
+    self->utf8_char = b & 0x0f;
+    self->utf8_needed = 2;
+    self->utf8_min = 0x800;
+    }
+  else if (b >= 0xf0 && b < 0xf5)
+    {
+    self->utf8_char = b & 0x07;
+    self->utf8_needed = 3;
+    self->utf8_min = 0x10000;
+    }
+  else
+    vtparser_print (self, VT_REPLACEMENT);
+  }
+
+
+/*==========================================================================
+  vtparser_action
+*==========================================================================*/
+static void vtparser_action (VtParser *self, int action, BYTE b)
+  {
+  const VtParserHandler *h = &self->handler;
+  switch (action)
+    {
+    case VT_PRINT:
+      vtparser_utf8 (self, b);
+      break;
+    case VT_EXECUTE:
+      if (h->execute) h->execute (self->user, b);
+      break;
+    case VT_COLLECT:
+      if (self->n_intermediates < VTPARSER_MAX_INTERMEDIATES)
+        self->intermediates[self->n_intermediates++] = b;
+      break;
+    case VT_PARAM:
+      if (self->n_params == 0) self->n_params = 1;
+      if (b == ';')
+        {
+        if (self->n_params < VTPARSER_MAX_PARAMS)
+          self->params[self->n_params++] = 0;
+        }
+      else
+        {
+        int *p = &self->params[self->n_params - 1];
+        *p = *p * 10 + (b - '0');
+        if (*p > VT_MAX_PARAM) *p = VT_MAX_PARAM;
+        }
+      break;
+    case VT_ESC_DISPATCH:
+      if (h->esc_dispatch)
+        h->esc_dispatch (self->user, b, self->intermediates,
+          self->n_intermediates);
+      break;
+    case VT_CSI_DISPATCH:
+      if (h->csi_dispatch)
+        h->csi_dispatch (self->user, b, self->params, self->n_params,
+          self->intermediates, self->n_intermediates);
+      break;
+    }
+  }
+
+
+/*==========================================================================
+  vtparser_feed
+*==========================================================================*/
+void vtparser_feed (VtParser *self, const BYTE *data, size_t len)
+  {
+  size_t i = 0;
+  while (i < len)
+    {
+    if (self->state == VT_GROUND && self->utf8_needed == 0)
+      {
+      // The fast path, for plain ASCII text
+      if (self->handler.print)
+        {
+        while (i < len && data[i] >= 0x20 && data[i] < 0x7f)
+          self->handler.print (self->user, data[i++]);
+        }
+      else
+        {
+        while (i < len && data[i] >= 0x20 && data[i] < 0x7f) i++;
+        }
+      if (i == len) break;
+      }
+
+    BYTE b = data[i++];
+    BYTE entry = self->table[self->state][b];
+    int next = entry >> 4;
+    // A control character in the middle of a UTF-8 character ends it
+    if (self->utf8_needed && (entry & 0x0f) != VT_PRINT)
+      {
+      self->utf8_needed = 0;
+      vtparser_print (self, VT_REPLACEMENT);
+      }
+    vtparser_action (self, entry & 0x0f, b);
+    if (next != self->state)
+      {
+      self->state = next;
+      // A new sequence starts with no parameters or intermediates
+      if (next == VT_ESCAPE || next == VT_CSI_ENTRY)
+        {
+        memset (self->params, 0, sizeof (self->params));
+        self->n_params = 0;
+        self->n_intermediates = 0;
+        }
+      }
+    }
+  }
+
@@ -0,0 +1,78 @@
+/*============================================================================
+
+  vtparser.h
+
+  A "class" that splits a stream of bytes, as written to a VT100-style
+  terminal, into printable characters, control characters, and escape
+  sequences. It interprets nothing itself: each item is passed to a
+  handler, which decides what it means.
+
+  The parser is a state machine, driven by a table that gives the
+  action and next state for every byte in every state, following the
+  well-known design by Paul Williams for DEC-compatible terminals.
+  Bytes can arrive in pieces of any size -- an escape sequence split
+  between two reads is handled correctly -- and nothing is allocated
+  while parsing. Printable text is UTF-8, and is passed to the
+  handler as Unicode characters.
+
+  The usual sequence of operations is
+  vtparser_create
+  vtparser_feed (probably many times)
+  vtparser_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include <stddef.h>
+#include "defs.h"
+
+// The most parameters and intermediate characters that are kept for
+//  one sequence -- any more are ignored
+#define VTPARSER_MAX_PARAMS        16
+#define VTPARSER_MAX_INTERMEDIATES 4
+
+/** The functions that are called for the items the parser finds.
+    Any of them can be NULL, if the handler is not interested. */
+typedef struct _VtParserHandler
+  {
+  /** A printable character. Invalid UTF-8 is passed as U+FFFD. */
+  void (*print) (void *user, UTF32 c);
+  /** A C0 control character, like newline or backspace. */
+  void (*execute) (void *user, BYTE c);
+  /** An escape sequence, like ESC 7. The intermediates are the
+      characters between the ESC and the final character. */
+  void (*esc_dispatch) (void *user, BYTE final,
+         const BYTE *intermediates, int n_intermediates);
+  /** A control sequence, like ESC [ 1 ; 31 m. Parameters that are
+      not given are 0. Private markers, like the '?' in ESC [ ? 25 l,
+      are passed as intermediates. */
+  void (*csi_dispatch) (void *user, BYTE final, const int *params,
+         int n_params, const BYTE *intermediates, int n_intermediates);
+  } VtParserHandler;
+
+struct _VtParser;
+typedef struct _VtParser VtParser;
+
+BEGIN_DECLS
+
+/** Create a parser that passes what it finds to the handler, along
+    with the user pointer. The handler structure is copied. This
+    method always succeeds, and must eventually be followed by a call
+    to vtparser_destroy(). */
+VtParser        *vtparser_create (const VtParserHandler *handler,
+                   void *user);
+
+/** Free the parser. */
+void             vtparser_destroy (VtParser *self);
+
+/** Parse len bytes. The bytes need not end at the end of a character
+    or sequence; the parser carries on where it left off with the next
+    call. */
+void             vtparser_feed (VtParser *self, const BYTE *data,
+                   size_t len);
+
+END_DECLS
+
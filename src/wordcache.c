@@ -0,0 +1,299 @@
+/*============================================================================
+
+  wordcache.c
+
+  Implementation of the "methods" defined in wordcache.h.
+
+  The cache is a hash table of words, each of which is also on a
+  doubly-linked list in order of use. A hit moves the word to the head
+  of the list; when the cache is full, the word at the tail of the
+  list is evicted to make room for a new one. All these operations
+  take constant time.
+
+  The key is the text of the word, together with the face, its pixel
+  size, and the style. The face and size are needed because the same
+  cache could be used with different glyph caches.
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stdint.h>
+#include <limits.h>
+#include "defs.h"
+#include "log.h"
+#include "wordcache.h"
+#include "grapheme.h"
+
+struct _WordCache
+  {
+  int capacity; // Maximum number of words to hold
+  int count; // Number of words currently held
+  int n_buckets; // Size of the hash table -- a power of two
+  CachedWord **buckets;
+  CachedWord *lru_head; // Most-recently-used word
+  CachedWord *lru_tail; // Least-recently-used word
+  int hits;
+  int misses;
+  };
+
+
+/*==========================================================================
+  wordcache_hash
+
+  FNV-1a hash of the word and its rendering parameters
+
+*==========================================================================*/
+static unsigned int wordcache_hash (const UTF32 *s, int len, FT_Face face,
+      int size, int style)
+  {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < len; i++)
+    {
+    h ^= (uint32_t)s[i];
+    h *= 16777619u;
+    }
+  h ^= (uint32_t)(uintptr_t)face;
+  h *= 16777619u;
+  h ^= (uint32_t)(size << 4 | style);
+  h *= 16777619u;
+  return h;
+  }
+
+
+/*==========================================================================
+  wordcache_create
+*==========================================================================*/
+WordCache *wordcache_create (int capacity)
+  {
+  LOG_IN
+  WordCache *self = malloc (sizeof (WordCache));
+  memset (self, 0, sizeof (WordCache));
+  self->capacity = capacity > 0 ? capacity : WORDCACHE_DEFAULT_CAPACITY;
+  // Keep the load factor no higher than about 0.5
+  self->n_buckets = 16;
+  while (self->n_buckets < self->capacity * 2) self->n_buckets *= 2;
+  self->buckets = calloc (self->n_buckets, sizeof (CachedWord *));
+  LOG_OUT
+  return self;
+  }
+
+
+/*==========================================================================
+  wordcache_free_word
+*==========================================================================*/
+static void wordcache_free_word (CachedWord *word)
+  {
+  free (word->text);
+  free (word->coverage);
+  free (word);
+  }
+
+
+/*==========================================================================
+  wordcache_destroy
+*==========================================================================*/
+void wordcache_destroy (WordCache *self)
+  {
+  LOG_IN
+  if (self)
+    {
+    log_debug ("Word cache: %d hits, %d misses", self->hits, self->misses);
+    CachedWord *word = self->lru_head;
+    while (word)
+      {
+      CachedWord *next = word->lru_next;
+      wordcache_free_word (word);
+      word = next;
+      }
+    free (self->buckets);
+    free (self);
+    }
+  LOG_OUT
+  }
+
+
+/*==========================================================================
+  wordcache_unlink_lru
+*==========================================================================*/
+static void wordcache_unlink_lru (WordCache *self, CachedWord *word)
+  {
+  if (word->lru_prev)
+    word->lru_prev->lru_next = word->lru_next;
+  else
+    self->lru_head = word->lru_next;
+  if (word->lru_next)
+    word->lru_next->lru_prev = word->lru_prev;
+  else
+    self->lru_tail = word->lru_prev;
+  word->lru_prev = NULL;
+  word->lru_next = NULL;
+  }
+
+
+/*==========================================================================
+  wordcache_push_lru
+*==========================================================================*/
+static void wordcache_push_lru (WordCache *self, CachedWord *word)
+  {
+  word->lru_prev = NULL;
+  word->lru_next = self->lru_head;
+  if (self->lru_head) self->lru_head->lru_prev = word;
+  self->lru_head = word;
+  if (!self->lru_tail) self->lru_tail = word;
+  }
+
+
+/*==========================================================================
+  wordcache_evict
+
+  Remove the least-recently-used word from the cache
+
+*==========================================================================*/
+static void wordcache_evict (WordCache *self)
+  {
+  CachedWord *word = self->lru_tail;
+  if (!word) return;
+  wordcache_unlink_lru (self, word);
+  CachedWord **p = &self->buckets[word->hash & (self->n_buckets - 1)];
+  while (*p != word) p = &(*p)->hash_next;
+  *p = word->hash_next;
+  wordcache_free_word (word);
+  self->count--;
+  }
+
+
+/*==========================================================================
+  wordcache_compose
+
+  Build the coverage bitmap for a word from the glyph cache. We need
+  two passes over the glyphs: one to find their positions, and the 
+  size of the bitmap, and one to draw into it. Both are cheap, as the
+  glyphs are (or will be) in the glyph cache. 
+
+  The marks in a grapheme cluster, like combining accents, are placed
+  over the character before them, as layout_measure_word() places them.
+
+*==========================================================================*/
+static void wordcache_compose (CachedWord *word, GlyphCache *glyphs)
+  {
+  int left = INT_MAX, top = INT_MAX, right = INT_MIN, bottom = INT_MIN;
+  int pen = 0;
+  const CachedGlyph *prev = NULL; // The last glyph that was not a mark
+  int base = 0; // Where it was placed
+  int *glyph_x = malloc (word->len * sizeof (int));
+  GraphemeState state;
+  grapheme_init (&state);
+
+  for (int i = 0; i < word->len; i++)
+    {
+    const CachedGlyph *g = glyphcache_get (glyphs, word->text[i],
+      word->style);
+    // Every character must be seen by the state, including the first
+    BOOL boundary = grapheme_is_boundary (&state, word->text[i]);
+    if (!boundary && prev && grapheme_is_mark (word->text[i]))
+      {
+      int x = base + (prev->advance - g->advance) / 2;
+      glyph_x[i] = x > 0 ? x : 0;
+      }
+    else
+      {
+      if (prev) pen += glyphcache_get_kerning (glyphs, prev, g);
+      glyph_x[i] = base = pen;
+      pen += g->advance;
+      prev = g;
+      }
+    if (g->buffer)
+      {
+      int gx = glyph_x[i] + g->x_off;
+      if (gx < left) left = gx;
+      if (gx + g->width > right) right = gx + g->width;
+      if (g->y_off < top) top = g->y_off;
+      if (g->y_off + g->rows > bottom) bottom = g->y_off + g->rows;
+      }
+    }
+
+  word->advance = pen;
+  if (right <= left || bottom <= top) 
+    {
+    free (glyph_x);
+    return; // Nothing visible
+    }
+
+  word->x_off = left;
+  word->y_off = top;
+  word->width = right - left;
+  word->rows = bottom - top;
+  word->coverage = calloc (word->width * word->rows, 1);
+
+  // Adjacent glyphs can overlap, particularly in italic, so we combine
+  //  coverage by taking the larger value, rather than overwriting.
+  for (int i = 0; i < word->len; i++)
+    {
+    const CachedGlyph *g = glyphcache_get (glyphs, word->text[i],
+      word->style);
+    for (int r = 0; r < g->rows; r++)
+      {
+      const BYTE *src = g->buffer + r * g->pitch;
+      BYTE *dest = word->coverage + (g->y_off - top + r) * word->width
+        + glyph_x[i] + g->x_off - left;
+      for (int c = g->spans[r].start; c < g->spans[r].end; c++)
+        if (src[c] > dest[c]) dest[c] = src[c];
+      }
+    }
+  free (glyph_x);
+  }
+
+
+/*==========================================================================
+  wordcache_get
+*==========================================================================*/
+const CachedWord *wordcache_get (WordCache *self, GlyphCache *glyphs,
+      const UTF32 *s, int len, int style)
+  {
+  FT_Face face = glyphcache_get_face (glyphs);
+  int size = face->size->metrics.y_ppem;
+  unsigned int h = wordcache_hash (s, len, face, size, style);
+  CachedWord **bucket = &self->buckets[h & (self->n_buckets - 1)];
+
+  for (CachedWord *word = *bucket; word; word = word->hash_next)
+    {
+    if (word->hash == h && word->len == len && word->face == face
+        && word->size == size && word->style == style
+        && memcmp (word->text, s, len * sizeof (UTF32)) == 0)
+      {
+      self->hits++;
+      if (word != self->lru_head)
+        {
+        wordcache_unlink_lru (self, word);
+        wordcache_push_lru (self, word);
+        }
+      return word;
+      }
+    }
+
+  self->misses++;
+  if (self->count >= self->capacity) wordcache_evict (self);
+
+  CachedWord *word = malloc (sizeof (CachedWord));
+  memset (word, 0, sizeof (CachedWord));
+  word->text = malloc (len * sizeof (UTF32));
+  memcpy (word->text, s, len * sizeof (UTF32));
+  word->len = len;
+  word->face = face;
+  word->size = size;
+  word->style = style;
+  word->hash = h;
+  wordcache_compose (word, glyphs);
+
+  word->hash_next = *bucket;
+  *bucket = word;
+  wordcache_push_lru (self, word);
+  self->count++;
+  return word;
+  }
+
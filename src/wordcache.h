@@ -0,0 +1,77 @@
+/*============================================================================
+
+  wordcache.h
+
+  A "class" that keeps fully-composed coverage bitmaps for whole words,
+  so that a word that is drawn repeatedly can be written to the
+  framebuffer as a single rectangle, rather than glyph-by-glyph.
+
+  The cache holds a fixed maximum number of words; when it is full, the
+  least-recently-used word is discarded.
+
+  The usual sequence of operations is
+  wordcache_create
+  wordcache_get (probably many times)
+  wordcache_destroy
+
+  Copyright (c)2020 Kevin Boone, GPL v3.0
+
+============================================================================*/
+
+#pragma once
+
+#include "defs.h"
+#include "glyphcache.h"
+
+// The number of words to keep, if the caller doesn't care
+#define WORDCACHE_DEFAULT_CAPACITY 512
+
+struct _WordCache;
+typedef struct _WordCache WordCache;
+
+/** A composed word. (x_off,y_off) is the position of the top-left
+    corner of the coverage bitmap, relative to the top-left corner of
+    the cell occupied by the first character of the word. The bitmap
+    is the smallest rectangle that encloses all the glyphs, so
+    x_off and y_off can be negative, and width can be larger or smaller
+    than advance. */
+typedef struct _CachedWord
+  {
+  UTF32 *text; // The characters of the word -- not null-terminated
+  int len; // The number of characters in text
+  FT_Face face; // The face the word was composed from
+  int size; // The pixel size of the face when the word was composed
+  int style; // GLYPH_STYLE_XXX flags
+  unsigned int hash; // Hash of all the above, to speed up comparisons
+  int x_off; // Horizontal offset of the bitmap from the pen position
+  int y_off; // Vertical offset of the bitmap from the cell top
+  int width; // Width of the bitmap, which is also its pitch
+  int rows; // Height of the bitmap
+  int advance; // Distance to move the pen after drawing, with kerning
+  BYTE *coverage; // 8-bit coverage values, or NULL if width or rows are 0
+  struct _CachedWord *hash_next; // Next word in the same hash bucket
+  struct _CachedWord *lru_prev; // Next more-recently-used word
+  struct _CachedWord *lru_next; // Next less-recently-used word
+  } CachedWord;
+
+BEGIN_DECLS
+
+/** Create a new, empty cache that will hold at most capacity words.
+    This method always succeeds, and must eventually be followed by a
+    call to wordcache_destroy(). */
+WordCache         *wordcache_create (int capacity);
+
+/** Free all the cached words, and the cache itself. */
+void               wordcache_destroy (WordCache *self);
+
+/** Get the composed bitmap for the len characters in s, using glyphs
+    of the specified style from the glyph cache. If the word is
+    not already in the cache, it is composed from the individual glyphs,
+    with kerning applied between them. The word remains owned by the
+    cache, and is only valid until the next call to wordcache_get(),
+    which might evict it. */
+const CachedWord  *wordcache_get (WordCache *self, GlyphCache *glyphs,
+                      const UTF32 *s, int len, int style);
+
+END_DECLS
+
@@ -0,0 +1,286 @@
+#!/usr/bin/perl
+#============================================================================
+#
+#  unicode_tables.pl
+#
+#  Generate a C header with the tables of Unicode character properties
+#  that one of fbtextdemo's modules needs, from the copy of the Unicode
+#  Character Database that comes with Perl. This is run by the Makefile,
+#  so the tables always match the Unicode version of the Perl that 
+#  builds the program.
+#
+#  usage: unicode_tables.pl table > build/table_table.h
+#
+#  Each property is stored in a two-stage table: the code point, shifted
+#  right, indexes the first stage, which gives the start of a block of
+#  the second stage, which the low bits of the code point index. Blocks
+#  that are the same -- and most are, because most of the code space is
+#  unassigned or in large uniform ranges -- are stored only once. The
+#  block size is chosen to make the tables as small as possible.
+#
+#  Copyright (c)2020 Kevin Boone, GPL v3.0
+#
+#============================================================================
+
+use strict;
+use warnings;
+use Unicode::UCD qw(prop_invmap);
+use Unicode::Normalize ();
+
+my $MAX_CODE = 0x110000;
+
+#============================================================================
+#  property_string
+#
+#  Get the values of a property for every code point, as a string with
+#  one character per code point, using the value map, which gives a
+#  number for each value name. Values that are not in the map are 
+#  given the number $default.
+#============================================================================
+sub property_string
+  {
+  my ($property, $map, $default) = @_;
+  my ($ranges, $values) = prop_invmap ($property);
+  die "Unknown property $property\n" unless $ranges;
+  my $s = '';
+  for (my $i = 0; $i < @$ranges; $i++)
+    {
+    my $start = $ranges->[$i];
+    last if $start >= $MAX_CODE;
+    my $end = $i + 1 < @$ranges ? $ranges->[$i + 1] : $MAX_CODE;
+    my $v = $map->{$values->[$i]};
+    $v = $default unless defined $v;
+    $s .= chr ($v) x ($end - $start);
+    }
+  return $s;
+  }
+
+#============================================================================
+#  emit_enum
+#
+#  Write a C enum of the names, in capitals, with the prefix, numbered
+#  in order
+#============================================================================
+sub emit_enum
+  {
+  my ($prefix, @names) = @_;
+  print "enum\n  {\n";
+  print "  $prefix\U$_\E,\n" for @names;
+  print "  ${prefix}COUNT\n  };\n\n";
+  }
+
+#============================================================================
+#  emit_array
+#============================================================================
+sub emit_array
+  {
+  my ($type, $name, @values) = @_;
+  print "static const $type ${name}[", scalar (@values), "] =\n  {\n";
+  for (my $i = 0; $i < @values; $i += 16)
+    {
+    my $last = $i + 15 < $#values ? $i + 15 : $#values;
+    print "  ", join (", ", @values[$i..$last]), 
+      $last < $#values ? ",\n" : "\n";
+    }
+  print "  };\n\n";
+  }
+
+#============================================================================
+#  emit_two_stage
+#
+#  Write the two-stage table for a property string, and a lookup
+#  function called $name, which returns the value for a code point,
+#  or 0 for a value that is not a code point.
+#============================================================================
+sub emit_two_stage
+  {
+  my ($name, $s) = @_;
+
+  my ($best_shift, $best_size, $best_stage1, $best_stage2);
+  for my $shift (4..10)
+    {
+    my $block = 1 << $shift;
+    my (%index, @stage1, @stage2);
+    for (my $c = 0; $c < $MAX_CODE; $c += $block)
+      {
+      my $b = substr ($s, $c, $block);
+      if (!defined $index{$b})
+        {
+        $index{$b} = scalar (@stage2);
+        push @stage2, map { ord } split //, $b;
+        }
+      push @stage1, $index{$b} >> $shift;
+      }
+    my $n_blocks = @stage2 >> $shift;
+    my $size = @stage2 + @stage1 * ($n_blocks > 256 ? 2 : 1);
+    if (!defined $best_size || $size < $best_size)
+      {
+      ($best_shift, $best_size, $best_stage1, $best_stage2) 
+        = ($shift, $size, \@stage1, \@stage2);
+      }
+    }
+
+  my $uc = uc $name;
+  my $max = sprintf ("0x%X", $MAX_CODE);
+  my $stage1_type = @$best_stage2 >> $best_shift > 256 
+    ? "uint16_t" : "uint8_t";
+  print "// $best_size bytes, in blocks of ", 1 << $best_shift, "\n";
+  print "#define ${uc}_SHIFT $best_shift\n\n";
+  emit_array ($stage1_type, "${name}_stage1", @$best_stage1);
+  emit_array ("uint8_t", "${name}_stage2", @$best_stage2);
+  print <<"END";
+static inline int $name (uint32_t c)
+  {
+  if (c >= $max) return 0;
+  int block = ${name}_stage1[c >> ${uc}_SHIFT];
+  return ${name}_stage2[(block << ${uc}_SHIFT) 
+    + (c & ((1 << ${uc}_SHIFT) - 1))];
+  }
+
+END
+  }
+
+#============================================================================
+#  linebreak_table
+#
+#  The line breaking classes of UAX #14, resolved as rule LB1 says: AI,
+#  SG, and XX become AL; SA becomes CM for combining marks, and AL
+#  otherwise; CJ becomes NS. AL is first, so that it is the value for
+#  anything that is not a code point.
+#============================================================================
+sub linebreak_table
+  {
+  my @classes = qw(AL BK CR LF CM NL WJ ZW GL SP ZWJ B2 BA BB HY CB CL CP
+    EX IN NS OP QU IS NU PO PR SY EB EM H2 H3 HL ID JL JV JT RI);
+  my %map;
+  @map{@classes} = (0..$#classes);
+  $map{AI} = $map{SG} = $map{Unknown} = $map{AL};
+  $map{CJ} = $map{NS};
+  $map{SA} = 255; # Resolved below
+  my $s = property_string ("Line_Break", \%map, $map{AL});
+
+  my %marks = (Mn => 1, Mc => 2);
+  my $gc = property_string ("General_Category", \%marks, 0);
+  my $sa = chr (255);
+  while ($s =~ /$sa/g)
+    {
+    my $c = pos ($s) - 1;
+    substr ($s, $c, 1) = chr (ord (substr ($gc, $c, 1)) 
+      ? $map{CM} : $map{AL});
+    }
+
+  emit_enum ("LB_", @classes);
+  emit_two_stage ("linebreak_class", $s);
+  }
+
+#============================================================================
+#  grapheme_table
+#
+#  The grapheme cluster break property of UAX #29, with the characters
+#  that are Extended_Pictographic, and otherwise Other, given a value
+#  of their own, since rule GB11 needs to know about them. Other is 
+#  first, so that it is the value for anything that is not a code 
+#  point.
+#============================================================================
+sub grapheme_table
+  {
+  my @classes = qw(Other CR LF Control Extend ZWJ RI Prepend SpacingMark
+    L V T LV LVT ExtPict);
+  my %map;
+  @map{@classes} = (0..$#classes);
+  $map{Regional_Indicator} = $map{RI};
+  my $s = property_string ("Grapheme_Cluster_Break", \%map, $map{Other});
+
+  my %yes = (Y => 1);
+  my $pictographic = property_string ("Extended_Pictographic", \%yes, 0);
+  my $yes = chr (1);
+  while ($pictographic =~ /$yes/g)
+    {
+    my $c = pos ($pictographic) - 1;
+    substr ($s, $c, 1) = chr ($map{ExtPict}) 
+      if ord (substr ($s, $c, 1)) == $map{Other};
+    }
+
+  emit_enum ("GCB_", @classes);
+  emit_two_stage ("grapheme_class", $s);
+  }
+
+#============================================================================
+#  normalize_table
+#
+#  The tables that Normalization Form C needs: the NFC quick check 
+#  property, with Yes first, so that it is the value for anything that
+#  is not a code point; the canonical combining classes; the full 
+#  canonical decompositions, as a sorted list of characters, with the 
+#  start of each one's decomposition in a list of all of them; and the
+#  pairs of characters that compose to a primary composite, as a sorted
+#  list of keys, with the composite for each. Hangul syllables are left
+#  out of the last two, because they are decomposed and composed by 
+#  arithmetic. The characters are int32_t, the same type as the UTF32
+#  that fbtextdemo uses for them.
+#============================================================================
+sub normalize_table
+  {
+  my @values = qw(Yes No Maybe);
+  my %map;
+  @map{@values} = (0..$#values);
+  $map{Y} = $map{Yes}; $map{N} = $map{No}; $map{M} = $map{Maybe};
+  my $qc = property_string ("NFC_Quick_Check", \%map, $map{Yes});
+
+  my %classes = map { $_ => $_ } (0..255);
+  my $ccc = property_string ("Canonical_Combining_Class", \%classes, 0);
+
+  my (@decomposed, @starts, @chars, %composites);
+  my $max = 3; # A Hangul syllable decomposes to at most three jamo
+  my ($ranges, $mappings) = prop_invmap ("Decomposition_Mapping");
+  for (my $i = 0; $i < @$ranges; $i++)
+    {
+    next if !ref $mappings->[$i] && $mappings->[$i] eq "0";
+    my $end = $i + 1 < @$ranges ? $ranges->[$i + 1] : $MAX_CODE;
+    for my $c ($ranges->[$i] .. $end - 1)
+      {
+      next if $c >= 0xAC00 && $c <= 0xD7A3;
+      my $canon = Unicode::Normalize::getCanon ($c);
+      next unless defined $canon;
+      push @decomposed, $c;
+      push @starts, scalar (@chars);
+      push @chars, map { ord } split //, $canon;
+      $max = length ($canon) if length ($canon) > $max;
+      my $mapping = $mappings->[$i];
+      $composites{($mapping->[0] << 21) | $mapping->[1]} = $c
+        if ref $mapping && @$mapping == 2 
+          && !Unicode::Normalize::isComp_Ex ($c);
+      }
+    }
+  push @starts, scalar (@chars);
+  my @pairs = sort { $a <=> $b } keys %composites;
+
+  emit_enum ("NFC_", @values);
+  emit_two_stage ("nfc_quick_check", $qc);
+  emit_two_stage ("combining_class", $ccc);
+  print "#define DECOMPOSITION_MAX $max\n\n";
+  emit_array ("int32_t", "decomposed", @decomposed);
+  emit_array ("uint16_t", "decomposition_start", @starts);
+  emit_array ("int32_t", "decomposition", @chars);
+  emit_array ("uint64_t", "composition_pair", @pairs);
+  emit_array ("int32_t", "composite", map { $composites{$_} } @pairs);
+  }
+
+#============================================================================
+#  main
+#============================================================================
+my %tables = 
+  (
+  linebreak => \&linebreak_table,
+  grapheme => \&grapheme_table,
+  normalize => \&normalize_table,
+  );
+
+my $table = shift @ARGV;
+die "usage: $0 {" . join ("|", sort keys %tables) . "}\n"
+  unless defined $table && $tables{$table};
+
+print "/* Generated by tools/unicode_tables.pl from Unicode ", 
+  Unicode::UCD::UnicodeVersion (), " -- do not edit */\n\n";
+print "#pragma once\n\n#include <stdint.h>\n\n";
+$tables{$table}->();